@@ -0,0 +1,170 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <util.h>
+
+#include "arena.h"
+
+#ifdef DEBUG_ARENA
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+#define ARENA_BLOCKSIZE	(64 * 1024)
+#define ARENA_ALIGN	16
+
+struct arena_block {
+	struct arena_block	*next;
+	size_t			 size;
+	size_t			 used;
+	/* Keep data[] aligned to ARENA_ALIGN */
+	size_t			 pad;
+	char			 data[];
+};
+
+struct arena {
+	struct arena_block	*first;
+	struct arena_block	*current;
+	size_t			 allocated;
+};
+
+static struct arena_block *
+arena_newblock(size_t size);
+
+struct arena *
+arena_new(void)
+{
+	struct arena *this;
+
+	this = ecalloc(1, sizeof(*this));
+
+	this->first = arena_newblock(ARENA_BLOCKSIZE);
+	this->current = this->first;
+
+	return this;
+}
+
+void
+arena_delete(struct arena *this)
+{
+	struct arena_block *b, *next;
+
+	assert(this);
+
+	for (b = this->first; b != NULL; b = next) {
+		next = b->next;
+		free(b);
+	}
+
+	free(this);
+}
+
+void *
+arena_alloc(struct arena *this, size_t size)
+{
+	struct arena_block *b, *nb;
+	void *p;
+
+	assert(this);
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	b = this->current;
+	while (b->size - b->used < size) {
+		/* Reuse blocks retained by a previous arena_reset() */
+		if (b->next != NULL && b->next->size >= size) {
+			b = b->next;
+			b->used = 0;
+			continue;
+		}
+
+		nb = arena_newblock(size > ARENA_BLOCKSIZE ?
+		    size : ARENA_BLOCKSIZE);
+		nb->next = b->next;
+		b->next = nb;
+		b = nb;
+	}
+	this->current = b;
+
+	p = &b->data[b->used];
+	b->used += size;
+	this->allocated += size;
+
+	DPRINTF(("%s(): arena=%p size=%zu p=%p\n", __func__, this, size, p));
+
+	return p;
+}
+
+void
+arena_reset(struct arena *this)
+{
+
+	assert(this);
+
+	this->current = this->first;
+	this->current->used = 0;
+	this->allocated = 0;
+}
+
+size_t
+arena_allocated(struct arena *this)
+{
+
+	assert(this);
+
+	return this->allocated;
+}
+
+/* Private functions */
+
+struct arena_block *
+arena_newblock(size_t size)
+{
+	struct arena_block *b;
+
+	b = emalloc(sizeof(*b) + size);
+
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+
+	DPRINTF(("%s(): block=%p size=%zu\n", __func__, b, size));
+
+	return b;
+}
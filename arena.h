@@ -29,15 +29,32 @@
  * SUCH DAMAGE.
  */
 
-#ifndef __MY_GETLINE_H__
-#define __MY_GETLINE_H__
+#ifndef __EVALVAL_ARENA_H__
+#define __EVALVAL_ARENA_H__
 
-#include <sys/cdefs.h>
-#include <stdio.h>
+#include <stddef.h>
 
-__BEGIN_DECLS
-char *
-my_getline(FILE *stream);
-__END_DECLS
+/*
+ * Region allocator.  Objects are carved out of large contiguous blocks and
+ * are never freed individually; arena_reset() releases everything at once
+ * and keeps the blocks around for the next round of allocations.
+ */
+
+struct arena;
+
+struct arena *
+arena_new(void);
+
+void
+arena_delete(struct arena *this);
+
+void *
+arena_alloc(struct arena *this, size_t size);
+
+void
+arena_reset(struct arena *this);
+
+size_t
+arena_allocated(struct arena *this);
 
-#endif /* __MY_GETLINE_H__ */
+#endif /* __EVALVAL_ARENA_H__ */
@@ -34,12 +34,14 @@ __RCSID("$NetBSD$");
 
 #include <assert.h>
 #include <ctype.h>
+#include <inttypes.h>
 #include <setjmp.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <util.h>
 
+#include "arena.h"
 #include "astnode.h"
 
 #ifdef DEBUG_ASTNODE
@@ -50,20 +52,69 @@ __RCSID("$NetBSD$");
 
 struct astnode {
 	enum astnode_type	 type;
-	double			 value;
+	uint32_t		 id;	/* 0 unless shared in a DAG */
+	union {
+		double		 value;		/* astnode_type_number */
+		size_t		 index;		/* astnode_type_variable */
+	};
 	struct astnode		*left;
 	struct astnode		*right;
 };
 
+/* Slots are empty unless stamped with the current generation */
+struct astnode_slot {
+	struct astnode		*node;
+	uint32_t		 generation;
+};
+
+struct astnode_table {
+	struct arena		*arena;
+	struct astnode_slot	*slots;
+	size_t			 size;		/* a power of 2 */
+	size_t			 count;
+	uint32_t		 generation;
+	uint32_t		 nshared;
+};
+
+#define ASTNODE_TABLESIZE	256
+
+static struct astnode_slot *
+astnode_table_lookup(struct astnode_table *this, enum astnode_type type,
+                     uint64_t key1, uint64_t key2);
+
+static struct astnode *
+astnode_table_insert(struct astnode_table *this, struct astnode_slot *slot,
+                     struct astnode *n);
+
+static struct astnode *
+astnode_table_share(struct astnode_table *this, struct astnode *n);
+
+static uint64_t
+astnode_table_hash(enum astnode_type type, uint64_t key1, uint64_t key2);
+
+static int
+astnode_table_match(struct astnode *n, enum astnode_type type,
+                    uint64_t key1, uint64_t key2);
+
+static void
+astnode_table_grow(struct astnode_table *this);
+
+static uint64_t
+astnode_bits(double value);
+
 struct astnode *
-astnode_new_node(enum astnode_type type, struct astnode *left,
-                struct astnode *right)
+astnode_new_node(struct arena *arena, enum astnode_type type,
+                 struct astnode *left, struct astnode *right)
 {
 	struct astnode *this;
 
-	this = ecalloc(1, sizeof(*this));
+	assert(arena);
+
+	this = arena_alloc(arena, sizeof(*this));
 
 	this->type = type;
+	this->id = 0;
+	this->value = 0;
 	this->left = left;
 	this->right = right;
 
@@ -71,41 +122,171 @@ astnode_new_node(enum astnode_type type, struct astnode *left,
 }
 
 struct astnode *
-astnode_new_unarynode(struct astnode *left)
+astnode_new_unarynode(struct arena *arena, struct astnode *left)
 {
 	struct astnode *this;
 
+	assert(arena);
 	assert(left);
 
-	this = ecalloc(1, sizeof(*this));
+	this = arena_alloc(arena, sizeof(*this));
 
 	this->type = astnode_type_unaryminus;
+	this->id = 0;
+	this->value = 0;
 	this->left = left;
+	this->right = NULL;
 
 	return this;
 }
 
 struct astnode *
-astnode_new_numbernode(double value)
+astnode_new_numbernode(struct arena *arena, double value)
 {
 	struct astnode *this;
 
-	this = ecalloc(1, sizeof(*this));
+	assert(arena);
+
+	this = arena_alloc(arena, sizeof(*this));
 
 	this->type = astnode_type_number;
+	this->id = 0;
 	this->value = value;
+	this->left = NULL;
+	this->right = NULL;
+
+	return this;
+}
+
+struct astnode *
+astnode_new_variablenode(struct arena *arena, size_t index)
+{
+	struct astnode *this;
+
+	assert(arena);
+
+	this = arena_alloc(arena, sizeof(*this));
+
+	this->type = astnode_type_variable;
+	this->id = 0;
+	this->index = index;
+	this->left = NULL;
+	this->right = NULL;
+
+	return this;
+}
+
+struct astnode_table *
+astnode_table_new(struct arena *arena)
+{
+	struct astnode_table *this;
+
+	assert(arena);
+
+	this = emalloc(sizeof(*this));
+	this->arena = arena;
+	this->size = ASTNODE_TABLESIZE;
+	this->slots = ecalloc(this->size, sizeof(*this->slots));
+	this->count = 0;
+	this->generation = 1;
+	this->nshared = 0;
 
 	return this;
 }
 
 void
-astnode_delete(struct astnode *this)
+astnode_table_delete(struct astnode_table *this)
 {
+
 	assert(this);
 
+	free(this->slots);
 	free(this);
 }
 
+/* Empties the table in constant time by moving to a new generation */
+void
+astnode_table_reset(struct astnode_table *this)
+{
+
+	assert(this);
+
+	if (++this->generation == 0) {
+		memset(this->slots, 0, this->size * sizeof(*this->slots));
+		this->generation = 1;
+	}
+	this->count = 0;
+	this->nshared = 0;
+}
+
+struct astnode *
+astnode_table_node(struct astnode_table *this, enum astnode_type type,
+                   struct astnode *left, struct astnode *right)
+{
+	struct astnode_slot *slot;
+
+	assert(this);
+	assert(left);
+	assert(right);
+
+	slot = astnode_table_lookup(this, type, (uintptr_t)left,
+	    (uintptr_t)right);
+	if (slot->generation == this->generation)
+		return astnode_table_share(this, slot->node);
+
+	return astnode_table_insert(this, slot,
+	    astnode_new_node(this->arena, type, left, right));
+}
+
+struct astnode *
+astnode_table_unarynode(struct astnode_table *this, struct astnode *left)
+{
+	struct astnode_slot *slot;
+
+	assert(this);
+	assert(left);
+
+	slot = astnode_table_lookup(this, astnode_type_unaryminus,
+	    (uintptr_t)left, 0);
+	if (slot->generation == this->generation)
+		return astnode_table_share(this, slot->node);
+
+	return astnode_table_insert(this, slot,
+	    astnode_new_unarynode(this->arena, left));
+}
+
+/* Numbers are told apart by bit pattern, so 0 and -0 stay distinct */
+struct astnode *
+astnode_table_numbernode(struct astnode_table *this, double value)
+{
+	struct astnode_slot *slot;
+
+	assert(this);
+
+	slot = astnode_table_lookup(this, astnode_type_number,
+	    astnode_bits(value), 0);
+	if (slot->generation == this->generation)
+		return slot->node;
+
+	return astnode_table_insert(this, slot,
+	    astnode_new_numbernode(this->arena, value));
+}
+
+struct astnode *
+astnode_table_variablenode(struct astnode_table *this, size_t index)
+{
+	struct astnode_slot *slot;
+
+	assert(this);
+
+	slot = astnode_table_lookup(this, astnode_type_variable, index, 0);
+	if (slot->generation == this->generation)
+		return slot->node;
+
+	return astnode_table_insert(this, slot,
+	    astnode_new_variablenode(this->arena, index));
+}
+
 enum astnode_type
 astnode_type(struct astnode *this)
 {
@@ -124,6 +305,16 @@ astnode_value(struct astnode *this)
 	return this->value;
 }
 
+size_t
+astnode_index(struct astnode *this)
+{
+
+	assert(this);
+	assert(this->type == astnode_type_variable);
+
+	return this->index;
+}
+
 struct astnode *
 astnode_left(struct astnode *this)
 {
@@ -142,15 +333,150 @@ astnode_right(struct astnode *this)
 	return this->right;
 }
 
+size_t
+astnode_id(struct astnode *this)
+{
+
+	assert(this);
+
+	return this->id;
+}
+
+/* Private functions */
+
+/*
+ * Open addressing with linear probing.  Returns the slot holding the node
+ * with the given key, or the empty slot where it belongs.  Interior nodes
+ * are keyed by the identity of their operands, which were themselves
+ * looked up first, so equal pointers mean equal subtrees.
+ */
+struct astnode_slot *
+astnode_table_lookup(struct astnode_table *this, enum astnode_type type,
+                     uint64_t key1, uint64_t key2)
+{
+	struct astnode_slot *slot;
+	size_t i, mask;
+
+	/* At most half full, so probes stay short and one is always empty */
+	if (this->count >= this->size / 2)
+		astnode_table_grow(this);
+
+	mask = this->size - 1;
+	for (i = astnode_table_hash(type, key1, key2) & mask;;
+	    i = (i + 1) & mask) {
+		slot = &this->slots[i];
+		if (slot->generation != this->generation ||
+		    astnode_table_match(slot->node, type, key1, key2))
+			return slot;
+	}
+}
+
+struct astnode *
+astnode_table_insert(struct astnode_table *this, struct astnode_slot *slot,
+                     struct astnode *n)
+{
+
+	slot->node = n;
+	slot->generation = this->generation;
+	this->count++;
+
+	return n;
+}
+
+/* A second reference to an interior node: number it for the evaluator */
+struct astnode *
+astnode_table_share(struct astnode_table *this, struct astnode *n)
+{
+
+	if (n->id == 0) {
+		assert(this->nshared < UINT32_MAX);
+		n->id = ++this->nshared;
+		DPRINTF(("%s(): node=%p id=%" PRIu32 "\n", __func__, n,
+		    n->id));
+	}
+
+	return n;
+}
+
+uint64_t
+astnode_table_hash(enum astnode_type type, uint64_t key1, uint64_t key2)
+{
+	uint64_t h;
+
+	h = (key1 ^ ((uint64_t)type << 59)) * UINT64_C(0x9e3779b97f4a7c15);
+	h = (h ^ (h >> 29) ^ key2) * UINT64_C(0xbf58476d1ce4e5b9);
+
+	return h ^ (h >> 32);
+}
+
+int
+astnode_table_match(struct astnode *n, enum astnode_type type,
+                    uint64_t key1, uint64_t key2)
+{
+
+	if (n->type != type)
+		return 0;
+
+	switch (type) {
+	case astnode_type_number:
+		return astnode_bits(n->value) == key1;
+	case astnode_type_variable:
+		return n->index == key1;
+	case astnode_type_unaryminus:
+		return (uintptr_t)n->left == key1;
+	default:
+		return (uintptr_t)n->left == key1 &&
+		    (uintptr_t)n->right == key2;
+	}
+}
+
+/* Doubles the table, carrying over the nodes of this generation only */
 void
-astnode_delete_tree(struct astnode *this)
+astnode_table_grow(struct astnode_table *this)
 {
+	struct astnode_slot *old, *slot;
+	struct astnode *n;
+	size_t i, oldsize;
+	uint64_t key1, key2;
+
+	old = this->slots;
+	oldsize = this->size;
+
+	this->size *= 2;
+	this->slots = ecalloc(this->size, sizeof(*this->slots));
+	this->count = 0;
+
+	for (i = 0; i < oldsize; i++) {
+		if (old[i].generation != this->generation)
+			continue;
+		n = old[i].node;
+		switch (n->type) {
+		case astnode_type_number:
+			key1 = astnode_bits(n->value);
+			key2 = 0;
+			break;
+		case astnode_type_variable:
+			key1 = n->index;
+			key2 = 0;
+			break;
+		default:
+			key1 = (uintptr_t)n->left;
+			key2 = (uintptr_t)n->right;
+			break;
+		}
+		slot = astnode_table_lookup(this, n->type, key1, key2);
+		(void)astnode_table_insert(this, slot, n);
+	}
+
+	free(old);
+}
 
-	if (this == NULL)
-		return;
+uint64_t
+astnode_bits(double value)
+{
+	uint64_t bits;
 
-	astnode_delete_tree(this->left);
-	astnode_delete_tree(this->right);
+	memcpy(&bits, &value, sizeof(bits));
 
-	free(this);
+	return bits;
 }
@@ -32,6 +32,8 @@
 #ifndef __EVALVAL_ASTNODE_H__
 #define __EVALVAL_ASTNODE_H__
 
+#include <stddef.h>
+
 enum astnode_type {
 	astnode_type_undefined,
 	astnode_type_plus,
@@ -39,23 +41,60 @@ enum astnode_type {
 	astnode_type_mul,
 	astnode_type_div,
 	astnode_type_unaryminus,
-	astnode_type_number
+	astnode_type_number,
+	astnode_type_variable
 };
 
+struct arena;
 struct astnode;
+struct astnode_table;
+
+/*
+ * Nodes are allocated from the given arena and live until it is reset or
+ * deleted; there is no per-node destructor.
+ */
+
+struct astnode *
+astnode_new_node(struct arena *arena, enum astnode_type type,
+                 struct astnode *left, struct astnode *right);
 
 struct astnode *
-astnode_new_node(enum astnode_type type, struct astnode *left,
-                 struct astnode *right);
+astnode_new_unarynode(struct arena *arena, struct astnode *left);
 
 struct astnode *
-astnode_new_unarynode(struct astnode *left);
+astnode_new_numbernode(struct arena *arena, double val);
 
 struct astnode *
-astnode_new_numbernode(double val);
+astnode_new_variablenode(struct arena *arena, size_t index);
+
+/*
+ * Hash-consing factory: structurally identical subtrees built through the
+ * same table are a single node, so an expression becomes a DAG.  The
+ * nodes still belong to the arena, and astnode_table_reset() must go
+ * along with arena_reset().  Interior nodes that are used more than once
+ * are numbered, see astnode_id().
+ */
+struct astnode_table *
+astnode_table_new(struct arena *arena);
 
 void
-astnode_delete(struct astnode *this);
+astnode_table_delete(struct astnode_table *this);
+
+void
+astnode_table_reset(struct astnode_table *this);
+
+struct astnode *
+astnode_table_node(struct astnode_table *this, enum astnode_type type,
+                   struct astnode *left, struct astnode *right);
+
+struct astnode *
+astnode_table_unarynode(struct astnode_table *this, struct astnode *left);
+
+struct astnode *
+astnode_table_numbernode(struct astnode_table *this, double val);
+
+struct astnode *
+astnode_table_variablenode(struct astnode_table *this, size_t index);
 
 enum astnode_type
 astnode_type(struct astnode *this);
@@ -63,13 +102,21 @@ astnode_type(struct astnode *this);
 double
 astnode_value(struct astnode *this);
 
+/* Index of an astnode_type_variable node into the variable bindings */
+size_t
+astnode_index(struct astnode *this);
+
 struct astnode *
 astnode_left(struct astnode *this);
 
 struct astnode *
 astnode_right(struct astnode *right);
 
-void
-astnode_delete_tree(struct astnode *this);
+/*
+ * Id of a node shared in a DAG, or 0 if it has a single parent.  Ids are
+ * numbered from 1 in each table generation.
+ */
+size_t
+astnode_id(struct astnode *this);
 
 #endif /* __EVALVAL_ASTNODE_H__ */
@@ -0,0 +1,731 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <paths.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <util.h>
+
+#include "calc.h"
+#include "input.h"
+#include "output.h"
+
+/*
+ * Synthetic workloads for evalval(1).  Every workload is a pure function
+ * of its seed, so two builds can be compared on identical input.
+ *
+ * Throughput and peak RSS are measured on the real evalval binary (main.c
+ * with its input, pipeline and output layers), fed from a file with its
+ * output discarded.  Per-line latency cannot be observed from outside, so
+ * it is measured here over calc_line(), the per-line path main.c runs.
+ * -t selects the arithmetic of both, so each backend of calc_settype()
+ * gets its own numbers.
+ */
+
+#ifdef DEBUG_EVALBENCH
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+#define EVALBENCH_LINES		50000
+#define EVALBENCH_RUNS		3
+#define EVALBENCH_SEED		1
+
+struct text {
+	char *s;
+	size_t len;
+	size_t size;
+};
+
+struct workload {
+	const char *name;
+	void (*gen)(uint64_t *, struct text *);
+};
+
+struct result {
+	size_t lines;
+	size_t bytes;
+	double seconds;
+	long maxrss;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+};
+
+static void
+usage(void) __dead;
+
+static uint64_t
+rng_next(uint64_t *state);
+
+static unsigned
+rng_uniform(uint64_t *state, unsigned n);
+
+static void
+text_putc(struct text *this, char c);
+
+static void
+text_printf(struct text *this, const char *fmt, ...) __printflike(2, 3);
+
+static void
+gen_number(uint64_t *rng, struct text *t);
+
+static void
+gen_op(uint64_t *rng, struct text *t);
+
+static void
+gen_short(uint64_t *rng, struct text *t);
+
+static void
+gen_flat(uint64_t *rng, struct text *t);
+
+static void
+gen_nested(uint64_t *rng, struct text *t);
+
+static void
+gen_unary(uint64_t *rng, struct text *t);
+
+static void
+gen_integer(uint64_t *rng, struct text *t);
+
+static void
+gen_mixed(uint64_t *rng, struct text *t);
+
+static void
+gen_malformed(uint64_t *rng, struct text *t);
+
+static void
+workload_generate(const struct workload *w, uint64_t seed, size_t lines,
+                  struct text *t);
+
+static int
+bench_spill(const struct text *t);
+
+static void
+bench_throughput(int fd, char **cmd, unsigned runs, struct result *r);
+
+static void
+bench_latency(int fd, enum calc_type type, struct result *r);
+
+static int
+cmp_uint64(const void *a, const void *b);
+
+static uint64_t
+nsecs(void);
+
+static const struct workload workloads[] = {
+	{ "short",	gen_short },
+	{ "flat",	gen_flat },
+	{ "nested",	gen_nested },
+	{ "unary",	gen_unary },
+	{ "integer",	gen_integer },
+	{ "mixed",	gen_mixed },
+	{ "malformed",	gen_malformed },
+};
+
+#define NWORKLOADS	(sizeof(workloads) / sizeof(workloads[0]))
+
+int
+main(int argc, char **argv)
+{
+	const struct workload *w;
+	enum calc_type type;
+	struct result r;
+	struct text t;
+	const char *errstr;
+	const char *name;
+	const char *evalval, *typename;
+	char **cmd;
+	uint64_t seed;
+	size_t lines;
+	size_t i;
+	unsigned runs;
+	int ch, fd, gflag, j, k;
+
+	setprogname(argv[0]);
+
+	evalval = "evalval";
+	name = NULL;
+	lines = EVALBENCH_LINES;
+	runs = EVALBENCH_RUNS;
+	seed = EVALBENCH_SEED;
+	gflag = 0;
+	type = calc_type_auto;
+	typename = NULL;
+
+	while ((ch = getopt(argc, argv, "e:gn:r:s:t:w:")) != -1) {
+		switch (ch) {
+		case 'e':
+			evalval = optarg;
+			break;
+		case 'g':
+			gflag = 1;
+			break;
+		case 'n':
+			lines = (size_t)strtonum(optarg, 1, 1 << 26, &errstr);
+			if (errstr != NULL)
+				errx(EXIT_FAILURE, "lines is %s: %s", errstr,
+				    optarg);
+			break;
+		case 'r':
+			runs = (unsigned)strtonum(optarg, 1, 1000, &errstr);
+			if (errstr != NULL)
+				errx(EXIT_FAILURE, "runs is %s: %s", errstr,
+				    optarg);
+			break;
+		case 's':
+			seed = (uint64_t)strtonum(optarg, 0, LLONG_MAX,
+			    &errstr);
+			if (errstr != NULL)
+				errx(EXIT_FAILURE, "seed is %s: %s", errstr,
+				    optarg);
+			break;
+		case 't':
+			if (!calc_parsetype(optarg, &type))
+				errx(EXIT_FAILURE, "unknown type: %s", optarg);
+			typename = optarg;
+			break;
+		case 'w':
+			name = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (name != NULL) {
+		for (i = 0; i < NWORKLOADS; i++)
+			if (strcmp(workloads[i].name, name) == 0)
+				break;
+		if (i == NWORKLOADS)
+			errx(EXIT_FAILURE, "unknown workload: %s", name);
+	}
+
+	memset(&t, 0, sizeof(t));
+
+	/* -g only prints the workload, e.g. to feed other tools */
+	if (gflag) {
+		for (i = 0; i < NWORKLOADS; i++) {
+			w = &workloads[i];
+			if (name != NULL && strcmp(w->name, name) != 0)
+				continue;
+			t.len = 0;
+			workload_generate(w, seed, lines, &t);
+			if (fwrite(t.s, 1, t.len, stdout) != t.len)
+				err(EXIT_FAILURE, "fwrite");
+		}
+		free(t.s);
+		return EXIT_SUCCESS;
+	}
+
+	/* Remaining arguments are passed on to evalval, e.g. -- -j4 */
+	cmd = ecalloc((size_t)argc + 4, sizeof(*cmd));
+	k = 0;
+	cmd[k++] = __UNCONST(evalval);
+	if (typename != NULL) {
+		cmd[k++] = __UNCONST("-t");
+		cmd[k++] = __UNCONST(typename);
+	}
+	for (j = 0; j < argc; j++)
+		cmd[k++] = argv[j];
+
+	printf("%-10s %8s %10s %11s %8s %8s %8s %8s %10s\n", "workload",
+	    "lines", "bytes", "lines/s", "MB/s", "p50 ns", "p99 ns",
+	    "p999 ns", "maxrss KiB");
+
+	for (i = 0; i < NWORKLOADS; i++) {
+		w = &workloads[i];
+		if (name != NULL && strcmp(w->name, name) != 0)
+			continue;
+
+		workload_generate(w, seed, lines, &t);
+
+		memset(&r, 0, sizeof(r));
+		r.lines = lines;
+		r.bytes = t.len;
+
+		/*
+		 * A forked child starts out with our resident set, so the
+		 * text goes to a file and is released before evalval runs.
+		 */
+		fd = bench_spill(&t);
+		free(t.s);
+		memset(&t, 0, sizeof(t));
+
+		bench_throughput(fd, cmd, runs, &r);
+		bench_latency(fd, type, &r);
+		close(fd);
+
+		printf("%-10s %8zu %10zu %11.0f %8.2f %8" PRIu64 " %8" PRIu64
+		    " %8" PRIu64 " %10ld\n", w->name, r.lines, r.bytes,
+		    (double)r.lines / r.seconds,
+		    (double)r.bytes / r.seconds / 1e6, r.p50, r.p99, r.p999,
+		    r.maxrss);
+		fflush(stdout);
+	}
+
+	free(cmd);
+
+	return EXIT_SUCCESS;
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-g] [-e evalval] [-n lines] [-r runs] "
+	    "[-s seed] [-t type] [-w workload] [-- evalval-args]\n",
+	    getprogname());
+	exit(EXIT_FAILURE);
+}
+
+/* Private functions */
+
+/* xorshift64*: small, fast and identical on every platform */
+static uint64_t
+rng_next(uint64_t *state)
+{
+	uint64_t x;
+
+	assert(state);
+
+	x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+
+	return x * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+static unsigned
+rng_uniform(uint64_t *state, unsigned n)
+{
+
+	assert(n > 0);
+
+	return (unsigned)((rng_next(state) >> 32) % n);
+}
+
+static void
+text_putc(struct text *this, char c)
+{
+
+	assert(this);
+
+	if (this->len == this->size) {
+		this->size = this->size ? this->size * 2 : 65536;
+		this->s = erealloc(this->s, this->size);
+	}
+	this->s[this->len++] = c;
+}
+
+static void
+text_printf(struct text *this, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	assert(this);
+	assert(fmt);
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(this->s + this->len, this->size - this->len, fmt,
+		    ap);
+		va_end(ap);
+		if (n < 0)
+			err(EXIT_FAILURE, "vsnprintf");
+		if ((size_t)n < this->size - this->len)
+			break;
+		this->size = this->size ? this->size * 2 : 65536;
+		this->s = erealloc(this->s, this->size);
+	}
+	this->len += (size_t)n;
+}
+
+static void
+gen_number(uint64_t *rng, struct text *t)
+{
+
+	if (rng_uniform(rng, 4) == 0)
+		text_printf(t, "%u.%02u", rng_uniform(rng, 1000),
+		    rng_uniform(rng, 100));
+	else
+		text_printf(t, "%u", 1 + rng_uniform(rng, 1000));
+}
+
+static void
+gen_op(uint64_t *rng, struct text *t)
+{
+
+	text_putc(t, "+-*/"[rng_uniform(rng, 4)]);
+}
+
+/* 1 + 2, 3*4-5: the common case, dominated by per-line overhead */
+static void
+gen_short(uint64_t *rng, struct text *t)
+{
+	unsigned i, n;
+
+	n = 1 + rng_uniform(rng, 3);
+
+	gen_number(rng, t);
+	for (i = 0; i < n; i++) {
+		gen_op(rng, t);
+		gen_number(rng, t);
+	}
+}
+
+/* Long sums: scanning and number conversion */
+static void
+gen_flat(uint64_t *rng, struct text *t)
+{
+	unsigned i, n;
+
+	n = 16 + rng_uniform(rng, 112);
+
+	gen_number(rng, t);
+	for (i = 0; i < n; i++) {
+		text_printf(t, " %c ", rng_uniform(rng, 2) ? '+' : '-');
+		gen_number(rng, t);
+	}
+}
+
+/* ((((1+2)*3)-4)/5): recursion depth and tree shape */
+static void
+gen_nested(uint64_t *rng, struct text *t)
+{
+	unsigned i, n;
+
+	n = 8 + rng_uniform(rng, 120);
+
+	for (i = 0; i < n; i++)
+		text_putc(t, '(');
+	gen_number(rng, t);
+	for (i = 0; i < n; i++) {
+		gen_op(rng, t);
+		gen_number(rng, t);
+		text_putc(t, ')');
+	}
+}
+
+/* - - -5, --7: unary chains, spaced and unspaced */
+static void
+gen_unary(uint64_t *rng, struct text *t)
+{
+	unsigned i, n, sp;
+
+	n = 1 + rng_uniform(rng, 64);
+	sp = rng_uniform(rng, 2);
+
+	for (i = 0; i < n; i++) {
+		text_putc(t, '-');
+		if (sp)
+			text_putc(t, ' ');
+	}
+	gen_number(rng, t);
+}
+
+/* 12*34-5: integers without division, the exact integer path */
+static void
+gen_integer(uint64_t *rng, struct text *t)
+{
+	unsigned i, n;
+
+	n = 1 + rng_uniform(rng, 8);
+
+	text_printf(t, "%u", rng_uniform(rng, 10000));
+	for (i = 0; i < n; i++) {
+		text_putc(t, "+-*"[rng_uniform(rng, 3)]);
+		text_printf(t, "%u", rng_uniform(rng, 10000));
+	}
+}
+
+/* 1 to 17 significant digits with exponents: the number fast and slow paths */
+static void
+gen_mixed(uint64_t *rng, struct text *t)
+{
+	unsigned i, j, n, digits, point;
+
+	n = 1 + rng_uniform(rng, 4);
+
+	for (i = 0; i < n; i++) {
+		if (i > 0)
+			gen_op(rng, t);
+
+		digits = 1 + rng_uniform(rng, 17);
+		point = rng_uniform(rng, digits + 1);
+		for (j = 0; j < digits; j++) {
+			if (j == point && j > 0)
+				text_putc(t, '.');
+			text_putc(t, (char)('0' + (j == 0 ?
+			    1 + rng_uniform(rng, 9) : rng_uniform(rng, 10))));
+		}
+		if (rng_uniform(rng, 3) == 0)
+			text_printf(t, "e%d", (int)rng_uniform(rng, 61) - 30);
+	}
+}
+
+/* Half of the lines are rejected, each in a different part of the parser */
+static void
+gen_malformed(uint64_t *rng, struct text *t)
+{
+
+	switch (rng_uniform(rng, 8)) {
+	case 0:
+		/* Truncated */
+		gen_number(rng, t);
+		gen_op(rng, t);
+		break;
+	case 1:
+		/* Unbalanced */
+		text_putc(t, '(');
+		gen_short(rng, t);
+		break;
+	case 2:
+		/* Stray symbol */
+		gen_number(rng, t);
+		text_printf(t, " %c ", "#$%&@"[rng_uniform(rng, 5)]);
+		gen_number(rng, t);
+		break;
+	case 3:
+		/* Unbound variable */
+		text_printf(t, "x%u", rng_uniform(rng, 100));
+		gen_op(rng, t);
+		gen_number(rng, t);
+		break;
+	default:
+		gen_short(rng, t);
+		break;
+	}
+}
+
+static void
+workload_generate(const struct workload *w, uint64_t seed, size_t lines,
+                  struct text *t)
+{
+	uint64_t rng;
+	size_t i;
+
+	assert(w);
+	assert(t);
+
+	/* Each workload has its own stream; xorshift must not start at 0 */
+	rng = (seed + 1) * UINT64_C(0x9e3779b97f4a7c15) ^
+	    (uint64_t)(uintptr_t)(w - workloads);
+	if (rng == 0)
+		rng = 1;
+
+	for (i = 0; i < lines; i++) {
+		w->gen(&rng, t);
+		text_putc(t, '\n');
+	}
+
+	DPRINTF(("%s: %zu lines, %zu bytes\n", w->name, lines, t->len));
+}
+
+/* Writes the workload to an unlinked temporary file */
+static int
+bench_spill(const struct text *t)
+{
+	char path[] = "/tmp/evalbench.XXXXXX";
+	int fd;
+
+	assert(t);
+
+	if ((fd = mkstemp(path)) == -1)
+		err(EXIT_FAILURE, "mkstemp");
+	unlink(path);
+	if (write(fd, t->s, t->len) != (ssize_t)t->len)
+		err(EXIT_FAILURE, "write");
+
+	return fd;
+}
+
+/*
+ * Runs evalval on the workload, best of runs.  Input comes from a regular
+ * file so the real input path (mmap) is taken; output goes to /dev/null.
+ */
+static void
+bench_throughput(int fd, char **cmd, unsigned runs, struct result *r)
+{
+	struct rusage ru;
+	uint64_t start, elapsed, best;
+	unsigned i;
+	pid_t pid;
+	int null, status;
+
+	assert(cmd);
+	assert(r);
+
+	if ((null = open(_PATH_DEVNULL, O_WRONLY)) == -1)
+		err(EXIT_FAILURE, "%s", _PATH_DEVNULL);
+
+	best = UINT64_MAX;
+	for (i = 0; i < runs; i++) {
+		if (lseek(fd, 0, SEEK_SET) == -1)
+			err(EXIT_FAILURE, "lseek");
+
+		start = nsecs();
+		switch (pid = fork()) {
+		case -1:
+			err(EXIT_FAILURE, "fork");
+		case 0:
+			dup2(fd, STDIN_FILENO);
+			dup2(null, STDOUT_FILENO);
+			dup2(null, STDERR_FILENO);
+			execvp(cmd[0], cmd);
+			_exit(127);
+		default:
+			break;
+		}
+		if (wait4(pid, &status, 0, &ru) == -1)
+			err(EXIT_FAILURE, "wait4");
+		elapsed = nsecs() - start;
+
+		if (WIFSIGNALED(status))
+			errx(EXIT_FAILURE, "%s: killed by signal %d", cmd[0],
+			    WTERMSIG(status));
+		if (WEXITSTATUS(status) == 127)
+			errx(EXIT_FAILURE, "%s: cannot execute", cmd[0]);
+
+		if (elapsed < best)
+			best = elapsed;
+		if (ru.ru_maxrss > r->maxrss)
+			r->maxrss = ru.ru_maxrss;
+	}
+
+	r->seconds = (double)best / 1e9;
+
+	close(null);
+}
+
+/*
+ * Times calc_line() for every line.  Rejected lines are reported on stderr,
+ * which is pointed at /dev/null meanwhile.
+ */
+static void
+bench_latency(int fd, enum calc_type type, struct result *r)
+{
+	struct calc *c;
+	uint64_t *lat;
+	uint64_t start;
+	const char *text, *pos, *line;
+	char buf[OUTPUT_MAXSIZE];
+	size_t len, n;
+	int null, saved;
+
+	assert(r);
+
+	text = mmap(NULL, r->bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (text == MAP_FAILED)
+		err(EXIT_FAILURE, "mmap");
+
+	lat = ecalloc(r->lines, sizeof(*lat));
+	c = calc_new(output_format_shortest, 0);
+	calc_settype(c, type);
+
+	fflush(stderr);
+	if ((null = open(_PATH_DEVNULL, O_WRONLY)) == -1)
+		err(EXIT_FAILURE, "%s", _PATH_DEVNULL);
+	if ((saved = dup(STDERR_FILENO)) == -1)
+		err(EXIT_FAILURE, "dup");
+	dup2(null, STDERR_FILENO);
+
+	n = 0;
+	pos = text;
+	while (n < r->lines &&
+	    input_splitline(&pos, text + r->bytes, &line, &len)) {
+		start = nsecs();
+		(void)calc_line(c, line, len, buf);
+		lat[n++] = nsecs() - start;
+	}
+
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+	close(null);
+
+	qsort(lat, n, sizeof(*lat), cmp_uint64);
+	if (n > 0) {
+		r->p50 = lat[(n - 1) * 500 / 1000];
+		r->p99 = lat[(n - 1) * 990 / 1000];
+		r->p999 = lat[(n - 1) * 999 / 1000];
+	}
+
+	calc_delete(c);
+	free(lat);
+	munmap(__UNCONST(text), r->bytes);
+}
+
+static int
+cmp_uint64(const void *a, const void *b)
+{
+	uint64_t x, y;
+
+	x = *(const uint64_t *)a;
+	y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t
+nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,426 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <util.h>
+
+/*
+ * Load generator for evalval -l/-p.  Each connection runs in its own
+ * thread and keeps up to depth requests in flight, cycling through the
+ * lines of the input, e.g. the output of evalbench -g.  Latency is the
+ * time from queueing a request to reading its reply.
+ */
+
+#ifdef DEBUG_EVALLOAD
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+#define EVALLOAD_CONNS		8
+#define EVALLOAD_DEPTH		64
+#define EVALLOAD_REQUESTS	100000
+#define EVALLOAD_READSIZE	65536
+
+struct conn {
+	pthread_t	 thread;
+	int		 fd;
+	size_t		 first;		/* line to start at */
+	uint64_t	*lat;
+	size_t		 errors;
+};
+
+static void
+usage(void) __dead;
+
+static void
+load_read(int fd);
+
+static int
+load_connect(const char *path, const char *port);
+
+static void *
+load_run(void *arg);
+
+static int
+cmp_uint64(const void *a, const void *b);
+
+static uint64_t
+nsecs(void);
+
+static char *text;
+static size_t textlen;
+static const char **lines;
+static size_t *linelens;
+static size_t nlines;
+static size_t depth;
+static size_t requests;
+
+int
+main(int argc, char **argv)
+{
+	struct conn *conns;
+	const char *errstr, *path, *port;
+	uint64_t *lat, start;
+	size_t i, n, nconns, errors;
+	double seconds;
+	int ch, fd, rv;
+
+	setprogname(argv[0]);
+
+	nconns = EVALLOAD_CONNS;
+	depth = EVALLOAD_DEPTH;
+	requests = EVALLOAD_REQUESTS;
+	path = NULL;
+	port = NULL;
+
+	while ((ch = getopt(argc, argv, "c:d:l:n:p:")) != -1) {
+		switch (ch) {
+		case 'c':
+			nconns = (size_t)strtonum(optarg, 1, 4096, &errstr);
+			if (errstr != NULL)
+				errx(EXIT_FAILURE, "connections is %s: %s",
+				    errstr, optarg);
+			break;
+		case 'd':
+			depth = (size_t)strtonum(optarg, 1, 1 << 20, &errstr);
+			if (errstr != NULL)
+				errx(EXIT_FAILURE, "depth is %s: %s", errstr,
+				    optarg);
+			break;
+		case 'l':
+			path = optarg;
+			break;
+		case 'n':
+			requests = (size_t)strtonum(optarg, 1, 1 << 30,
+			    &errstr);
+			if (errstr != NULL)
+				errx(EXIT_FAILURE, "requests is %s: %s",
+				    errstr, optarg);
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if ((path == NULL) == (port == NULL) || argc > 1)
+		usage();
+
+	if (argc == 0 || strcmp(argv[0], "-") == 0) {
+		load_read(STDIN_FILENO);
+	} else {
+		if ((fd = open(argv[0], O_RDONLY)) == -1)
+			err(EXIT_FAILURE, "%s", argv[0]);
+		load_read(fd);
+		close(fd);
+	}
+	if (nlines == 0)
+		errx(EXIT_FAILURE, "no input lines");
+
+	conns = ecalloc(nconns, sizeof(*conns));
+	for (i = 0; i < nconns; i++) {
+		conns[i].fd = load_connect(path, port);
+		conns[i].first = i * nlines / nconns;
+		conns[i].lat = ecalloc(requests, sizeof(*conns[i].lat));
+	}
+
+	start = nsecs();
+	for (i = 0; i < nconns; i++) {
+		rv = pthread_create(&conns[i].thread, NULL, load_run,
+		    &conns[i]);
+		if (rv != 0)
+			errc(EXIT_FAILURE, rv, "pthread_create");
+	}
+	for (i = 0; i < nconns; i++)
+		pthread_join(conns[i].thread, NULL);
+	seconds = (double)(nsecs() - start) / 1e9;
+
+	n = nconns * requests;
+	lat = ecalloc(n, sizeof(*lat));
+	errors = 0;
+	for (i = 0; i < nconns; i++) {
+		memcpy(lat + i * requests, conns[i].lat,
+		    requests * sizeof(*lat));
+		errors += conns[i].errors;
+		close(conns[i].fd);
+		free(conns[i].lat);
+	}
+	qsort(lat, n, sizeof(*lat), cmp_uint64);
+
+	printf("%5s %6s %10s %11s %10s %10s %10s %8s\n", "conns", "depth",
+	    "requests", "req/s", "p50 ns", "p99 ns", "p999 ns", "errors");
+	printf("%5zu %6zu %10zu %11.0f %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+	    " %8zu\n", nconns, depth, n, (double)n / seconds,
+	    lat[(n - 1) * 500 / 1000], lat[(n - 1) * 990 / 1000],
+	    lat[(n - 1) * 999 / 1000], errors);
+
+	free(lat);
+	free(conns);
+	free(lines);
+	free(linelens);
+	free(text);
+
+	return EXIT_SUCCESS;
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-c connections] [-d depth] [-n requests] "
+	    "-l socket | -p port [file]\n", getprogname());
+	exit(EXIT_FAILURE);
+}
+
+/* Private functions */
+
+/* Reads all of fd and splits it into non-empty lines */
+static void
+load_read(int fd)
+{
+	size_t size, i, start;
+	ssize_t n;
+
+	size = 0;
+	for (;;) {
+		if (size - textlen < EVALLOAD_READSIZE) {
+			size = size ? size * 2 : EVALLOAD_READSIZE;
+			text = erealloc(text, size);
+		}
+		n = read(fd, text + textlen, size - textlen);
+		if (n == -1)
+			err(EXIT_FAILURE, "read");
+		if (n == 0)
+			break;
+		textlen += (size_t)n;
+	}
+
+	size = 0;
+	for (i = start = 0; i <= textlen; i++) {
+		if (i < textlen && text[i] != '\n')
+			continue;
+		if (i > start) {
+			if (nlines == size) {
+				size = size ? size * 2 : 1024;
+				lines = erealloc(lines, size * sizeof(*lines));
+				linelens = erealloc(linelens,
+				    size * sizeof(*linelens));
+			}
+			lines[nlines] = text + start;
+			linelens[nlines++] = i - start;
+		}
+		start = i + 1;
+	}
+}
+
+static int
+load_connect(const char *path, const char *port)
+{
+	struct sockaddr_un sun;
+	struct addrinfo hints, *res, *ai;
+	int error, fd;
+
+	if (path != NULL) {
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if (strlcpy(sun.sun_path, path, sizeof(sun.sun_path)) >=
+		    sizeof(sun.sun_path))
+			errx(EXIT_FAILURE, "%s: socket path too long", path);
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+			err(EXIT_FAILURE, "socket");
+		if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+			err(EXIT_FAILURE, "%s", path);
+	} else {
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		error = getaddrinfo(NULL, port, &hints, &res);
+		if (error != 0)
+			errx(EXIT_FAILURE, "%s: %s", port,
+			    gai_strerror(error));
+		fd = -1;
+		for (ai = res; ai != NULL; ai = ai->ai_next) {
+			fd = socket(ai->ai_family, ai->ai_socktype,
+			    ai->ai_protocol);
+			if (fd == -1)
+				continue;
+			if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+				break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(res);
+		if (fd == -1)
+			err(EXIT_FAILURE, "port %s", port);
+	}
+
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+		err(EXIT_FAILURE, "fcntl");
+
+	return fd;
+}
+
+/*
+ * Queues requests while fewer than depth are unanswered and matches
+ * replies to them in order.  Replies starting with "error:" are counted.
+ */
+static void *
+load_run(void *arg)
+{
+	struct conn *c;
+	struct pollfd pfd;
+	char in[EVALLOAD_READSIZE];
+	char *out;
+	uint64_t *queued;
+	size_t outoff, outlen, outsize, nsent, nrecv, next, len;
+	ssize_t i, n;
+	int bol;
+
+	c = arg;
+
+	queued = ecalloc(depth, sizeof(*queued));
+	outsize = EVALLOAD_READSIZE;
+	out = emalloc(outsize);
+	outoff = outlen = 0;
+	nsent = nrecv = 0;
+	next = c->first;
+	bol = 1;
+
+	while (nrecv < requests) {
+		while (nsent < requests && nsent - nrecv < depth) {
+			len = linelens[next];
+			while (outsize - outlen < len + 1) {
+				outsize *= 2;
+				out = erealloc(out, outsize);
+			}
+			memcpy(out + outlen, lines[next], len);
+			out[outlen + len] = '\n';
+			outlen += len + 1;
+			queued[nsent++ % depth] = nsecs();
+			if (++next == nlines)
+				next = 0;
+		}
+
+		pfd.fd = c->fd;
+		pfd.events = POLLIN | (outoff < outlen ? POLLOUT : 0);
+		if (poll(&pfd, 1, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "poll");
+		}
+
+		if (pfd.revents & POLLOUT) {
+			n = write(c->fd, out + outoff, outlen - outoff);
+			if (n == -1 && errno != EAGAIN && errno != EINTR)
+				err(EXIT_FAILURE, "write");
+			if (n > 0)
+				outoff += (size_t)n;
+			if (outoff == outlen)
+				outoff = outlen = 0;
+		}
+
+		if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+			n = read(c->fd, in, sizeof(in));
+			if (n == -1) {
+				if (errno == EAGAIN || errno == EINTR)
+					continue;
+				err(EXIT_FAILURE, "read");
+			}
+			if (n == 0)
+				errx(EXIT_FAILURE, "connection closed after "
+				    "%zu replies", nrecv);
+			for (i = 0; i < n; i++) {
+				if (bol && in[i] == 'e')
+					c->errors++;
+				bol = in[i] == '\n';
+				if (bol) {
+					c->lat[nrecv] = nsecs() -
+					    queued[nrecv % depth];
+					nrecv++;
+				}
+			}
+		}
+	}
+
+	DPRINTF(("%s(): fd=%d replies=%zu errors=%zu\n", __func__, c->fd,
+	    nrecv, c->errors));
+
+	free(out);
+	free(queued);
+
+	return NULL;
+}
+
+static int
+cmp_uint64(const void *a, const void *b)
+{
+	uint64_t x, y;
+
+	x = *(const uint64_t *)a;
+	y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t
+nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,610 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <util.h>
+
+#include "astnode.h"
+#include "kernel.h"
+
+#include "bytecode.h"
+
+#ifdef DEBUG_BYTECODE
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+/*
+ * Every instruction is one 64-bit word.  Instructions with a constant
+ * operand (bytecode_op_push and the *k forms, whose right operand is a
+ * literal) are followed by a second word holding the double;
+ * bytecode_op_load is followed by the variable index.
+ *
+ * A node shared in a DAG, see astnode_id(), is computed where it is first
+ * used and followed by bytecode_op_store, which copies the top of the
+ * stack into a slot; its other uses are bytecode_op_fetch of that slot.
+ * Both are followed by the slot number.  Slots are numbered in the order
+ * they are stored, so the code can be checked in one pass.
+ */
+
+enum bytecode_op {
+	bytecode_op_ret,
+	bytecode_op_push,
+	bytecode_op_neg,
+	bytecode_op_add,
+	bytecode_op_sub,
+	bytecode_op_mul,
+	bytecode_op_div,
+	bytecode_op_addk,
+	bytecode_op_subk,
+	bytecode_op_mulk,
+	bytecode_op_divk,
+	bytecode_op_load,
+	bytecode_op_store,
+	bytecode_op_fetch
+};
+
+union bytecode_word {
+	uint64_t	op;
+	uint64_t	index;
+	double		value;
+};
+
+struct bytecode {
+	uint32_t		nwords;
+	uint32_t		maxstack;
+	uint32_t		nvars;
+	uint32_t		nslots;		/* of shared nodes */
+	union bytecode_word	code[];
+};
+
+#define BYTECODE_STACKSIZE	64
+#define BYTECODE_SLOTSIZE	64
+
+/* Nodes on the explicit stack of bytecode_emit() */
+struct bytecode_frame {
+	struct astnode	*node;
+	int		 visited;	/* operands already emitted */
+};
+
+/* Rows per chunk in bytecode_evalbatch(), small enough to stay in L1 */
+#define BYTECODE_BATCHSIZE	256
+
+static size_t
+bytecode_countwords(struct astnode *n, size_t *maxid);
+
+static uint32_t
+bytecode_emit(struct bytecode *this, struct astnode *n, size_t maxid);
+
+static void
+bytecode_store(struct bytecode *this, struct astnode *n, uint32_t *slots);
+
+static enum bytecode_op
+bytecode_binop(enum astnode_type type, int constant);
+
+struct bytecode *
+bytecode_compile(struct astnode *n)
+{
+	struct bytecode *this;
+	size_t nwords, maxid;
+
+	assert(n);
+
+	/* +1 for the trailing bytecode_op_ret */
+	nwords = bytecode_countwords(n, &maxid) + 1;
+
+	this = emalloc(sizeof(*this) + nwords * sizeof(this->code[0]));
+
+	this->nwords = 0;
+	this->nvars = 0;
+	this->nslots = 0;
+	this->maxstack = bytecode_emit(this, n, maxid);
+	this->code[this->nwords++].op = bytecode_op_ret;
+
+	assert(this->nwords == nwords);
+
+	DPRINTF(("%s(): bytecode=%p nwords=%" PRIu32 " maxstack=%" PRIu32
+	    " nslots=%" PRIu32 "\n", __func__, this, this->nwords,
+	    this->maxstack, this->nslots));
+
+	return this;
+}
+
+void
+bytecode_delete(struct bytecode *this)
+{
+
+	assert(this);
+
+	free(this);
+}
+
+size_t
+bytecode_size(const struct bytecode *this)
+{
+
+	assert(this);
+
+	return sizeof(*this) + this->nwords * sizeof(this->code[0]);
+}
+
+const struct bytecode *
+bytecode_verify(const void *p, size_t len)
+{
+	const struct bytecode *this;
+	const union bytecode_word *pc, *end;
+	uint32_t depth, peak, nstored;
+
+	assert(p);
+	assert(((uintptr_t)p & (sizeof(union bytecode_word) - 1)) == 0);
+
+	this = p;
+	if (len < sizeof(*this) || this->nwords == 0 ||
+	    this->nwords > (len - sizeof(*this)) / sizeof(this->code[0]))
+		return NULL;
+
+	/*
+	 * Replays the stack depth the way bytecode_emit() counted it; the
+	 * peak must match exactly, as maxstack sizes the evaluation stack.
+	 * Every slot must be stored, in order, before it is fetched.
+	 */
+	depth = peak = nstored = 0;
+	end = &this->code[this->nwords];
+	for (pc = this->code; pc < end; pc++) {
+		switch (pc->op) {
+		case bytecode_op_push:
+		case bytecode_op_load:
+		case bytecode_op_fetch:
+			if (end - pc < 2 || depth == this->maxstack)
+				return NULL;
+			if (pc->op == bytecode_op_load &&
+			    pc[1].index >= this->nvars)
+				return NULL;
+			if (pc->op == bytecode_op_fetch &&
+			    pc[1].index >= nstored)
+				return NULL;
+			if (++depth > peak)
+				peak = depth;
+			pc++;
+			break;
+		case bytecode_op_store:
+			if (end - pc < 2 || depth < 1 ||
+			    pc[1].index != nstored || nstored == this->nslots)
+				return NULL;
+			nstored++;
+			pc++;
+			break;
+		case bytecode_op_neg:
+			if (depth < 1)
+				return NULL;
+			break;
+		case bytecode_op_add:
+		case bytecode_op_sub:
+		case bytecode_op_mul:
+		case bytecode_op_div:
+			if (depth < 2)
+				return NULL;
+			depth--;
+			break;
+		case bytecode_op_addk:
+		case bytecode_op_subk:
+		case bytecode_op_mulk:
+		case bytecode_op_divk:
+			if (end - pc < 2 || depth < 1)
+				return NULL;
+			pc++;
+			break;
+		case bytecode_op_ret:
+			if (pc != end - 1 || depth != 1 ||
+			    peak != this->maxstack || nstored != this->nslots)
+				return NULL;
+			return this;
+		default:
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+size_t
+bytecode_nvariables(const struct bytecode *this)
+{
+
+	assert(this);
+
+	return this->nvars;
+}
+
+double
+bytecode_eval(const struct bytecode *this, const double *vars)
+{
+	const union bytecode_word *pc;
+	double stackbuf[BYTECODE_STACKSIZE], slotbuf[BYTECODE_SLOTSIZE];
+	double *stack, *sp, *slots;
+	double tos, rv;
+
+	assert(this);
+	assert(vars || this->nvars == 0);
+
+	/*
+	 * The top of the stack lives in tos; stack[] holds the entries below
+	 * it, so a binary operation touches memory only for its left operand.
+	 */
+	if (this->maxstack <= BYTECODE_STACKSIZE)
+		stack = stackbuf;
+	else
+		stack = emalloc(this->maxstack * sizeof(*stack));
+	if (this->nslots <= BYTECODE_SLOTSIZE)
+		slots = slotbuf;
+	else
+		slots = emalloc(this->nslots * sizeof(*slots));
+	sp = stack;
+	tos = 0;
+	pc = this->code;
+
+#ifdef __GNUC__
+	static const void *const dispatch[] = {
+		[bytecode_op_ret] = &&op_ret,
+		[bytecode_op_push] = &&op_push,
+		[bytecode_op_neg] = &&op_neg,
+		[bytecode_op_add] = &&op_add,
+		[bytecode_op_sub] = &&op_sub,
+		[bytecode_op_mul] = &&op_mul,
+		[bytecode_op_div] = &&op_div,
+		[bytecode_op_addk] = &&op_addk,
+		[bytecode_op_subk] = &&op_subk,
+		[bytecode_op_mulk] = &&op_mulk,
+		[bytecode_op_divk] = &&op_divk,
+		[bytecode_op_load] = &&op_load,
+		[bytecode_op_store] = &&op_store,
+		[bytecode_op_fetch] = &&op_fetch
+	};
+#define	VM_SWITCH()	goto *dispatch[(pc++)->op];
+#define	VM_CASE(op)	op_##op:
+#define	VM_NEXT()	goto *dispatch[(pc++)->op]
+#else
+#define	VM_SWITCH()	for (;;) switch ((enum bytecode_op)(pc++)->op) {
+#define	VM_CASE(op)	case bytecode_op_##op:
+#define	VM_NEXT()	continue
+#endif
+
+	VM_SWITCH()
+	VM_CASE(push)
+		*sp++ = tos;
+		tos = (pc++)->value;
+		VM_NEXT();
+	VM_CASE(load)
+		*sp++ = tos;
+		tos = vars[(pc++)->index];
+		VM_NEXT();
+	VM_CASE(store)
+		slots[(pc++)->index] = tos;
+		VM_NEXT();
+	VM_CASE(fetch)
+		*sp++ = tos;
+		tos = slots[(pc++)->index];
+		VM_NEXT();
+	VM_CASE(neg)
+		tos = -tos;
+		VM_NEXT();
+	VM_CASE(add)
+		tos = *--sp + tos;
+		VM_NEXT();
+	VM_CASE(sub)
+		tos = *--sp - tos;
+		VM_NEXT();
+	VM_CASE(mul)
+		tos = *--sp * tos;
+		VM_NEXT();
+	VM_CASE(div)
+		tos = *--sp / tos;
+		VM_NEXT();
+	VM_CASE(addk)
+		tos = tos + (pc++)->value;
+		VM_NEXT();
+	VM_CASE(subk)
+		tos = tos - (pc++)->value;
+		VM_NEXT();
+	VM_CASE(mulk)
+		tos = tos * (pc++)->value;
+		VM_NEXT();
+	VM_CASE(divk)
+		tos = tos / (pc++)->value;
+		VM_NEXT();
+	VM_CASE(ret)
+		rv = tos;
+#ifndef __GNUC__
+		goto out;
+	}
+out:
+#endif
+
+#undef VM_SWITCH
+#undef VM_CASE
+#undef VM_NEXT
+
+	if (stack != stackbuf)
+		free(stack);
+	if (slots != slotbuf)
+		free(slots);
+
+	return rv;
+}
+
+/*
+ * bytecode_evalbatch() and bytecode_evalbatch_float() share one body,
+ * instantiated from bytecode_batch.h.
+ */
+
+#define BYTECODE_BATCH_NAME	bytecode_evalbatch
+#define BYTECODE_BATCH_T	double
+#define BYTECODE_BATCH_KERNEL	kernel
+#define BYTECODE_BATCH_SELECT	kernel_select
+#include "bytecode_batch.h"
+
+#define BYTECODE_BATCH_NAME	bytecode_evalbatch_float
+#define BYTECODE_BATCH_T	float
+#define BYTECODE_BATCH_KERNEL	kernel_float
+#define BYTECODE_BATCH_SELECT	kernel_select_float
+#include "bytecode_batch.h"
+
+/* Private functions */
+
+/*
+ * Counts the words of the code for n and finds the largest astnode_id() in
+ * it.  A shared node is counted in full once, with its store, and as a
+ * fetch wherever else it is used.
+ */
+size_t
+bytecode_countwords(struct astnode *n, size_t *maxid)
+{
+	struct astnode **stack;
+	struct astnode *r;
+	size_t nstack, size, nwords, id, nseen, newsize;
+	uint8_t *seen;
+
+	assert(n);
+	assert(maxid);
+
+	size = 64;
+	stack = emalloc(size * sizeof(*stack));
+	nstack = 0;
+	stack[nstack++] = n;
+	seen = NULL;
+	nseen = 0;
+	*maxid = 0;
+
+	/* Any order will do for counting */
+	nwords = 0;
+	while (nstack > 0) {
+		if (size - nstack < 2) {
+			size *= 2;
+			stack = erealloc(stack, size * sizeof(*stack));
+		}
+		n = stack[--nstack];
+
+		if ((id = astnode_id(n)) != 0) {
+			if (id >= nseen) {
+				newsize = nseen > 0 ? nseen * 2 : 64;
+				while (newsize <= id)
+					newsize *= 2;
+				seen = erealloc(seen, newsize);
+				memset(&seen[nseen], 0, newsize - nseen);
+				nseen = newsize;
+			}
+			nwords += 2;
+			if (seen[id])
+				continue;
+			seen[id] = 1;
+			if (id > *maxid)
+				*maxid = id;
+		}
+
+		switch (astnode_type(n)) {
+		case astnode_type_number:
+		case astnode_type_variable:
+			nwords += 2;
+			break;
+		case astnode_type_unaryminus:
+			nwords += 1;
+			stack[nstack++] = astnode_left(n);
+			break;
+		default:
+			r = astnode_right(n);
+			stack[nstack++] = astnode_left(n);
+			if (astnode_type(r) == astnode_type_number) {
+				nwords += 2;
+			} else {
+				nwords += 1;
+				stack[nstack++] = r;
+			}
+			break;
+		}
+	}
+
+	free(stack);
+	free(seen);
+
+	return nwords;
+}
+
+/*
+ * Emits code for the tree rooted at n in post-order, walking it with an
+ * explicit stack, and returns the number of stack slots (including tos) the
+ * code needs.  Shared nodes, with ids up to maxid, are emitted once.
+ */
+uint32_t
+bytecode_emit(struct bytecode *this, struct astnode *n, size_t maxid)
+{
+	struct bytecode_frame *frames;
+	struct bytecode_frame *f;
+	struct astnode *r;
+	size_t nframes, size, id;
+	uint32_t depth, maxdepth, *slots;
+
+	assert(this);
+	assert(n);
+
+	/* slots[id] is the slot of a shared node plus one, 0 until stored */
+	slots = ecalloc(maxid + 1, sizeof(*slots));
+
+	size = 64;
+	frames = emalloc(size * sizeof(*frames));
+	nframes = 0;
+	frames[nframes].node = n;
+	frames[nframes++].visited = 0;
+
+	depth = 0;
+	maxdepth = 0;
+	while (nframes > 0) {
+		if (nframes == size) {
+			size *= 2;
+			frames = erealloc(frames, size * sizeof(*frames));
+		}
+		f = &frames[nframes - 1];
+		n = f->node;
+
+		if (f->visited == 0 && (id = astnode_id(n)) != 0 &&
+		    slots[id] != 0) {
+			this->code[this->nwords++].op = bytecode_op_fetch;
+			this->code[this->nwords++].index = slots[id] - 1;
+			if (++depth > maxdepth)
+				maxdepth = depth;
+			nframes--;
+			continue;
+		}
+
+		switch (astnode_type(n)) {
+		case astnode_type_number:
+			this->code[this->nwords++].op = bytecode_op_push;
+			this->code[this->nwords++].value = astnode_value(n);
+			if (++depth > maxdepth)
+				maxdepth = depth;
+			nframes--;
+			continue;
+		case astnode_type_variable:
+			this->code[this->nwords++].op = bytecode_op_load;
+			this->code[this->nwords++].index = astnode_index(n);
+			if (astnode_index(n) >= this->nvars)
+				this->nvars = (uint32_t)astnode_index(n) + 1;
+			if (++depth > maxdepth)
+				maxdepth = depth;
+			nframes--;
+			continue;
+		case astnode_type_unaryminus:
+			if (f->visited++ == 0) {
+				frames[nframes].node = astnode_left(n);
+				frames[nframes++].visited = 0;
+				continue;
+			}
+			this->code[this->nwords++].op = bytecode_op_neg;
+			bytecode_store(this, n, slots);
+			nframes--;
+			continue;
+		default:
+			break;
+		}
+
+		r = astnode_right(n);
+		if (f->visited == 0) {
+			f->visited = 1;
+			frames[nframes].node = astnode_left(n);
+			frames[nframes++].visited = 0;
+			continue;
+		}
+		if (astnode_type(r) == astnode_type_number) {
+			this->code[this->nwords++].op =
+			    bytecode_binop(astnode_type(n), 1);
+			this->code[this->nwords++].value = astnode_value(r);
+			bytecode_store(this, n, slots);
+			nframes--;
+			continue;
+		}
+		if (f->visited == 1) {
+			f->visited = 2;
+			frames[nframes].node = r;
+			frames[nframes++].visited = 0;
+			continue;
+		}
+		this->code[this->nwords++].op =
+		    bytecode_binop(astnode_type(n), 0);
+		bytecode_store(this, n, slots);
+		depth--;
+		nframes--;
+	}
+
+	free(frames);
+	free(slots);
+
+	return maxdepth;
+}
+
+/* Keeps the value of n, just computed, for its other uses if it is shared */
+void
+bytecode_store(struct bytecode *this, struct astnode *n, uint32_t *slots)
+{
+	size_t id;
+
+	if ((id = astnode_id(n)) == 0)
+		return;
+
+	assert(slots[id] == 0);
+	this->code[this->nwords++].op = bytecode_op_store;
+	this->code[this->nwords++].index = this->nslots;
+	slots[id] = ++this->nslots;
+}
+
+enum bytecode_op
+bytecode_binop(enum astnode_type type, int constant)
+{
+
+	switch (type) {
+	case astnode_type_plus:
+		return constant ? bytecode_op_addk : bytecode_op_add;
+	case astnode_type_minus:
+		return constant ? bytecode_op_subk : bytecode_op_sub;
+	case astnode_type_mul:
+		return constant ? bytecode_op_mulk : bytecode_op_mul;
+	case astnode_type_div:
+		return constant ? bytecode_op_divk : bytecode_op_div;
+	default:
+		abort();
+	}
+}
@@ -0,0 +1,90 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __EVALVAL_BYTECODE_H__
+#define __EVALVAL_BYTECODE_H__
+
+#include <stddef.h>
+
+/*
+ * Compiled form of an AST: a flat array of stack machine instructions with
+ * constants stored inline.  The representation contains no pointers, so it
+ * can be stored as is, see bytecode_size() and bytecode_verify().
+ */
+
+struct astnode;
+struct bytecode;
+
+struct bytecode *
+bytecode_compile(struct astnode *n);
+
+void
+bytecode_delete(struct bytecode *this);
+
+/* Bytes from this to the end of the code, 8-byte aligned */
+size_t
+bytecode_size(const struct bytecode *this);
+
+/*
+ * Checks that the len bytes at p, which must be 8-byte aligned, hold
+ * bytecode that is safe to run: known instructions, variable indexes and
+ * stack use within the declared bounds, and a final return.  Returns p as
+ * bytecode, or NULL.  Nothing is copied.
+ */
+const struct bytecode *
+bytecode_verify(const void *p, size_t len);
+
+/* Number of variables referenced, i.e. the highest index plus one */
+size_t
+bytecode_nvariables(const struct bytecode *this);
+
+/* vars[i] is the value of variable i; may be NULL without variables */
+double
+bytecode_eval(const struct bytecode *this, const double *vars);
+
+/*
+ * Evaluates the expression for n rows at once: columns[i][r] is the value
+ * of variable i in row r and the result goes to out[r].  Rows are processed
+ * in chunks, one operator at a time, with the SIMD kernels.
+ */
+void
+bytecode_evalbatch(const struct bytecode *this, const double *const *columns,
+                   size_t n, double *out);
+
+/*
+ * The same in single precision, with twice the rows per instruction:
+ * constants are rounded to float and every operation rounds to float.
+ */
+void
+bytecode_evalbatch_float(const struct bytecode *this,
+                         const float *const *columns, size_t n, float *out);
+
+#endif /* __EVALVAL_BYTECODE_H__ */
@@ -0,0 +1,165 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Body of the batch evaluators, included by bytecode.c once per element
+ * type with these defined:
+ *
+ *	BYTECODE_BATCH_NAME	the function
+ *	BYTECODE_BATCH_T	the element type
+ *	BYTECODE_BATCH_KERNEL	the struct of its kernels
+ *	BYTECODE_BATCH_SELECT	the function returning them
+ *
+ * Constants are rounded from double to the element type as they are used.
+ */
+
+void
+BYTECODE_BATCH_NAME(const struct bytecode *this,
+                    const BYTECODE_BATCH_T *const *columns, size_t n,
+                    BYTECODE_BATCH_T *out)
+{
+	const struct BYTECODE_BATCH_KERNEL *k;
+	const union bytecode_word *pc;
+	const BYTECODE_BATCH_T **stack;
+	BYTECODE_BATCH_T *scratch, *saved, *dst;
+	size_t row, m, sp, i;
+
+	assert(this);
+	assert(columns || this->nvars == 0);
+	assert(out || n == 0);
+
+	if (n == 0)
+		return;
+
+	k = BYTECODE_BATCH_SELECT();
+
+	/*
+	 * stack[] points at each operand's values for the current chunk:
+	 * either straight into a column or into the scratch rows of that
+	 * stack slot, where results are computed.
+	 */
+	scratch = emalloc(this->maxstack * BYTECODE_BATCHSIZE *
+	    sizeof(*scratch));
+	stack = emalloc(this->maxstack * sizeof(*stack));
+	/* The rows of each shared node, kept from its store to its fetches */
+	saved = NULL;
+	if (this->nslots > 0)
+		saved = emalloc(this->nslots * BYTECODE_BATCHSIZE *
+		    sizeof(*saved));
+
+#define	SLOT(i)	(&scratch[(i) * BYTECODE_BATCHSIZE])
+#define	SAVED(i) (&saved[(i) * BYTECODE_BATCHSIZE])
+#define	BINOP(f) do {							\
+	dst = SLOT(sp - 2);						\
+	(f)(dst, stack[sp - 2], stack[sp - 1], m);			\
+	stack[sp - 2] = dst;						\
+	sp--;								\
+} while (/*CONSTCOND*/0)
+#define	BINOPK(f) do {							\
+	dst = SLOT(sp - 1);						\
+	(f)(dst, stack[sp - 1], (BYTECODE_BATCH_T)(++pc)->value, m);	\
+	stack[sp - 1] = dst;						\
+} while (/*CONSTCOND*/0)
+
+	for (row = 0; row < n; row += m) {
+		m = n - row < BYTECODE_BATCHSIZE ? n - row : BYTECODE_BATCHSIZE;
+		sp = 0;
+		for (pc = this->code; pc->op != bytecode_op_ret; pc++) {
+			switch ((enum bytecode_op)pc->op) {
+			case bytecode_op_push:
+				dst = SLOT(sp);
+				for (i = 0; i < m; i++)
+					dst[i] = (BYTECODE_BATCH_T)pc[1].value;
+				stack[sp++] = dst;
+				pc++;
+				break;
+			case bytecode_op_load:
+				stack[sp++] = &columns[(++pc)->index][row];
+				break;
+			case bytecode_op_store:
+				dst = SAVED((++pc)->index);
+				memcpy(dst, stack[sp - 1], m * sizeof(*dst));
+				break;
+			case bytecode_op_fetch:
+				stack[sp++] = SAVED((++pc)->index);
+				break;
+			case bytecode_op_neg:
+				dst = SLOT(sp - 1);
+				k->neg(dst, stack[sp - 1], m);
+				stack[sp - 1] = dst;
+				break;
+			case bytecode_op_add:
+				BINOP(k->add);
+				break;
+			case bytecode_op_sub:
+				BINOP(k->sub);
+				break;
+			case bytecode_op_mul:
+				BINOP(k->mul);
+				break;
+			case bytecode_op_div:
+				BINOP(k->div);
+				break;
+			case bytecode_op_addk:
+				BINOPK(k->addk);
+				break;
+			case bytecode_op_subk:
+				BINOPK(k->subk);
+				break;
+			case bytecode_op_mulk:
+				BINOPK(k->mulk);
+				break;
+			case bytecode_op_divk:
+				BINOPK(k->divk);
+				break;
+			case bytecode_op_ret:
+				break;
+			}
+		}
+		assert(sp == 1);
+		memcpy(&out[row], stack[0], m * sizeof(*out));
+	}
+
+#undef SLOT
+#undef SAVED
+#undef BINOP
+#undef BINOPK
+
+	free(saved);
+	free(stack);
+	free(scratch);
+}
+
+#undef BYTECODE_BATCH_NAME
+#undef BYTECODE_BATCH_T
+#undef BYTECODE_BATCH_KERNEL
+#undef BYTECODE_BATCH_SELECT
@@ -0,0 +1,318 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <util.h>
+
+#include "cache.h"
+
+#ifdef DEBUG_CACHE
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+/* 64-bit FNV-1a */
+#define CACHE_FNV_OFFSET	UINT64_C(0xcbf29ce484222325)
+#define CACHE_FNV_PRIME		UINT64_C(0x100000001b3)
+
+#define CACHE_NIL		UINT32_MAX
+
+#define CACHE_ISWORD(c)							\
+	(((c) >= '0' && (c) <= '9') || ((c) >= 'a' && (c) <= 'z') ||	\
+	 ((c) >= 'A' && (c) <= 'Z') || (c) == '.' || (c) == '_')
+
+#define CACHE_ISEXP(c)		((c) == 'e' || (c) == 'E')
+
+#define CACHE_ISSIGN(c)		((c) == '+' || (c) == '-')
+
+#define CACHE_ISSPACE(c)						\
+	((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\v' ||	\
+	 (c) == '\f' || (c) == '\r')
+
+struct cache_entry {
+	uint64_t	 hash;
+	uint32_t	 next;		/* bucket chain */
+	uint32_t	 keylen;
+	uint32_t	 keysize;
+	int		 used;
+	int		 referenced;
+	double		 value;
+	char		*key;
+};
+
+struct cache {
+	struct cache_entry	*entries;
+	uint32_t		 nentries;
+	uint32_t		 hand;		/* CLOCK hand */
+	uint32_t		*buckets;
+	uint64_t		 mask;
+
+	/* Key of the last miss */
+	char			 key[CACHE_MAXKEY];
+	size_t			 keylen;
+	uint64_t		 hash;
+	int			 pending;
+
+	struct cache_stats	 stats;
+};
+
+static int
+cache_normalize(struct cache *this, const char *text, size_t len);
+
+static int
+cache_joins(const char *key, size_t n, int c);
+
+static uint32_t
+cache_evict(struct cache *this);
+
+struct cache *
+cache_new(size_t nentries)
+{
+	struct cache *this;
+	size_t nbuckets, i;
+
+	assert(nentries > 0 && nentries < CACHE_NIL);
+
+	this = ecalloc(1, sizeof(*this));
+
+	this->nentries = (uint32_t)nentries;
+	this->entries = ecalloc(nentries, sizeof(*this->entries));
+
+	/* Load factor of at most 1/2 */
+	for (nbuckets = 1; nbuckets < nentries * 2; nbuckets <<= 1)
+		continue;
+	this->buckets = emalloc(nbuckets * sizeof(*this->buckets));
+	for (i = 0; i < nbuckets; i++)
+		this->buckets[i] = CACHE_NIL;
+	this->mask = nbuckets - 1;
+
+	return this;
+}
+
+void
+cache_delete(struct cache *this)
+{
+	uint32_t i;
+
+	assert(this);
+
+	for (i = 0; i < this->nentries; i++)
+		free(this->entries[i].key);
+	free(this->entries);
+	free(this->buckets);
+	free(this);
+}
+
+int
+cache_lookup(struct cache *this, const char *text, size_t len, double *v)
+{
+	struct cache_entry *e;
+	uint32_t i;
+
+	assert(this);
+	assert(text || len == 0);
+	assert(v);
+
+	this->pending = 0;
+
+	if (cache_normalize(this, text, len) == -1) {
+		this->stats.uncacheable++;
+		return 0;
+	}
+
+	for (i = this->buckets[this->hash & this->mask]; i != CACHE_NIL;
+	    i = e->next) {
+		e = &this->entries[i];
+		if (e->hash == this->hash && e->keylen == this->keylen &&
+		    memcmp(e->key, this->key, this->keylen) == 0) {
+			e->referenced = 1;
+			*v = e->value;
+			this->stats.hits++;
+			return 1;
+		}
+	}
+
+	this->stats.misses++;
+	this->pending = 1;
+
+	return 0;
+}
+
+void
+cache_insert(struct cache *this, double v)
+{
+	struct cache_entry *e;
+	uint32_t i, *b;
+
+	assert(this);
+
+	if (!this->pending)
+		return;
+	this->pending = 0;
+
+	i = cache_evict(this);
+	e = &this->entries[i];
+
+	/* Entries keep their key buffer; it only ever grows */
+	if (e->key == NULL || e->keysize < this->keylen) {
+		e->keysize = this->keylen ? (uint32_t)this->keylen : 1;
+		e->key = erealloc(e->key, e->keysize);
+	}
+	memcpy(e->key, this->key, this->keylen);
+	e->keylen = (uint32_t)this->keylen;
+	e->hash = this->hash;
+	e->value = v;
+	e->used = 1;
+	e->referenced = 0;
+
+	b = &this->buckets[this->hash & this->mask];
+	e->next = *b;
+	*b = i;
+}
+
+void
+cache_stats(struct cache *this, struct cache_stats *stats)
+{
+
+	assert(this);
+	assert(stats);
+
+	*stats = this->stats;
+}
+
+/* Private functions */
+
+/*
+ * Copies text to this->key with insignificant whitespace removed, hashing
+ * as it goes.  Returns -1 if the key is too long.
+ */
+int
+cache_normalize(struct cache *this, const char *text, size_t len)
+{
+	uint64_t hash;
+	size_t i, n;
+	int c, space;
+
+	hash = CACHE_FNV_OFFSET;
+	space = 0;
+	n = 0;
+
+	for (i = 0; i < len; i++) {
+		c = (unsigned char)text[i];
+		if (CACHE_ISSPACE(c)) {
+			space = 1;
+			continue;
+		}
+		if (space && cache_joins(this->key, n, c)) {
+			if (n == sizeof(this->key))
+				return -1;
+			this->key[n++] = ' ';
+			hash = (hash ^ ' ') * CACHE_FNV_PRIME;
+		}
+		space = 0;
+		if (n == sizeof(this->key))
+			return -1;
+		this->key[n++] = (char)c;
+		hash = (hash ^ (unsigned)c) * CACHE_FNV_PRIME;
+	}
+
+	this->keylen = n;
+	this->hash = hash;
+
+	return 0;
+}
+
+/*
+ * Whether c written right after the n bytes of key could join the last
+ * token, so that the whitespace between them is significant.  "1 + 2" and
+ * "1+2" are the same expression, but "1 2" and "12" are not, and neither
+ * are "1e -5", "1e- 5" and "1e-5": only the last holds an exponent.
+ */
+int
+cache_joins(const char *key, size_t n, int c)
+{
+	int last;
+
+	if (n == 0)
+		return 0;
+
+	last = (unsigned char)key[n - 1];
+	if (CACHE_ISSIGN(c))
+		return CACHE_ISEXP(last);
+	if (!CACHE_ISWORD(c))
+		return 0;
+	if (CACHE_ISWORD(last))
+		return 1;
+
+	return CACHE_ISSIGN(last) && n > 1 &&
+	    CACHE_ISEXP((unsigned char)key[n - 2]);
+}
+
+/* Returns a free entry, evicting the first unreferenced one if needed */
+uint32_t
+cache_evict(struct cache *this)
+{
+	struct cache_entry *e;
+	uint32_t i, *p;
+
+	for (;;) {
+		i = this->hand;
+		this->hand = (this->hand + 1) % this->nentries;
+		e = &this->entries[i];
+
+		if (!e->used)
+			return i;
+		if (e->referenced) {
+			e->referenced = 0;
+			continue;
+		}
+		break;
+	}
+
+	DPRINTF(("%s(): entry=%" PRIu32 "\n", __func__, i));
+
+	for (p = &this->buckets[e->hash & this->mask]; *p != i;
+	    p = &this->entries[*p].next)
+		assert(*p != CACHE_NIL);
+	*p = e->next;
+	e->used = 0;
+	this->stats.evictions++;
+
+	return i;
+}
@@ -0,0 +1,76 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __EVALVAL_CACHE_H__
+#define __EVALVAL_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bounded cache of results keyed on expression text.  Keys are normalized
+ * by dropping whitespace that does not separate two numbers or names, so
+ * "1 + 2" and "1+2" share an entry.  Replacement uses the CLOCK algorithm.
+ * Lines longer than CACHE_MAXKEY bytes are never cached.
+ */
+
+#define CACHE_MAXKEY	1024
+
+struct cache_stats {
+	uint64_t	hits;
+	uint64_t	misses;
+	uint64_t	evictions;
+	uint64_t	uncacheable;
+};
+
+struct cache;
+
+struct cache *
+cache_new(size_t nentries);
+
+void
+cache_delete(struct cache *this);
+
+/*
+ * Returns 1 and stores the cached result in *v on a hit.  On a miss the
+ * normalized key is remembered for a following cache_insert().
+ */
+int
+cache_lookup(struct cache *this, const char *text, size_t len, double *v);
+
+/* Records v as the result of the last missed cache_lookup() */
+void
+cache_insert(struct cache *this, double v);
+
+void
+cache_stats(struct cache *this, struct cache_stats *stats);
+
+#endif /* __EVALVAL_CACHE_H__ */
@@ -0,0 +1,451 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <float.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <util.h>
+
+#include "arena.h"
+#include "astnode.h"
+#include "bytecode.h"
+#include "cache.h"
+#include "catalog.h"
+#include "evaluator.h"
+#include "evalval.h"
+#include "optimizer.h"
+#include "output.h"
+#include "parser.h"
+#include "stats.h"
+
+#include "calc.h"
+
+#ifdef DEBUG_CALC
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+struct calc {
+	struct parser		*parser;
+	struct evaluator	*evaluator;
+	struct cache		*cache;
+	enum output_format	 format;
+	struct stats		*stats;
+	enum calc_type		 type;
+	int			 reply;		/* errors go to buf */
+	int			 quiet;		/* errors are only counted */
+	uint64_t		 rejected;
+};
+
+static const char *const calc_types[] = {
+	[calc_type_auto] = "auto",
+	[calc_type_float] = "float",
+	[calc_type_double] = "double",
+	[calc_type_longdouble] = "ldouble",
+	[calc_type_int64] = "int64"
+};
+
+static size_t
+calc_syntaxerror(struct calc *this, const char *s, size_t len, char *buf);
+
+static size_t
+calc_error(struct calc *this, char *buf, const char *fmt, ...)
+    __printflike(3, 4);
+
+static enum evalval_error
+calc_status(enum parser_error error);
+
+static double
+calc_eval(struct calc *this, struct astnode *n);
+
+struct calc *
+calc_new(enum output_format format, size_t cachesize)
+{
+	struct calc *this;
+
+	this = ecalloc(1, sizeof(*this));
+
+	this->parser = parser_new();
+	this->evaluator = evaluator_new();
+	if (cachesize > 0)
+		this->cache = cache_new(cachesize);
+	this->format = format;
+
+	return this;
+}
+
+void
+calc_delete(struct calc *this)
+{
+
+	assert(this);
+
+	if (this->cache != NULL)
+		cache_delete(this->cache);
+	evaluator_delete(this->evaluator);
+	parser_delete(this->parser);
+	free(this);
+}
+
+size_t
+calc_line(struct calc *this, const char *s, size_t len, char *buf)
+{
+	struct stats *st;
+	struct astnode *n;
+	uint64_t t, lex;
+	size_t rv;
+	int64_t iv;
+	double v;
+	int hit, ok;
+
+	assert(this);
+	assert(s || len == 0);
+	assert(buf);
+
+	st = this->stats;
+	if (st != NULL) {
+		st->lines++;
+		st->bytes += len + 1;
+	}
+
+	if (this->cache != NULL) {
+		STATS_START(st, t);
+		hit = cache_lookup(this->cache, s, len, &v);
+		STATS_STOP(st, stats_phase_cache, t);
+		if (hit)
+			goto out;
+	}
+
+	/* Tokenizer time is counted by the parser; the rest is tree building */
+	lex = st != NULL ? st->cycles[stats_phase_lex] : 0;
+	STATS_START(st, t);
+	n = parser_parse(this->parser, s, len);
+	STATS_STOP(st, stats_phase_parse, t);
+	if (st != NULL) {
+		st->cycles[stats_phase_parse] -=
+		    st->cycles[stats_phase_lex] - lex;
+		st->allocated += arena_allocated(parser_arena(this->parser));
+	}
+	if (n == NULL) {
+		rv = calc_syntaxerror(this, s, len, buf);
+		goto err;
+	}
+	if (parser_nvariables(this->parser) > 0) {
+		if (this->format == output_format_binary)
+			rv = output_formaterror(evalval_error_unbound,
+			    parser_variableoffset(this->parser, 0), buf);
+		else
+			rv = calc_error(this, buf, "Unbound variable: '%s'",
+			    parser_variable(this->parser, 0));
+		goto err;
+	}
+
+	STATS_START(st, t);
+	if (this->type == calc_type_int64) {
+		ok = evaluator_eval_int64(this->evaluator, n, NULL, &iv);
+		v = (double)iv;
+	} else {
+		ok = 1;
+		v = calc_eval(this, n);
+	}
+	STATS_STOP(st, stats_phase_eval, t);
+
+	if (!ok) {
+		if (this->format == output_format_binary)
+			rv = output_formaterror(evalval_error_range, 0, buf);
+		else
+			rv = calc_error(this, buf, "Not representable as "
+			    "an integer");
+		goto err;
+	}
+
+	parser_reset(this->parser);
+
+	/* Doubles cannot hold such results for the cache */
+	if (this->type == calc_type_int64 &&
+	    (iv > INT64_C(1) << DBL_MANT_DIG ||
+	     iv < -(INT64_C(1) << DBL_MANT_DIG))) {
+		STATS_START(st, t);
+		rv = output_formatint64(this->format, iv, buf);
+		STATS_STOP(st, stats_phase_output, t);
+		return rv;
+	}
+
+	if (this->cache != NULL) {
+		STATS_START(st, t);
+		cache_insert(this->cache, v);
+		STATS_STOP(st, stats_phase_cache, t);
+	}
+
+out:
+	STATS_START(st, t);
+	rv = output_formatdouble(this->format, v, buf);
+	STATS_STOP(st, stats_phase_output, t);
+
+	return rv;
+
+err:
+	this->rejected++;
+	if (st != NULL)
+		st->errors++;
+	parser_reset(this->parser);
+
+	return rv;
+}
+
+void
+calc_compile(struct calc *this, const char *s, size_t len,
+             struct catalog_builder *b)
+{
+	char buf[OUTPUT_MAXSIZE];
+	struct bytecode *bc;
+	struct astnode *n;
+	size_t i, offset;
+	int status;
+
+	assert(this);
+	assert(s || len == 0);
+	assert(b);
+
+	if (this->stats != NULL) {
+		this->stats->lines++;
+		this->stats->bytes += len + 1;
+	}
+
+	n = parser_parse(this->parser, s, len);
+	if (n == NULL) {
+		(void)calc_syntaxerror(this, s, len, buf);
+		status = calc_status(parser_error(this->parser, &offset));
+		catalog_builder_adderror(b, status, offset);
+		this->rejected++;
+		if (this->stats != NULL)
+			this->stats->errors++;
+		parser_reset(this->parser);
+		return;
+	}
+
+	n = optimizer_optimize(parser_nodes(this->parser), n);
+	bc = bytecode_compile(n);
+	catalog_builder_add(b, bc, parser_nvariables(this->parser));
+	for (i = 0; i < parser_nvariables(this->parser); i++)
+		catalog_builder_addvariable(b,
+		    parser_variable(this->parser, i));
+	bytecode_delete(bc);
+
+	parser_reset(this->parser);
+}
+
+struct cache *
+calc_cache(struct calc *this)
+{
+
+	assert(this);
+
+	return this->cache;
+}
+
+void
+calc_setreply(struct calc *this, int reply)
+{
+
+	assert(this);
+
+	this->reply = reply;
+}
+
+void
+calc_setquiet(struct calc *this, int quiet)
+{
+
+	assert(this);
+
+	this->quiet = quiet;
+}
+
+uint64_t
+calc_rejected(struct calc *this)
+{
+
+	assert(this);
+
+	return this->rejected;
+}
+
+void
+calc_setstats(struct calc *this, struct stats *st)
+{
+
+	assert(this);
+
+	this->stats = st;
+	parser_setstats(this->parser, st);
+}
+
+void
+calc_settype(struct calc *this, enum calc_type type)
+{
+
+	assert(this);
+	assert(type >= calc_type_auto && type <= calc_type_int64);
+
+	this->type = type;
+}
+
+int
+calc_parsetype(const char *name, enum calc_type *type)
+{
+	size_t i;
+
+	assert(name);
+	assert(type);
+
+	for (i = 0; i < __arraycount(calc_types); i++) {
+		if (strcmp(name, calc_types[i]) == 0) {
+			*type = (enum calc_type)i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Private functions */
+
+/* Reports the byte the parser stopped at, NUL past the end of the line */
+size_t
+calc_syntaxerror(struct calc *this, const char *s, size_t len, char *buf)
+{
+	enum parser_error error;
+	size_t offset;
+	int c;
+
+	assert(this);
+
+	error = parser_error(this->parser, &offset);
+	if (this->format == output_format_binary)
+		return output_formaterror(calc_status(error), offset, buf);
+	if (offset >= len && this->reply)
+		return calc_error(this, buf, "Unexpected end of line");
+	c = offset < len ? (unsigned char)s[offset] : '\0';
+
+	return calc_error(this, buf, "Unrecognized input symbol: '%c'", c);
+}
+
+/* The status byte of binary records */
+enum evalval_error
+calc_status(enum parser_error error)
+{
+
+	switch (error) {
+	case parser_error_symbol:
+		return evalval_error_symbol;
+	case parser_error_operand:
+		return evalval_error_operand;
+	case parser_error_paren:
+		return evalval_error_paren;
+	default:
+		abort();
+	}
+}
+
+/* Evaluates a constant tree in a floating-point type */
+double
+calc_eval(struct calc *this, struct astnode *n)
+{
+	double v;
+
+	switch (this->type) {
+	case calc_type_float:
+		return evaluator_eval_float(this->evaluator, n, NULL);
+	case calc_type_longdouble:
+		return (double)evaluator_eval_longdouble(this->evaluator, n,
+		    NULL);
+	case calc_type_auto:
+		if (parser_integral(this->parser) &&
+		    evaluator_eval_exact(this->evaluator, n, NULL, &v))
+			return v;
+		/* FALLTHROUGH */
+	case calc_type_double:
+	default:
+		return evaluator_eval(this->evaluator, n);
+	}
+}
+
+/*
+ * Reports a rejected line on stderr and returns 0 or, in reply mode,
+ * formats it as "error: <message>" and a newline into buf and returns the
+ * length.  Overlong messages are truncated.  In quiet mode nothing is
+ * formatted at all.
+ */
+size_t
+calc_error(struct calc *this, char *buf, const char *fmt, ...)
+{
+	va_list ap;
+	size_t n;
+	int rv;
+
+	assert(this);
+	assert(buf);
+
+	if (this->quiet && !this->reply)
+		return 0;
+
+	va_start(ap, fmt);
+	if (!this->reply) {
+		/* Whole lines, as workers may report concurrently */
+		flockfile(stderr);
+		vfprintf(stderr, fmt, ap);
+		fputc('\n', stderr);
+		funlockfile(stderr);
+		va_end(ap);
+		return 0;
+	}
+
+	n = strlcpy(buf, "error: ", OUTPUT_MAXSIZE);
+	rv = vsnprintf(buf + n, OUTPUT_MAXSIZE - n, fmt, ap);
+	va_end(ap);
+	if (rv < 0)
+		rv = 0;
+	n += (size_t)rv;
+	if (n > OUTPUT_MAXSIZE - 1)
+		n = OUTPUT_MAXSIZE - 1;
+	buf[n++] = '\n';
+
+	return n;
+}
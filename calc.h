@@ -0,0 +1,128 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __EVALVAL_CALC_H__
+#define __EVALVAL_CALC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "output.h"
+
+/*
+ * Line-at-a-time evaluation context: a parser, the output format and an
+ * optional result cache.  Contexts are not shared between threads; the
+ * pipeline gives each worker its own.
+ */
+
+struct cache;
+struct calc;
+struct catalog_builder;
+struct stats;
+
+/* Arithmetic of calc_line(), see calc_settype() */
+enum calc_type {
+	calc_type_auto,		/* double, integers where exact */
+	calc_type_float,
+	calc_type_double,
+	calc_type_longdouble,
+	calc_type_int64		/* checked, see evaluator_eval_int64() */
+};
+
+/* cachesize is the number of cached results, 0 disables the cache */
+struct calc *
+calc_new(enum output_format format, size_t cachesize);
+
+void
+calc_delete(struct calc *this);
+
+/*
+ * Evaluates one line and writes the result and a newline to buf, which must
+ * have room for OUTPUT_MAXSIZE bytes.  Returns the number of bytes written,
+ * or 0 if the line was rejected; the error has been reported.  In reply
+ * mode the error is written to buf instead, see calc_setreply().  With
+ * output_format_binary every line gets a record, errors included.
+ */
+size_t
+calc_line(struct calc *this, const char *s, size_t len, char *buf);
+
+/*
+ * Adds the optimized bytecode of one line to a catalog instead of
+ * evaluating it; variables are allowed.  A rejected line is reported as
+ * by calc_line() and stored with its error.
+ */
+void
+calc_compile(struct calc *this, const char *s, size_t len,
+             struct catalog_builder *b);
+
+/* The result cache, or NULL */
+struct cache *
+calc_cache(struct calc *this);
+
+/*
+ * Nonzero answers rejected lines with "error: <message>" and a newline in
+ * the output rather than on stderr, so that every line gets one reply.
+ */
+void
+calc_setreply(struct calc *this, int reply);
+
+/*
+ * Nonzero skips rejected lines silently, for feeds where malformed lines
+ * are expected: they are counted, see calc_rejected(), but not reported.
+ * Reply mode and binary records still answer every line.
+ */
+void
+calc_setquiet(struct calc *this, int quiet);
+
+/* Number of lines rejected so far, by calc_line() or calc_compile() */
+uint64_t
+calc_rejected(struct calc *this);
+
+/* Count lines, errors and phase times into st; NULL, the default, disables */
+void
+calc_setstats(struct calc *this, struct stats *st);
+
+/*
+ * Selects the arithmetic.  The default, calc_type_auto, evaluates a line
+ * with 64-bit integers when all its numbers are integers and it does not
+ * divide, and with doubles otherwise or whenever the integers could give a
+ * different result.  Float and long double results are printed as the
+ * nearest double.  With calc_type_int64 an overflow or an inexact
+ * division rejects the line, as evalval_error_range at offset 0.
+ */
+void
+calc_settype(struct calc *this, enum calc_type type);
+
+/* Parses a name of calc_settype(): auto, float, double, ldouble or int64 */
+int
+calc_parsetype(const char *name, enum calc_type *type);
+
+#endif /* __EVALVAL_CALC_H__ */
@@ -0,0 +1,530 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <util.h>
+
+#include "bytecode.h"
+#include "evalval.h"
+
+#include "catalog.h"
+
+#ifdef DEBUG_CATALOG
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+/*
+ * File layout.  All offsets are from the start of the file, so it can be
+ * mapped at any address, and everything is 8-byte aligned.  Numbers are
+ * in the byte order of the writer; a catalog is opened only on a machine
+ * of the same byte order.
+ *
+ *	header
+ *	for each entry: bytecode, nvars name offsets, the names
+ *	entry table
+ *
+ * The version must change whenever the header, the entries or struct
+ * bytecode and its instructions do.
+ */
+#define CATALOG_MAGIC		"EVALCAT"
+#define CATALOG_VERSION		2
+#define CATALOG_BYTEORDER	0x01020304
+#define CATALOG_ALIGN(n)	(((n) + 7) & ~(size_t)7)
+
+/* What is known of an entry, see catalog_entry() */
+#define CATALOG_UNCHECKED	0
+#define CATALOG_GOOD		1
+#define CATALOG_DAMAGED		2
+
+struct catalog_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	byteorder;
+	uint64_t	nentries;
+	uint64_t	entries;	/* offset of the entry table */
+	uint64_t	size;		/* of the file */
+};
+
+struct catalog_entry {
+	uint64_t	code;		/* of the bytecode, 0 if rejected */
+	uint64_t	names;		/* offset of nvars offsets of names */
+	uint32_t	nvars;
+	uint32_t	status;
+	uint64_t	offset;		/* of the error in the expression */
+};
+
+struct catalog_builder {
+	char			*blob;		/* the file after the header */
+	size_t			 bloblen;
+	size_t			 blobsize;
+	struct catalog_entry	*entries;
+	size_t			 nentries;
+	size_t			 entriessize;
+	size_t			 nvars;		/* variables added so far */
+};
+
+struct catalog {
+	void			*map;
+	size_t			 size;
+	const struct catalog_header *header;
+	const struct catalog_entry *entries;
+	atomic_uchar		*states;	/* per entry */
+};
+
+static size_t
+catalog_builder_reserve(struct catalog_builder *this, size_t len);
+
+static struct catalog_entry *
+catalog_builder_newentry(struct catalog_builder *this);
+
+static int
+catalog_check(struct catalog *this);
+
+static const struct catalog_entry *
+catalog_entry(const struct catalog *this, size_t i);
+
+static int
+catalog_checkentry(const struct catalog *this, const struct catalog_entry *e);
+
+static int
+catalog_writeall(int fd, const void *buf, size_t len);
+
+struct catalog_builder *
+catalog_builder_new(void)
+{
+
+	return ecalloc(1, sizeof(struct catalog_builder));
+}
+
+void
+catalog_builder_delete(struct catalog_builder *this)
+{
+
+	assert(this);
+
+	free(this->blob);
+	free(this->entries);
+	free(this);
+}
+
+void
+catalog_builder_add(struct catalog_builder *this, const struct bytecode *bc,
+                    size_t nvars)
+{
+	struct catalog_entry *e;
+	size_t off;
+
+	assert(this);
+	assert(bc);
+	assert(nvars >= bytecode_nvariables(bc));
+
+	off = catalog_builder_reserve(this, bytecode_size(bc));
+	memcpy(&this->blob[off], bc, bytecode_size(bc));
+
+	e = catalog_builder_newentry(this);
+	e->code = sizeof(struct catalog_header) + off;
+	e->nvars = (uint32_t)nvars;
+
+	off = catalog_builder_reserve(this, nvars * sizeof(uint64_t));
+	e->names = sizeof(struct catalog_header) + off;
+	this->nvars = 0;
+}
+
+void
+catalog_builder_addvariable(struct catalog_builder *this, const char *name)
+{
+	struct catalog_entry *e;
+	uint64_t name_off;
+	size_t len, off;
+
+	assert(this);
+	assert(name);
+	assert(this->nentries > 0);
+
+	e = &this->entries[this->nentries - 1];
+	assert(this->nvars < e->nvars);
+
+	len = strlen(name) + 1;
+	off = catalog_builder_reserve(this, len);
+	memcpy(&this->blob[off], name, len);
+
+	/* The blob may have moved since the entry was added */
+	name_off = sizeof(struct catalog_header) + off;
+	memcpy(&this->blob[e->names - sizeof(struct catalog_header) +
+	    this->nvars * sizeof(uint64_t)], &name_off, sizeof(name_off));
+	this->nvars++;
+}
+
+void
+catalog_builder_adderror(struct catalog_builder *this, int status,
+                         size_t offset)
+{
+	struct catalog_entry *e;
+
+	assert(this);
+	assert(status > evalval_error_none && status <= evalval_error_range);
+
+	e = catalog_builder_newentry(this);
+	e->status = (uint32_t)status;
+	e->offset = offset;
+}
+
+int
+catalog_builder_write(struct catalog_builder *this, int fd)
+{
+	struct catalog_header h;
+	static const char pad[8];
+	size_t entries;
+
+	assert(this);
+	assert(this->nentries == 0 ||
+	    this->nvars == this->entries[this->nentries - 1].nvars);
+
+	entries = sizeof(h) + CATALOG_ALIGN(this->bloblen);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+	h.version = CATALOG_VERSION;
+	h.byteorder = CATALOG_BYTEORDER;
+	h.nentries = this->nentries;
+	h.entries = entries;
+	h.size = entries + this->nentries * sizeof(*this->entries);
+
+	DPRINTF(("%s(): nentries=%zu size=%" PRIu64 "\n", __func__,
+	    this->nentries, h.size));
+
+	if (catalog_writeall(fd, &h, sizeof(h)) == -1 ||
+	    catalog_writeall(fd, this->blob, this->bloblen) == -1 ||
+	    catalog_writeall(fd, pad, entries - sizeof(h) - this->bloblen)
+	    == -1 ||
+	    catalog_writeall(fd, this->entries,
+	    this->nentries * sizeof(*this->entries)) == -1)
+		return -1;
+
+	return 0;
+}
+
+struct catalog *
+catalog_open(const char *path)
+{
+	struct catalog *this;
+	struct stat st;
+	int fd, serrno;
+
+	assert(path);
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1) {
+		serrno = errno;
+		close(fd);
+		errno = serrno;
+		return NULL;
+	}
+	if (!S_ISREG(st.st_mode) ||
+	    (size_t)st.st_size < sizeof(struct catalog_header) ||
+	    (unsigned long long)st.st_size > SIZE_MAX) {
+		close(fd);
+		errno = EFTYPE;
+		return NULL;
+	}
+
+	this = ecalloc(1, sizeof(*this));
+	this->size = (size_t)st.st_size;
+	this->map = mmap(NULL, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	serrno = errno;
+	close(fd);
+	if (this->map == MAP_FAILED) {
+		free(this);
+		errno = serrno;
+		return NULL;
+	}
+
+	this->header = this->map;
+	if (!catalog_check(this)) {
+		munmap(this->map, this->size);
+		free(this);
+		errno = EFTYPE;
+		return NULL;
+	}
+	/* All CATALOG_UNCHECKED, in pages that are not touched until then */
+	this->states = ecalloc((size_t)this->header->nentries + 1,
+	    sizeof(*this->states));
+
+	DPRINTF(("%s(): catalog=%p nentries=%" PRIu64 "\n", __func__, this,
+	    this->header->nentries));
+
+	return this;
+}
+
+void
+catalog_close(struct catalog *this)
+{
+
+	assert(this);
+
+	munmap(this->map, this->size);
+	free(this->states);
+	free(this);
+}
+
+size_t
+catalog_count(const struct catalog *this)
+{
+
+	assert(this);
+
+	return (size_t)this->header->nentries;
+}
+
+const struct bytecode *
+catalog_get(const struct catalog *this, size_t i, int *status,
+            size_t *offset)
+{
+	const struct catalog_entry *e;
+
+	assert(this);
+
+	e = catalog_entry(this, i);
+	if (e == NULL) {
+		if (status != NULL)
+			*status = evalval_error_damaged;
+		if (offset != NULL)
+			*offset = 0;
+		return NULL;
+	}
+	if (status != NULL)
+		*status = (int)e->status;
+	if (offset != NULL)
+		*offset = (size_t)e->offset;
+	if (e->code == 0)
+		return NULL;
+
+	return (const struct bytecode *)((const char *)this->map + e->code);
+}
+
+size_t
+catalog_nvariables(const struct catalog *this, size_t i)
+{
+	const struct catalog_entry *e;
+
+	assert(this);
+
+	e = catalog_entry(this, i);
+
+	return e != NULL ? e->nvars : 0;
+}
+
+const char *
+catalog_variable(const struct catalog *this, size_t i, size_t index)
+{
+	const struct catalog_entry *e;
+	const uint64_t *names;
+
+	assert(this);
+
+	e = catalog_entry(this, i);
+	if (e == NULL || index >= e->nvars)
+		return NULL;
+
+	names = (const uint64_t *)((const char *)this->map + e->names);
+
+	return (const char *)this->map + names[index];
+}
+
+/* Private functions */
+
+/* Appends len bytes at an 8-byte boundary and returns their blob offset */
+size_t
+catalog_builder_reserve(struct catalog_builder *this, size_t len)
+{
+	size_t off;
+
+	off = CATALOG_ALIGN(this->bloblen);
+	while (this->blobsize < off || this->blobsize - off < len) {
+		this->blobsize = this->blobsize ? this->blobsize * 2 : 65536;
+		this->blob = erealloc(this->blob, this->blobsize);
+	}
+	memset(&this->blob[this->bloblen], 0, off - this->bloblen);
+	this->bloblen = off + len;
+
+	return off;
+}
+
+struct catalog_entry *
+catalog_builder_newentry(struct catalog_builder *this)
+{
+	struct catalog_entry *e;
+
+	if (this->nentries > 0)
+		assert(this->nvars == this->entries[this->nentries - 1].nvars);
+
+	if (this->nentries == this->entriessize) {
+		this->entriessize = this->entriessize ?
+		    this->entriessize * 2 : 1024;
+		this->entries = erealloc(this->entries,
+		    this->entriessize * sizeof(*this->entries));
+	}
+
+	e = &this->entries[this->nentries++];
+	memset(e, 0, sizeof(*e));
+	this->nvars = 0;
+
+	return e;
+}
+
+/*
+ * The header and that the entry table lies within the file, which is all
+ * that opening reads: entries are left to catalog_entry().  Sets the entry
+ * table.
+ */
+int
+catalog_check(struct catalog *this)
+{
+	const struct catalog_header *h;
+
+	h = this->header;
+	if (memcmp(h->magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0 ||
+	    h->version != CATALOG_VERSION ||
+	    h->byteorder != CATALOG_BYTEORDER || h->size != this->size)
+		return 0;
+	if (h->entries < sizeof(*h) || h->entries > this->size ||
+	    (h->entries & 7) != 0 ||
+	    h->nentries > (this->size - h->entries) / sizeof(*this->entries))
+		return 0;
+
+	this->entries = (const struct catalog_entry *)
+	    ((const char *)this->map + h->entries);
+
+	return 1;
+}
+
+/*
+ * Entry i, checked the first time it is used so that opening does not
+ * read the whole file; NULL if it is damaged.  Threads that check the
+ * same entry at once come to the same verdict, so the race is harmless.
+ */
+const struct catalog_entry *
+catalog_entry(const struct catalog *this, size_t i)
+{
+	const struct catalog_entry *e;
+	unsigned char state;
+
+	assert(i < this->header->nentries);
+
+	e = &this->entries[i];
+	state = atomic_load_explicit(&this->states[i], memory_order_relaxed);
+	if (state == CATALOG_UNCHECKED) {
+		state = catalog_checkentry(this, e) ? CATALOG_GOOD :
+		    CATALOG_DAMAGED;
+		atomic_store_explicit(&this->states[i], state,
+		    memory_order_relaxed);
+		DPRINTF(("%s(): entry=%zu state=%d\n", __func__, i, state));
+	}
+
+	return state == CATALOG_GOOD ? e : NULL;
+}
+
+/*
+ * Everything the accessors rely on: a known status, that all offsets are
+ * aligned and in the file, the names are terminated and the bytecode
+ * passes bytecode_verify().
+ */
+int
+catalog_checkentry(const struct catalog *this, const struct catalog_entry *e)
+{
+	const struct bytecode *bc;
+	const uint64_t *names;
+	const char *map;
+	uint32_t j;
+
+	map = this->map;
+
+	if (e->code == 0)
+		return e->status > evalval_error_none &&
+		    e->status <= evalval_error_range && e->nvars == 0;
+	if (e->status != 0 || (e->code & 7) != 0 || e->code >= this->size)
+		return 0;
+
+	bc = bytecode_verify(map + e->code, this->size - e->code);
+	if (bc == NULL || bytecode_nvariables(bc) > e->nvars)
+		return 0;
+
+	if ((e->names & 7) != 0 || e->names > this->size ||
+	    e->nvars > (this->size - e->names) / sizeof(uint64_t))
+		return 0;
+	names = (const uint64_t *)(map + e->names);
+	for (j = 0; j < e->nvars; j++) {
+		if (names[j] >= this->size ||
+		    memchr(map + names[j], '\0', this->size - names[j]) ==
+		    NULL)
+			return 0;
+	}
+
+	return 1;
+}
+
+int
+catalog_writeall(int fd, const void *buf, size_t len)
+{
+	const char *p;
+	ssize_t rv;
+
+	for (p = buf; len > 0; p += rv, len -= (size_t)rv) {
+		rv = write(fd, p, len);
+		if (rv == -1) {
+			if (errno == EINTR) {
+				rv = 0;
+				continue;
+			}
+			return -1;
+		}
+	}
+
+	return 0;
+}
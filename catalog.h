@@ -0,0 +1,108 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef __EVALVAL_CATALOG_H__
+#define __EVALVAL_CATALOG_H__
+
+#include <stddef.h>
+
+/*
+ * Catalogs are files of compiled expressions that are used straight from
+ * an mmap(2) of the file: opening one does not parse or copy any
+ * expression, it only checks the header.  Each entry is checked the first
+ * time it is used, so a cold start faults in only the pages it touches.
+ * Entries are numbered in the order they were added, which for evalval -o
+ * is the order of the input lines; expressions that did not parse keep
+ * their place with the error.
+ */
+
+struct bytecode;
+struct catalog;
+struct catalog_builder;
+
+struct catalog_builder *
+catalog_builder_new(void);
+
+void
+catalog_builder_delete(struct catalog_builder *this);
+
+/*
+ * Adds an expression, followed by catalog_builder_addvariable() for each
+ * of its nvars variables in order.  The bytecode is copied.
+ */
+void
+catalog_builder_add(struct catalog_builder *this, const struct bytecode *bc,
+                    size_t nvars);
+
+void
+catalog_builder_addvariable(struct catalog_builder *this, const char *name);
+
+/* Adds an expression that was rejected with status at offset */
+void
+catalog_builder_adderror(struct catalog_builder *this, int status,
+                         size_t offset);
+
+/* Returns 0, or -1 with errno set */
+int
+catalog_builder_write(struct catalog_builder *this, int fd);
+
+/*
+ * Returns NULL with errno set on failure; EFTYPE if the file is not a
+ * catalog of this version and byte order or is damaged.
+ */
+struct catalog *
+catalog_open(const char *path);
+
+void
+catalog_close(struct catalog *this);
+
+size_t
+catalog_count(const struct catalog *this);
+
+/*
+ * The bytecode of entry i, valid until catalog_close(), or NULL if the
+ * expression was rejected.  status then receives the error, 0 otherwise,
+ * and offset its byte offset; either may be NULL.  An entry found damaged
+ * reads as rejected with evalval_error_damaged at offset 0.
+ */
+const struct bytecode *
+catalog_get(const struct catalog *this, size_t i, int *status,
+            size_t *offset);
+
+/* Variables of entry i, numbered as for parser_variable(); none if damaged */
+size_t
+catalog_nvariables(const struct catalog *this, size_t i);
+
+const char *
+catalog_variable(const struct catalog *this, size_t i, size_t index);
+
+#endif /* __EVALVAL_CATALOG_H__ */
@@ -34,12 +34,17 @@ __RCSID("$NetBSD$");
 
 #include <assert.h>
 #include <err.h>
+#include <float.h>
+#include <math.h>
 #include <regex.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <util.h>
 
 #include "astnode.h"
+#include "bytecode.h"
 
 #include "evaluator.h"
 
@@ -49,57 +54,380 @@ __RCSID("$NetBSD$");
 #define DPRINTF(a)
 #endif
 
+/* Nodes on the explicit stack of evaluator_evalsubtree() */
+struct evaluator_frame {
+	struct astnode	*node;
+	int		 visited;	/* operands already done */
+};
+
+/*
+ * Heap stacks for deep trees, kept for the next evaluation, and the values
+ * of shared DAG nodes by astnode_id(), valid when stamped with the epoch.
+ * Values are of the type being evaluated, so both arrays are sized for the
+ * widest one.
+ */
 struct evaluator
 {
+	struct evaluator_frame *frames;
+	void		*values;
+	size_t		 size;
+	void		*memo;
+	uint32_t	*stamps;
+	size_t		 memosize;
+	uint32_t	 epoch;
 };
 
-double
-evaluator_evalsubtree(struct evaluator *this, struct astnode *ast);
+/* Frames and values on the C stack; deeper trees move to the heap */
+#define EVALUATOR_STACKSIZE	64
+
+#define EVALUATOR_VALUESIZE	sizeof(long double)
+
+/* Integers up to 2^53 in magnitude are exact as doubles */
+#define EVALUATOR_EXACT		(INT64_C(1) << DBL_MANT_DIG)
+
+static int
+evaluator_evaldouble(struct evaluator *this, struct astnode *n,
+                     const double *vars, double *result);
+
+static int
+evaluator_evalfloat(struct evaluator *this, struct astnode *n,
+                    const double *vars, float *result);
+
+static int
+evaluator_evallongdouble(struct evaluator *this, struct astnode *n,
+                         const double *vars, long double *result);
+
+static int
+evaluator_evalint64(struct evaluator *this, struct astnode *n,
+                    const double *vars, int64_t *result);
+
+static int
+evaluator_evalexact(struct evaluator *this, struct astnode *n,
+                    const double *vars, int64_t *result);
+
+static void
+evaluator_newepoch(struct evaluator *this);
+
+static void
+evaluator_grow(struct evaluator *this, struct evaluator_frame **frames,
+               struct evaluator_frame *framebuf, void **values,
+               void *valuebuf, size_t valuesize, size_t *size);
+
+static size_t
+evaluator_recall(struct evaluator *this, struct astnode *n);
+
+static size_t
+evaluator_remember(struct evaluator *this, struct astnode *n);
 
-static struct evaluator this;
+static int
+evaluator_integer(double x, int64_t *v);
 
 struct evaluator *
-evaluator_singleton(void)
+evaluator_new(void)
 {
-	return &this;
+
+	return ecalloc(1, sizeof(struct evaluator));
+}
+
+void
+evaluator_delete(struct evaluator *this)
+{
+
+	assert(this);
+
+	free(this->frames);
+	free(this->values);
+	free(this->memo);
+	free(this->stamps);
+	free(this);
 }
 
 double
 evaluator_eval(struct evaluator *this, struct astnode *n)
 {
+	double v;
 
 	assert(this);
 	assert(n);
 
-	evaluator_evalsubtree(this, n);
-}
+	(void)evaluator_evaldouble(this, n, NULL, &v);
 
-/* Private functions */
+	return v;
+}
 
 double
-evaluator_evalsubtree(struct evaluator *this, struct astnode *n)
+evaluator_evalvars(struct evaluator *this, struct astnode *n,
+                   const double *vars)
 {
-	double v1, v2;
+	double v;
 
 	assert(this);
 	assert(n);
 
-	if (astnode_type(n) == astnode_type_number) {
-                return astnode_value(n);
-        } else if (astnode_type(n) == astnode_type_unaryminus) {
-                return -evaluator_evalsubtree(this, astnode_left(n));
-        } else {
-                v1 = evaluator_evalsubtree(this, astnode_left(n));
-                v2 = evaluator_evalsubtree(this, astnode_right(n));
-                switch (astnode_type(n)) {
-                        case astnode_type_plus:
-                                return v1 + v2;
-                        case astnode_type_minus:
-                                return v1 - v2;
-                        case astnode_type_mul:
-                                return v1 * v2;
-                        case astnode_type_div:
-                                return v1 / v2;
-                }
+	(void)evaluator_evaldouble(this, n, vars, &v);
+
+	return v;
+}
+
+float
+evaluator_eval_float(struct evaluator *this, struct astnode *n,
+                     const double *vars)
+{
+	float v;
+
+	assert(this);
+	assert(n);
+
+	(void)evaluator_evalfloat(this, n, vars, &v);
+
+	return v;
+}
+
+long double
+evaluator_eval_longdouble(struct evaluator *this, struct astnode *n,
+                          const double *vars)
+{
+	long double v;
+
+	assert(this);
+	assert(n);
+
+	(void)evaluator_evallongdouble(this, n, vars, &v);
+
+	return v;
+}
+
+int
+evaluator_eval_int64(struct evaluator *this, struct astnode *n,
+                     const double *vars, int64_t *result)
+{
+
+	assert(this);
+	assert(n);
+	assert(result);
+
+	return evaluator_evalint64(this, n, vars, result);
+}
+
+int
+evaluator_eval_exact(struct evaluator *this, struct astnode *n,
+                     const double *vars, double *result)
+{
+	int64_t v;
+
+	assert(this);
+	assert(n);
+	assert(result);
+
+	if (!evaluator_evalexact(this, n, vars, &v))
+		return 0;
+
+	*result = (double)v;
+
+	return 1;
+}
+
+void
+evaluator_eval_batch(struct evaluator *this, const struct bytecode *bc,
+                     const double *const *columns, size_t n, double *out)
+{
+
+	assert(this);
+	assert(bc);
+
+	bytecode_evalbatch(bc, columns, n, out);
+}
+
+void
+evaluator_eval_batch_float(struct evaluator *this, const struct bytecode *bc,
+                           const float *const *columns, size_t n, float *out)
+{
+
+	assert(this);
+	assert(bc);
+
+	bytecode_evalbatch_float(bc, columns, n, out);
+}
+
+/* Private functions */
+
+/* IEEE types: conversions and operations cannot fail */
+
+#define EVALUATOR_WALK_NAME		evaluator_evaldouble
+#define EVALUATOR_WALK_T		double
+#define EVALUATOR_WALK_LEAF(v, x)	((v) = (x), 1)
+#define EVALUATOR_WALK_NEG(v, a)	((v) = -(a), 1)
+#define EVALUATOR_WALK_ADD(v, a, b)	((v) = (a) + (b), 1)
+#define EVALUATOR_WALK_SUB(v, a, b)	((v) = (a) - (b), 1)
+#define EVALUATOR_WALK_MUL(v, a, b)	((v) = (a) * (b), 1)
+#define EVALUATOR_WALK_DIV(v, a, b)	((v) = (a) / (b), 1)
+#include "evaluator_walk.h"
+
+#define EVALUATOR_WALK_NAME		evaluator_evalfloat
+#define EVALUATOR_WALK_T		float
+#define EVALUATOR_WALK_LEAF(v, x)	((v) = (float)(x), 1)
+#define EVALUATOR_WALK_NEG(v, a)	((v) = -(a), 1)
+#define EVALUATOR_WALK_ADD(v, a, b)	((v) = (a) + (b), 1)
+#define EVALUATOR_WALK_SUB(v, a, b)	((v) = (a) - (b), 1)
+#define EVALUATOR_WALK_MUL(v, a, b)	((v) = (a) * (b), 1)
+#define EVALUATOR_WALK_DIV(v, a, b)	((v) = (a) / (b), 1)
+#include "evaluator_walk.h"
+
+#define EVALUATOR_WALK_NAME		evaluator_evallongdouble
+#define EVALUATOR_WALK_T		long double
+#define EVALUATOR_WALK_LEAF(v, x)	((v) = (x), 1)
+#define EVALUATOR_WALK_NEG(v, a)	((v) = -(a), 1)
+#define EVALUATOR_WALK_ADD(v, a, b)	((v) = (a) + (b), 1)
+#define EVALUATOR_WALK_SUB(v, a, b)	((v) = (a) - (b), 1)
+#define EVALUATOR_WALK_MUL(v, a, b)	((v) = (a) * (b), 1)
+#define EVALUATOR_WALK_DIV(v, a, b)	((v) = (a) / (b), 1)
+#include "evaluator_walk.h"
+
+/*
+ * Checked 64-bit integers: any overflow, a division with a remainder or
+ * by zero, or a number that is not an integer ends the evaluation.
+ */
+
+#define EVALUATOR_WALK_NAME		evaluator_evalint64
+#define EVALUATOR_WALK_T		int64_t
+#define EVALUATOR_WALK_LEAF(v, x)	evaluator_integer((x), &(v))
+#define EVALUATOR_WALK_NEG(v, a)	((a) != INT64_MIN && ((v) = -(a), 1))
+#define EVALUATOR_WALK_ADD(v, a, b)					\
+	(!__builtin_add_overflow((a), (b), &(v)))
+#define EVALUATOR_WALK_SUB(v, a, b)					\
+	(!__builtin_sub_overflow((a), (b), &(v)))
+#define EVALUATOR_WALK_MUL(v, a, b)					\
+	(!__builtin_mul_overflow((a), (b), &(v)))
+#define EVALUATOR_WALK_DIV(v, a, b)					\
+	((b) != 0 && ((a) != INT64_MIN || (b) != -1) &&			\
+	 (a) % (b) == 0 && ((v) = (a) / (b), 1))
+#include "evaluator_walk.h"
+
+/*
+ * Integers that give exactly what the double walk would: every value must
+ * stay within 2^53, where double arithmetic on integers is exact, and a
+ * result that would be -0 as a double ends the evaluation.
+ */
+
+#define EVALUATOR_EXACT_OK(v)						\
+	((v) >= -EVALUATOR_EXACT && (v) <= EVALUATOR_EXACT)
+
+#define EVALUATOR_WALK_NAME		evaluator_evalexact
+#define EVALUATOR_WALK_T		int64_t
+#define EVALUATOR_WALK_LEAF(v, x)	evaluator_integer((x), &(v))
+#define EVALUATOR_WALK_NEG(v, a)	((a) != 0 && ((v) = -(a), 1))
+#define EVALUATOR_WALK_ADD(v, a, b)					\
+	((v) = (a) + (b), EVALUATOR_EXACT_OK(v))
+#define EVALUATOR_WALK_SUB(v, a, b)					\
+	((v) = (a) - (b), EVALUATOR_EXACT_OK(v))
+#define EVALUATOR_WALK_MUL(v, a, b)					\
+	(!__builtin_mul_overflow((a), (b), &(v)) && EVALUATOR_EXACT_OK(v) && \
+	 ((v) != 0 || ((a) >= 0 && (b) >= 0)))
+#define EVALUATOR_WALK_DIV(v, a, b)					\
+	((b) != 0 && (a) % (b) == 0 && ((v) = (a) / (b), 1) &&		\
+	 ((v) != 0 || (b) > 0))
+#include "evaluator_walk.h"
+
+#undef EVALUATOR_EXACT_OK
+
+/* Forgets the shared values of the previous evaluation */
+void
+evaluator_newepoch(struct evaluator *this)
+{
+
+	if (++this->epoch == 0) {
+		memset(this->stamps, 0,
+		    this->memosize * sizeof(*this->stamps));
+		this->epoch = 1;
 	}
 }
+
+/*
+ * Doubles both stacks, moving them off the C stack the first time.  The
+ * heap stacks belong to the evaluator, so a deep tree allocates only once.
+ */
+void
+evaluator_grow(struct evaluator *this, struct evaluator_frame **frames,
+               struct evaluator_frame *framebuf, void **values,
+               void *valuebuf, size_t valuesize, size_t *size)
+{
+	size_t newsize;
+
+	newsize = *size * 2;
+
+	if (this->size < newsize) {
+		this->frames = erealloc(this->frames,
+		    newsize * sizeof(*this->frames));
+		this->values = erealloc(this->values,
+		    newsize * EVALUATOR_VALUESIZE);
+		this->size = newsize;
+	}
+
+	if (*frames == framebuf) {
+		memcpy(this->frames, framebuf, *size * sizeof(*framebuf));
+		memcpy(this->values, valuebuf, *size * valuesize);
+	}
+
+	*frames = this->frames;
+	*values = this->values;
+	*size = this->size;
+}
+
+/* The id of n if shared and evaluated already, its value is in memo */
+size_t
+evaluator_recall(struct evaluator *this, struct astnode *n)
+{
+	size_t id;
+
+	id = astnode_id(n);
+	if (id == 0 || id >= this->memosize ||
+	    this->stamps[id] != this->epoch)
+		return 0;
+
+	return id;
+}
+
+/* The id under which to record the value of n if shared, else 0 */
+size_t
+evaluator_remember(struct evaluator *this, struct astnode *n)
+{
+	size_t id, newsize;
+
+	if ((id = astnode_id(n)) == 0)
+		return 0;
+
+	if (id >= this->memosize) {
+		newsize = this->memosize > 0 ? this->memosize * 2 :
+		    EVALUATOR_STACKSIZE;
+		while (newsize <= id)
+			newsize *= 2;
+		this->memo = erealloc(this->memo,
+		    newsize * EVALUATOR_VALUESIZE);
+		this->stamps = erealloc(this->stamps,
+		    newsize * sizeof(*this->stamps));
+		memset(&this->stamps[this->memosize], 0,
+		    (newsize - this->memosize) * sizeof(*this->stamps));
+		this->memosize = newsize;
+	}
+
+	this->stamps[id] = this->epoch;
+
+	return id;
+}
+
+/*
+ * Converts x to v if it is an integer smaller than 2^53 in magnitude and
+ * not -0.  2^53 itself is also what larger numbers round to.
+ */
+int
+evaluator_integer(double x, int64_t *v)
+{
+
+	if (!(x > -EVALUATOR_EXACT && x < EVALUATOR_EXACT))
+		return 0;
+	*v = (int64_t)x;
+	if ((double)*v != x || (*v == 0 && signbit(x)))
+		return 0;
+
+	return 1;
+}
@@ -32,13 +32,73 @@
 #ifndef __EVALVAL_EVALUATOR_H__
 #define __EVALVAL_EVALUATOR_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
 struct evaluator;
 struct astnode;
+struct bytecode;
 
+/*
+ * Evaluators keep no state between calls other than scratch space, so one
+ * per thread suffices; they are not to be shared between threads.
+ */
 struct evaluator *
-evaluator_singleton(void);
+evaluator_new(void);
+
+void
+evaluator_delete(struct evaluator *this);
 
 double
 evaluator_eval(struct evaluator *, struct astnode *);
 
+/* vars[i] is the value of variable i, see parser_variable() */
+double
+evaluator_evalvars(struct evaluator *, struct astnode *, const double *vars);
+
+/*
+ * The same walk in other types; vars may be NULL without variables.  The
+ * numbers of the tree were read as doubles, so long double only carries
+ * more precision through the operations.
+ */
+float
+evaluator_eval_float(struct evaluator *, struct astnode *, const double *vars);
+
+long double
+evaluator_eval_longdouble(struct evaluator *, struct astnode *,
+                          const double *vars);
+
+/*
+ * Checked 64-bit integer arithmetic.  Numbers and variables must be
+ * integers smaller than 2^53 in magnitude, which doubles hold exactly;
+ * results may use the whole range.  Returns 0 on overflow, on a division
+ * with a remainder or by zero, or on a number that is not such an integer.
+ */
+int
+evaluator_eval_int64(struct evaluator *, struct astnode *, const double *vars,
+                     int64_t *result);
+
+/*
+ * Evaluates with integers if that gives bit for bit what evaluator_evalvars()
+ * would, which holds while every value stays within 2^53 and none is -0;
+ * otherwise returns 0 and the tree is to be evaluated as doubles.  See
+ * parser_integral() for the trees worth trying.
+ */
+int
+evaluator_eval_exact(struct evaluator *, struct astnode *, const double *vars,
+                     double *result);
+
+/*
+ * Evaluates a compiled expression over n rows: columns[i][r] is the value of
+ * variable i in row r, and the result is stored in out[r].
+ */
+void
+evaluator_eval_batch(struct evaluator *, const struct bytecode *,
+                     const double *const *columns, size_t n, double *out);
+
+/* The same in single precision, twice as many rows per SIMD instruction */
+void
+evaluator_eval_batch_float(struct evaluator *, const struct bytecode *,
+                           const float *const *columns, size_t n, float *out);
+
 #endif /* __EVALVAL_EVALUATOR_H__ */
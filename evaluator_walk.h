@@ -0,0 +1,207 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * The tree walk of the evaluator, included by evaluator.c once per
+ * numeric type with these defined:
+ *
+ *	EVALUATOR_WALK_NAME		the function
+ *	EVALUATOR_WALK_T		the type of values
+ *	EVALUATOR_WALK_LEAF(v, x)	converts the double x of a number or
+ *					variable to v
+ *	EVALUATOR_WALK_NEG(v, a)	v = -a
+ *	EVALUATOR_WALK_ADD(v, a, b)	v = a + b, and likewise
+ *	EVALUATOR_WALK_SUB(v, a, b)	for the other binary operators
+ *	EVALUATOR_WALK_MUL(v, a, b)
+ *	EVALUATOR_WALK_DIV(v, a, b)
+ *
+ * Each of the last six evaluates to 0 if the value cannot be represented,
+ * which ends the evaluation.  Where they are constant 1 the compiler
+ * removes the checks, so the double instance is the plain walk.
+ */
+
+#define	MEMO(id)	(((EVALUATOR_WALK_T *)this->memo)[(id)])
+
+/*
+ * Post-order walk with an explicit stack: a node is applied once its
+ * operands have been visited, their values being on top of the value
+ * stack.  Right operands that are numbers or variables are read directly
+ * rather than pushed.  Both stacks are bounded by the depth of the tree.
+ * A node shared in a DAG is evaluated the first time it is reached and
+ * its value is reused afterwards.  Returns 0 as soon as a conversion or
+ * an operation fails, which only the integer instances do.
+ */
+int
+EVALUATOR_WALK_NAME(struct evaluator *this, struct astnode *n,
+                    const double *vars, EVALUATOR_WALK_T *result)
+{
+	struct evaluator_frame framebuf[EVALUATOR_STACKSIZE];
+	EVALUATOR_WALK_T valuebuf[EVALUATOR_STACKSIZE];
+	struct evaluator_frame *frames;
+	struct evaluator_frame *f;
+	struct astnode *r;
+	EVALUATOR_WALK_T *values;
+	size_t nframes, nvalues, size, id;
+	EVALUATOR_WALK_T v1, v2;
+
+	assert(this);
+	assert(n);
+
+	evaluator_newepoch(this);
+
+	frames = framebuf;
+	values = valuebuf;
+	size = EVALUATOR_STACKSIZE;
+
+	nframes = 0;
+	nvalues = 0;
+	frames[nframes].node = n;
+	frames[nframes++].visited = 0;
+
+	while (nframes > 0) {
+		if (nframes == size || nvalues == size) {
+			evaluator_grow(this, &frames, framebuf,
+			    (void **)&values, valuebuf, sizeof(*values),
+			    &size);
+		}
+
+		f = &frames[nframes - 1];
+		n = f->node;
+
+		switch (astnode_type(n)) {
+		case astnode_type_number:
+			if (!EVALUATOR_WALK_LEAF(values[nvalues],
+			    astnode_value(n)))
+				return 0;
+			nvalues++;
+			nframes--;
+			continue;
+		case astnode_type_variable:
+			assert(vars);
+			if (!EVALUATOR_WALK_LEAF(values[nvalues],
+			    vars[astnode_index(n)]))
+				return 0;
+			nvalues++;
+			nframes--;
+			continue;
+		case astnode_type_unaryminus:
+			if (f->visited++ == 0) {
+				if ((id = evaluator_recall(this, n)) != 0) {
+					values[nvalues++] = MEMO(id);
+					nframes--;
+					continue;
+				}
+				frames[nframes].node = astnode_left(n);
+				frames[nframes++].visited = 0;
+				continue;
+			}
+			v1 = values[nvalues - 1];
+			if (!EVALUATOR_WALK_NEG(values[nvalues - 1], v1))
+				return 0;
+			if ((id = evaluator_remember(this, n)) != 0)
+				MEMO(id) = values[nvalues - 1];
+			nframes--;
+			continue;
+		default:
+			break;
+		}
+
+		r = astnode_right(n);
+		if (f->visited == 0) {
+			if ((id = evaluator_recall(this, n)) != 0) {
+				values[nvalues++] = MEMO(id);
+				nframes--;
+				continue;
+			}
+			f->visited = 1;
+			frames[nframes].node = astnode_left(n);
+			frames[nframes++].visited = 0;
+			continue;
+		}
+		if (astnode_type(r) == astnode_type_number) {
+			if (!EVALUATOR_WALK_LEAF(v2, astnode_value(r)))
+				return 0;
+		} else if (astnode_type(r) == astnode_type_variable) {
+			assert(vars);
+			if (!EVALUATOR_WALK_LEAF(v2, vars[astnode_index(r)]))
+				return 0;
+		} else if (f->visited == 1) {
+			f->visited = 2;
+			frames[nframes].node = r;
+			frames[nframes++].visited = 0;
+			continue;
+		} else {
+			v2 = values[--nvalues];
+		}
+		v1 = values[nvalues - 1];
+		nframes--;
+
+		switch (astnode_type(n)) {
+		case astnode_type_plus:
+			if (!EVALUATOR_WALK_ADD(values[nvalues - 1], v1, v2))
+				return 0;
+			break;
+		case astnode_type_minus:
+			if (!EVALUATOR_WALK_SUB(values[nvalues - 1], v1, v2))
+				return 0;
+			break;
+		case astnode_type_mul:
+			if (!EVALUATOR_WALK_MUL(values[nvalues - 1], v1, v2))
+				return 0;
+			break;
+		case astnode_type_div:
+			if (!EVALUATOR_WALK_DIV(values[nvalues - 1], v1, v2))
+				return 0;
+			break;
+		default:
+			abort();
+		}
+		if ((id = evaluator_remember(this, n)) != 0)
+			MEMO(id) = values[nvalues - 1];
+	}
+
+	assert(nvalues == 1);
+
+	*result = values[0];
+
+	return 1;
+}
+
+#undef MEMO
+#undef EVALUATOR_WALK_NAME
+#undef EVALUATOR_WALK_T
+#undef EVALUATOR_WALK_LEAF
+#undef EVALUATOR_WALK_NEG
+#undef EVALUATOR_WALK_ADD
+#undef EVALUATOR_WALK_SUB
+#undef EVALUATOR_WALK_MUL
+#undef EVALUATOR_WALK_DIV
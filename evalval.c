@@ -0,0 +1,397 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <util.h>
+
+#include "astnode.h"
+#include "bytecode.h"
+#include "catalog.h"
+#include "evaluator.h"
+#include "incremental.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "parser.h"
+
+#include "evalval.h"
+
+#ifdef DEBUG_EVALVAL
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+struct evalval {
+	struct parser		*parser;
+	struct evaluator	*evaluator;
+};
+
+struct evalval_catalog {
+	struct catalog	*catalog;
+};
+
+struct evalval_live {
+	struct incremental_state *state;
+};
+
+struct evalval_expr {
+	struct jit	*jit;
+	struct incremental *graph;
+	size_t		 nvars;
+	char		**vars;		/* names follow the array */
+};
+
+static enum evalval_error
+evalval_parse(struct evalval *this, const char *text, size_t len,
+              struct astnode **n, size_t *offset);
+
+struct evalval *
+evalval_new(void)
+{
+	struct evalval *this;
+
+	this = ecalloc(1, sizeof(*this));
+	this->parser = parser_new();
+	this->evaluator = evaluator_new();
+
+	return this;
+}
+
+void
+evalval_delete(struct evalval *this)
+{
+
+	assert(this);
+
+	evaluator_delete(this->evaluator);
+	parser_delete(this->parser);
+	free(this);
+}
+
+enum evalval_error
+evalval_eval(struct evalval *this, const char *text, size_t len,
+             double *result, size_t *offset)
+{
+	enum evalval_error error;
+	struct astnode *n;
+
+	assert(this);
+	assert(text || len == 0);
+	assert(result);
+
+	error = evalval_parse(this, text, len, &n, offset);
+	if (error != evalval_error_none)
+		return error;
+
+	if (parser_nvariables(this->parser) > 0) {
+		if (offset != NULL)
+			*offset = parser_variableoffset(this->parser, 0);
+		parser_reset(this->parser);
+		return evalval_error_unbound;
+	}
+
+	*result = evaluator_eval(this->evaluator, n);
+	parser_reset(this->parser);
+
+	return evalval_error_none;
+}
+
+enum evalval_error
+evalval_compile(struct evalval *this, const char *text, size_t len,
+                struct evalval_expr **expr, size_t *offset)
+{
+	enum evalval_error error;
+	struct evalval_expr *e;
+	struct astnode *n;
+	const char *name;
+	size_t i, size;
+	char *p;
+
+	assert(this);
+	assert(text || len == 0);
+	assert(expr);
+
+	error = evalval_parse(this, text, len, &n, offset);
+	if (error != evalval_error_none)
+		return error;
+
+	e = ecalloc(1, sizeof(*e));
+	e->nvars = parser_nvariables(this->parser);
+
+	size = e->nvars * sizeof(*e->vars);
+	for (i = 0; i < e->nvars; i++)
+		size += strlen(parser_variable(this->parser, i)) + 1;
+	e->vars = emalloc(size);
+	p = (char *)(e->vars + e->nvars);
+	for (i = 0; i < e->nvars; i++) {
+		name = parser_variable(this->parser, i);
+		e->vars[i] = p;
+		p = stpcpy(p, name) + 1;
+	}
+
+	n = optimizer_optimize(parser_nodes(this->parser), n);
+	e->jit = jit_compile(n);
+	e->graph = incremental_compile(n, e->nvars);
+	parser_reset(this->parser);
+
+	DPRINTF(("%s(): expr=%p nvars=%zu native=%d\n", __func__, e, e->nvars,
+	    jit_native(e->jit)));
+
+	*expr = e;
+
+	return evalval_error_none;
+}
+
+void
+evalval_expr_delete(struct evalval_expr *expr)
+{
+
+	assert(expr);
+
+	jit_delete(expr->jit);
+	incremental_delete(expr->graph);
+	free(expr->vars);
+	free(expr);
+}
+
+size_t
+evalval_expr_nvariables(const struct evalval_expr *expr)
+{
+
+	assert(expr);
+
+	return expr->nvars;
+}
+
+const char *
+evalval_expr_variable(const struct evalval_expr *expr, size_t index)
+{
+
+	assert(expr);
+	assert(index < expr->nvars);
+
+	return expr->vars[index];
+}
+
+double
+evalval_expr_eval(const struct evalval_expr *expr, const double *vars)
+{
+
+	assert(expr);
+	assert(vars || expr->nvars == 0);
+
+	return jit_eval(expr->jit, vars);
+}
+
+struct evalval_live *
+evalval_live_new(const struct evalval_expr *expr, const double *vars)
+{
+	struct evalval_live *live;
+
+	assert(expr);
+	assert(vars || expr->nvars == 0);
+
+	live = ecalloc(1, sizeof(*live));
+	live->state = incremental_state_new(expr->graph, vars);
+
+	return live;
+}
+
+void
+evalval_live_delete(struct evalval_live *live)
+{
+
+	assert(live);
+
+	incremental_state_delete(live->state);
+	free(live);
+}
+
+void
+evalval_live_set(struct evalval_live *live, size_t index, double value)
+{
+
+	assert(live);
+
+	incremental_state_set(live->state, index, value);
+}
+
+double
+evalval_live_eval(struct evalval_live *live)
+{
+
+	assert(live);
+
+	return incremental_state_eval(live->state);
+}
+
+struct evalval_catalog *
+evalval_catalog_open(const char *path)
+{
+	struct evalval_catalog *cat;
+	struct catalog *c;
+
+	assert(path);
+
+	if ((c = catalog_open(path)) == NULL)
+		return NULL;
+
+	cat = ecalloc(1, sizeof(*cat));
+	cat->catalog = c;
+
+	return cat;
+}
+
+void
+evalval_catalog_close(struct evalval_catalog *cat)
+{
+
+	assert(cat);
+
+	catalog_close(cat->catalog);
+	free(cat);
+}
+
+size_t
+evalval_catalog_count(const struct evalval_catalog *cat)
+{
+
+	assert(cat);
+
+	return catalog_count(cat->catalog);
+}
+
+enum evalval_error
+evalval_catalog_error(const struct evalval_catalog *cat, size_t i,
+                      size_t *offset)
+{
+	int status;
+
+	assert(cat);
+
+	(void)catalog_get(cat->catalog, i, &status, offset);
+
+	return (enum evalval_error)status;
+}
+
+size_t
+evalval_catalog_nvariables(const struct evalval_catalog *cat, size_t i)
+{
+
+	assert(cat);
+
+	return catalog_nvariables(cat->catalog, i);
+}
+
+const char *
+evalval_catalog_variable(const struct evalval_catalog *cat, size_t i,
+                         size_t index)
+{
+
+	assert(cat);
+
+	return catalog_variable(cat->catalog, i, index);
+}
+
+double
+evalval_catalog_eval(const struct evalval_catalog *cat, size_t i,
+                     const double *vars)
+{
+	const struct bytecode *bc;
+
+	assert(cat);
+
+	/* Rejected and damaged entries have no code */
+	bc = catalog_get(cat->catalog, i, NULL, NULL);
+	if (bc == NULL)
+		return NAN;
+
+	return bytecode_eval(bc, vars);
+}
+
+const char *
+evalval_strerror(enum evalval_error error)
+{
+
+	switch (error) {
+	case evalval_error_none:
+		return "No error";
+	case evalval_error_symbol:
+		return "Unrecognized input symbol";
+	case evalval_error_operand:
+		return "Operand expected";
+	case evalval_error_paren:
+		return "Closing parenthesis expected";
+	case evalval_error_unbound:
+		return "Unbound variable";
+	case evalval_error_range:
+		return "Not representable as an integer";
+	case evalval_error_damaged:
+		return "Damaged catalog entry";
+	default:
+		return "Unknown error";
+	}
+}
+
+/* Private functions */
+
+/* Parses text, translating parser errors; the tree is left in the parser */
+enum evalval_error
+evalval_parse(struct evalval *this, const char *text, size_t len,
+              struct astnode **n, size_t *offset)
+{
+
+	assert(this);
+	assert(n);
+
+	*n = parser_parse(this->parser, text, len);
+	if (*n != NULL)
+		return evalval_error_none;
+
+	switch (parser_error(this->parser, offset)) {
+	case parser_error_symbol:
+		return evalval_error_symbol;
+	case parser_error_operand:
+		return evalval_error_operand;
+	case parser_error_paren:
+		return evalval_error_paren;
+	default:
+		abort();
+	}
+}
@@ -0,0 +1,169 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef __EVALVAL_H__
+#define __EVALVAL_H__
+
+#include <stddef.h>
+
+/*
+ * libevalval: arithmetic expressions over doubles for embedding.
+ *
+ * All state lives in the objects below; the library has no globals other
+ * than CPU feature detection done once under pthread_once(3).  A context
+ * may be used by one thread at a time, so give each thread its own; there
+ * are no locks.  A compiled expression is immutable and may be evaluated
+ * from any number of threads at once.  Nothing is written to stdout or
+ * stderr.  Out of memory is fatal, as in the rest of evalval.
+ */
+
+struct evalval;
+struct evalval_catalog;
+struct evalval_expr;
+struct evalval_live;
+
+enum evalval_error {
+	evalval_error_none,
+	evalval_error_symbol,		/* byte that starts no token */
+	evalval_error_operand,		/* no number, variable, "-" or "(" */
+	evalval_error_paren,		/* ")" expected */
+	evalval_error_unbound,		/* variable in evalval_eval() */
+	evalval_error_range,		/* no exact 64-bit integer result */
+	evalval_error_damaged		/* catalog entry fails its checks */
+};
+
+struct evalval *
+evalval_new(void);
+
+void
+evalval_delete(struct evalval *this);
+
+/*
+ * Evaluates len bytes at text, which need not be NUL-terminated.  On
+ * success *result is set.  On failure, if offset is not NULL, it receives
+ * the byte offset into the text where the error was found; len when the
+ * text ended too early.
+ */
+enum evalval_error
+evalval_eval(struct evalval *this, const char *text, size_t len,
+             double *result, size_t *offset);
+
+/*
+ * Compiles an expression with variables for repeated evaluation, to native
+ * code where supported.  Errors are reported as by evalval_eval(); the
+ * result does not depend on the context or the text afterwards.
+ */
+enum evalval_error
+evalval_compile(struct evalval *this, const char *text, size_t len,
+                struct evalval_expr **expr, size_t *offset);
+
+void
+evalval_expr_delete(struct evalval_expr *expr);
+
+/* Variables are numbered in order of first appearance in the text */
+size_t
+evalval_expr_nvariables(const struct evalval_expr *expr);
+
+const char *
+evalval_expr_variable(const struct evalval_expr *expr, size_t index);
+
+/* vars[i] is the value of variable i; may be NULL without variables */
+double
+evalval_expr_eval(const struct evalval_expr *expr, const double *vars);
+
+/*
+ * Live evaluation, for re-evaluating an expression after only some of its
+ * variables changed.  A live expression keeps the value of every node for
+ * its bindings; evalval_live_eval() recomputes only the nodes that depend
+ * on variables set since the last call, so an update costs in proportion
+ * to the depth of the expression rather than its size.  It refers to expr,
+ * which must outlive it, and is used by one thread at a time.
+ */
+struct evalval_live *
+evalval_live_new(const struct evalval_expr *expr, const double *vars);
+
+void
+evalval_live_delete(struct evalval_live *live);
+
+void
+evalval_live_set(struct evalval_live *live, size_t index, double value);
+
+double
+evalval_live_eval(struct evalval_live *live);
+
+/*
+ * Catalogs of precompiled expressions, written by evalval -o, are used in
+ * place from a read-only mapping: opening one checks its header but does
+ * not parse anything.  Entry i is line i of the input it was made from.
+ * A catalog may be shared by any number of threads.
+ * evalval_catalog_open() returns NULL with errno set, EFTYPE if the file
+ * is not a catalog of this version and byte order.  Entries are checked
+ * when first used; a damaged one reads as rejected with
+ * evalval_error_damaged.
+ */
+struct evalval_catalog *
+evalval_catalog_open(const char *path);
+
+void
+evalval_catalog_close(struct evalval_catalog *cat);
+
+size_t
+evalval_catalog_count(const struct evalval_catalog *cat);
+
+/*
+ * Why entry i was rejected when the catalog was made, with its offset, or
+ * evalval_error_damaged
+ */
+enum evalval_error
+evalval_catalog_error(const struct evalval_catalog *cat, size_t i,
+                      size_t *offset);
+
+size_t
+evalval_catalog_nvariables(const struct evalval_catalog *cat, size_t i);
+
+const char *
+evalval_catalog_variable(const struct evalval_catalog *cat, size_t i,
+                         size_t index);
+
+/*
+ * vars as for evalval_expr_eval(); NaN if entry i was rejected or is
+ * damaged
+ */
+double
+evalval_catalog_eval(const struct evalval_catalog *cat, size_t i,
+                     const double *vars);
+
+/* A static description of the error */
+const char *
+evalval_strerror(enum evalval_error error);
+
+#endif /* __EVALVAL_H__ */
@@ -0,0 +1,858 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef __EVALVAL_CONSTEXPR_HPP__
+#define __EVALVAL_CONSTEXPR_HPP__
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <type_traits>
+
+/*
+ * Compile-time front end for C++20: the grammar of parser.c, parsed from a
+ * string literal while compiling.
+ *
+ *	constexpr double k = evalval::value<"2 * (3 + 4)">;
+ *	double y = evalval::expression<"x * x - 2 * x + 1">::eval(x);
+ *
+ * value<> is a constant.  expression<>::eval() takes the variables as
+ * arguments, in order of first appearance as with parser_variable(), and
+ * inlines into straight-line code; subexpressions without variables are
+ * folded while compiling.  Malformed text fails the compilation with a
+ * call to one of the error_*() functions below.
+ *
+ * Results are those of evaluator_evalvars() bit for bit: numbers are
+ * rounded as number_scan() rounds them, the tree has the same shape and
+ * every operation is the same IEEE double operation.  This assumes double
+ * arithmetic without excess precision (FLT_EVAL_METHOD 0) and without
+ * fused multiply-add; build with -ffp-contract=off where FMA is enabled.
+ * A literal beyond the range of doubles, or a subexpression that
+ * overflows, divides by zero or yields NaN, is not a constant expression
+ * to the compiler, so it is left to run time, where it gives the infinity
+ * or NaN that the evaluator gives; value<> rejects such text.  Every node
+ * instantiates a template, so very deep expressions may need a larger
+ * -ftemplate-depth.
+ */
+
+namespace evalval {
+
+/* A string literal as a template argument */
+template <std::size_t N>
+struct literal {
+	char	s[N];
+
+	constexpr
+	literal(const char (&str)[N])
+	{
+
+		for (std::size_t i = 0; i < N; i++)
+			s[i] = str[i];
+	}
+};
+
+namespace detail {
+
+/*
+ * Never defined: reaching one while parsing stops the compilation, and
+ * the diagnostic names the error, as enum parser_error would.
+ */
+void error_symbol();		/* byte that starts no token */
+void error_operand();		/* number, variable, "-" or "(" expected */
+void error_paren();		/* ")" expected */
+
+enum class kind : unsigned char {
+	number,
+	variable,
+	neg,
+	plus,
+	minus,
+	mul,
+	div
+};
+
+/*
+ * Nodes are stored in the order the parser creates them, children before
+ * their parent, so a subtree occupies the indices first to its own.
+ */
+struct node {
+	kind		type = kind::number;
+	std::size_t	left = 0;
+	std::size_t	right = 0;
+	std::size_t	first = 0;
+	bool		constant = true;	/* no variables below */
+	double		value = 0;
+	std::size_t	index = 0;		/* of a variable */
+};
+
+/* At most one node and one variable per byte of text */
+template <std::size_t C>
+struct tree {
+	node		nodes[C] = {};
+	std::size_t	nnodes = 0;
+	std::size_t	root = 0;
+	std::size_t	varoffsets[C] = {};
+	std::size_t	varlens[C] = {};
+	std::size_t	nvars = 0;
+};
+
+/*
+ * Unsigned integers of up to 5120 bits, enough to convert literals of
+ * NUMBER_DIGITS significant digits exactly.
+ */
+struct bignum {
+	static constexpr std::size_t	limbs = 160;
+
+	std::uint32_t	d[limbs] = {};
+	std::size_t	n = 0;
+
+	constexpr void
+	muladd(std::uint32_t m, std::uint32_t a)
+	{
+		std::uint64_t c = a;
+
+		for (std::size_t i = 0; i < n; i++) {
+			c += (std::uint64_t)d[i] * m;
+			d[i] = (std::uint32_t)c;
+			c >>= 32;
+		}
+		if (c != 0)
+			d[n++] = (std::uint32_t)c;
+	}
+
+	constexpr void
+	shl(std::size_t bits)
+	{
+		std::size_t w = bits / 32, b = bits % 32;
+
+		if (n == 0)
+			return;
+		d[n + w] = 0;
+		for (std::size_t i = n; i-- > 0;) {
+			if (b != 0)
+				d[i + w + 1] |= d[i] >> (32 - b);
+			d[i + w] = d[i] << b;
+		}
+		for (std::size_t i = 0; i < w; i++)
+			d[i] = 0;
+		n += w + 1;
+		while (n > 0 && d[n - 1] == 0)
+			n--;
+	}
+
+	constexpr void
+	sub(const bignum &o)
+	{
+		std::int64_t c = 0;
+
+		for (std::size_t i = 0; i < n; i++) {
+			c += (std::int64_t)d[i] - (i < o.n ? o.d[i] : 0);
+			d[i] = (std::uint32_t)c;
+			c = c < 0 ? -1 : 0;
+		}
+		while (n > 0 && d[n - 1] == 0)
+			n--;
+	}
+
+	constexpr int
+	cmp(const bignum &o) const
+	{
+
+		if (n != o.n)
+			return n < o.n ? -1 : 1;
+		for (std::size_t i = n; i-- > 0;)
+			if (d[i] != o.d[i])
+				return d[i] < o.d[i] ? -1 : 1;
+		return 0;
+	}
+
+	constexpr std::size_t
+	bits() const
+	{
+
+		return n == 0 ? 0 :
+		    32 * (n - 1) + (std::size_t)std::bit_width(d[n - 1]);
+	}
+
+	constexpr bool
+	bit(std::size_t i) const
+	{
+
+		return i / 32 < n && (d[i / 32] >> (i % 32) & 1) != 0;
+	}
+
+	/* Whether any of the bits below i is set */
+	constexpr bool
+	below(std::size_t i) const
+	{
+
+		for (std::size_t j = 0; j < i; j++)
+			if (bit(j))
+				return true;
+		return false;
+	}
+
+	/* Bits lo to lo + count - 1 as an integer, count <= 64 */
+	constexpr std::uint64_t
+	extract(std::size_t lo, std::size_t count) const
+	{
+		std::uint64_t v = 0;
+
+		for (std::size_t j = count; j-- > 0;)
+			v = v << 1 | (bit(lo + j) ? 1 : 0);
+		return v;
+	}
+};
+
+/*
+ * Digits kept exactly; any further nonzero digit only tells that the value
+ * lies above them, as no halfway point between doubles needs more than 767
+ * significant digits.
+ */
+inline constexpr std::size_t	NUMBER_DIGITS = 780;
+
+/* The double nearest to q * 2^e, q being truncated if sticky */
+constexpr double
+number_round(const bignum &q, long e, bool sticky)
+{
+	std::uint64_t m, bits;
+	long msb, t, drop;
+	std::size_t l;
+	bool half, rest;
+
+	if ((l = q.bits()) == 0)
+		return 0;
+	msb = (long)l - 1 + e;
+	if (msb > 1023)
+		return std::numeric_limits<double>::infinity();
+
+	/* The weight of the last bit kept, smaller below 2^-1022 */
+	t = msb - 52 > -1074 ? msb - 52 : -1074;
+	drop = t - e;
+	if (drop <= 0) {
+		m = q.extract(0, l) << -drop;
+	} else {
+		m = (long)l > drop ? q.extract((std::size_t)drop,
+		    l - (std::size_t)drop) : 0;
+		half = q.bit((std::size_t)drop - 1);
+		rest = sticky || q.below((std::size_t)drop - 1);
+		if (half && (rest || (m & 1) != 0))
+			m++;
+	}
+	if (m == UINT64_C(1) << 53) {
+		m >>= 1;
+		t++;
+	}
+	if (t + 52 > 1023)
+		return std::numeric_limits<double>::infinity();
+
+	if (m >= UINT64_C(1) << 52)
+		bits = (std::uint64_t)(t + 52 + 1023) << 52 |
+		    (m & ((UINT64_C(1) << 52) - 1));
+	else
+		bits = m;
+
+	return std::bit_cast<double>(bits);
+}
+
+/* The double nearest to digits * 10^exp10, correctly rounded */
+constexpr double
+number_decimal(const bignum &digits, long exp10)
+{
+	bignum num = digits, den, t;
+	std::uint64_t q;
+	long s;
+
+	if (exp10 >= 0) {
+		for (long i = 0; i < exp10; i++)
+			num.muladd(10, 0);
+		return number_round(num, 0, false);
+	}
+
+	den.muladd(1, 1);
+	for (long i = 0; i < -exp10; i++)
+		den.muladd(10, 0);
+
+	/* Scale the quotient to between 2^54 and 2^56 */
+	s = 55 + (long)den.bits() - (long)num.bits();
+	if (s >= 0)
+		num.shl((std::size_t)s);
+	else
+		den.shl((std::size_t)-s);
+
+	q = 0;
+	for (std::size_t i = 57; i-- > 0;) {
+		t = den;
+		t.shl(i);
+		if (num.cmp(t) >= 0) {
+			num.sub(t);
+			q |= UINT64_C(1) << i;
+		}
+	}
+
+	t = bignum();
+	t.d[0] = (std::uint32_t)q;
+	t.d[1] = (std::uint32_t)(q >> 32);
+	t.n = t.d[1] != 0 ? 2 : 1;
+
+	return number_round(t, -s, num.n != 0);
+}
+
+constexpr bool
+digit(char c)
+{
+
+	return c >= '0' && c <= '9';
+}
+
+constexpr bool
+namestart(char c)
+{
+
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+/*
+ * number_scan() at compile time: the same literals, the same count of
+ * bytes consumed, and the correctly rounded value.
+ */
+constexpr std::size_t
+number_scan(const char *s, std::size_t len, double *val)
+{
+	bignum digits;
+	std::size_t i, j, ndigits;
+	long exp10, e;
+	bool truncated, expneg;
+
+	ndigits = 0;
+	exp10 = 0;
+	truncated = false;
+	i = 0;
+
+	while (i < len && s[i] == '0')
+		i++;
+	while (i < len && digit(s[i])) {
+		if (ndigits < NUMBER_DIGITS) {
+			digits.muladd(10, (std::uint32_t)(s[i] - '0'));
+			ndigits++;
+		} else {
+			truncated |= s[i] != '0';
+			exp10++;
+		}
+		i++;
+	}
+
+	if (i < len && s[i] == '.') {
+		i++;
+		if (ndigits == 0) {
+			while (i < len && s[i] == '0') {
+				exp10--;
+				i++;
+			}
+		}
+		while (i < len && digit(s[i])) {
+			if (ndigits < NUMBER_DIGITS) {
+				digits.muladd(10,
+				    (std::uint32_t)(s[i] - '0'));
+				ndigits++;
+				exp10--;
+			} else {
+				truncated |= s[i] != '0';
+			}
+			i++;
+		}
+	}
+
+	if (i == 0 || (i == 1 && s[0] == '.'))
+		return 0;
+
+	if (i + 1 < len && (s[i] == 'e' || s[i] == 'E')) {
+		j = i + 1;
+		expneg = false;
+		if (s[j] == '+' || s[j] == '-') {
+			expneg = s[j] == '-';
+			j++;
+		}
+		if (j < len && digit(s[j])) {
+			e = 0;
+			while (j < len && digit(s[j])) {
+				if (e < 100000)
+					e = e * 10 + (s[j] - '0');
+				j++;
+			}
+			exp10 += expneg ? -e : e;
+			i = j;
+		}
+	}
+
+	if (digits.n == 0) {
+		*val = 0;
+		return i;
+	}
+
+	if (truncated) {
+		digits.muladd(10, 1);
+		ndigits++;
+		exp10--;
+	}
+
+	/* Beyond the range of doubles either way */
+	if ((long)ndigits + exp10 > 310)
+		*val = std::numeric_limits<double>::infinity();
+	else if ((long)ndigits + exp10 < -324)
+		*val = 0;
+	else
+		*val = number_decimal(digits, exp10);
+
+	return i;
+}
+
+/*
+ * The value of a literal.  number_scan() reads one beyond the range of
+ * doubles as infinity, which the compiler would take as a constant, so it
+ * is made by an overflow instead: the same infinity at run time, and not a
+ * constant expression while compiling.
+ */
+constexpr double
+number_value(double v)
+{
+
+	if (v == std::numeric_limits<double>::infinity())
+		return std::numeric_limits<double>::max() * 2;
+	return v;
+}
+
+enum class token : unsigned char {
+	eot,
+	error,
+	number,
+	variable,
+	plus,
+	minus,
+	mul,
+	div,
+	openparen,
+	closeparen
+};
+
+/* Pending operators, as in parser_expression() */
+enum class op : unsigned char {
+	paren,
+	plus,
+	minus,
+	mul,
+	div,
+	neg
+};
+
+constexpr int
+precedence(op o)
+{
+
+	switch (o) {
+	case op::paren:
+		return 0;
+	case op::plus:
+	case op::minus:
+		return 1;
+	case op::mul:
+	case op::div:
+		return 2;
+	default:
+		return 3;
+	}
+}
+
+/* The parser of parser.c over the lexer of lexer.c, one token at a time */
+template <std::size_t C>
+struct parser {
+	const char	*s;
+	std::size_t	 len;
+	std::size_t	 pos = 0;
+	token		 type = token::eot;
+	std::size_t	 offset = 0;
+	double		 value = 0;
+	tree<C>		 t;
+	std::size_t	 operands[C] = {};
+	std::size_t	 noperands = 0;
+	op		 ops[C] = {};
+	std::size_t	 nops = 0;
+
+	constexpr
+	parser(const char *text, std::size_t n) : s(text), len(n)
+	{
+	}
+
+	constexpr void
+	getnexttoken()
+	{
+		std::size_t n;
+		char c;
+
+		while (pos < len && (s[pos] == ' ' || s[pos] == '\t' ||
+		    s[pos] == '\n' || s[pos] == '\v' || s[pos] == '\f' ||
+		    s[pos] == '\r'))
+			pos++;
+		offset = pos;
+		if (pos >= len || s[pos] == '\0') {
+			type = token::eot;
+			return;
+		}
+
+		c = s[pos];
+		switch (c) {
+		case '+':
+			type = token::plus;
+			break;
+		case '-':
+			type = token::minus;
+			break;
+		case '*':
+			type = token::mul;
+			break;
+		case '/':
+			type = token::div;
+			break;
+		case '(':
+			type = token::openparen;
+			break;
+		case ')':
+			type = token::closeparen;
+			break;
+		default:
+			if (digit(c) || c == '.') {
+				if ((n = number_scan(s + pos, len - pos,
+				    &value)) == 0)
+					error_symbol();
+				type = token::number;
+				pos += n;
+			} else if (namestart(c)) {
+				while (pos < len && (namestart(s[pos]) ||
+				    digit(s[pos])))
+					pos++;
+				type = token::variable;
+			} else {
+				error_symbol();
+			}
+			return;
+		}
+		pos++;
+	}
+
+	constexpr std::size_t
+	newnode(kind k, std::size_t l, std::size_t r)
+	{
+		node &n = t.nodes[t.nnodes];
+
+		n.type = k;
+		n.left = l;
+		n.right = r;
+		n.first = t.nodes[l].first;
+		n.constant = t.nodes[l].constant;
+		if (k != kind::neg)
+			n.constant = n.constant && t.nodes[r].constant;
+		return t.nnodes++;
+	}
+
+	constexpr std::size_t
+	newleaf(kind k, double v, std::size_t index)
+	{
+		node &n = t.nodes[t.nnodes];
+
+		n.type = k;
+		n.first = t.nnodes;
+		n.constant = k == kind::number;
+		n.value = v;
+		n.index = index;
+		return t.nnodes++;
+	}
+
+	constexpr std::size_t
+	lookupvariable()
+	{
+		std::size_t i, j, l;
+
+		l = pos - offset;
+		for (i = 0; i < t.nvars; i++) {
+			if (t.varlens[i] != l)
+				continue;
+			for (j = 0; j < l; j++)
+				if (s[t.varoffsets[i] + j] != s[offset + j])
+					break;
+			if (j == l)
+				return i;
+		}
+		t.varoffsets[t.nvars] = offset;
+		t.varlens[t.nvars] = l;
+		return t.nvars++;
+	}
+
+	constexpr void
+	reduce(int prec)
+	{
+		std::size_t l, r;
+		kind k = kind::plus;
+
+		while (nops > 0 && precedence(ops[nops - 1]) >= prec) {
+			switch (ops[--nops]) {
+			case op::neg:
+				l = operands[noperands - 1];
+				operands[noperands - 1] =
+				    newnode(kind::neg, l, l);
+				continue;
+			case op::plus:
+				k = kind::plus;
+				break;
+			case op::minus:
+				k = kind::minus;
+				break;
+			case op::mul:
+				k = kind::mul;
+				break;
+			case op::div:
+				k = kind::div;
+				break;
+			default:
+				break;
+			}
+			r = operands[--noperands];
+			l = operands[noperands - 1];
+			operands[noperands - 1] = newnode(k, l, r);
+		}
+	}
+
+	constexpr void
+	expression()
+	{
+		op o = op::plus;
+
+		getnexttoken();
+		for (;;) {
+			for (;;) {
+				if (type == token::minus)
+					ops[nops++] = op::neg;
+				else if (type == token::openparen)
+					ops[nops++] = op::paren;
+				else
+					break;
+				getnexttoken();
+			}
+
+			if (type == token::number)
+				operands[noperands++] =
+				    newleaf(kind::number, value, 0);
+			else if (type == token::variable)
+				operands[noperands++] =
+				    newleaf(kind::variable, 0,
+				    lookupvariable());
+			else
+				error_operand();
+			getnexttoken();
+
+			while (type == token::closeparen) {
+				reduce(1);
+				if (nops == 0)
+					break;
+				nops--;
+				getnexttoken();
+			}
+
+			switch (type) {
+			case token::plus:
+				o = op::plus;
+				break;
+			case token::minus:
+				o = op::minus;
+				break;
+			case token::mul:
+				o = op::mul;
+				break;
+			case token::div:
+				o = op::div;
+				break;
+			default:
+				reduce(1);
+				if (nops > 0)
+					error_paren();
+				t.root = operands[0];
+				return;
+			}
+
+			reduce(precedence(o));
+			ops[nops++] = o;
+			getnexttoken();
+		}
+	}
+};
+
+template <literal E>
+constexpr auto
+parse()
+{
+	constexpr std::size_t C = sizeof(E.s);
+	parser<C> p(E.s, C - 1);
+
+	p.expression();
+
+	return p.t;
+}
+
+template <literal E>
+inline constexpr auto program = parse<E>();
+
+/* Evaluates the subtree at i, which has no variables, in creation order */
+template <std::size_t C>
+constexpr double
+fold(const tree<C> &t, std::size_t i)
+{
+	double v[C] = {};
+
+	for (std::size_t j = t.nodes[i].first; j <= i; j++) {
+		const node &n = t.nodes[j];
+
+		switch (n.type) {
+		case kind::number:
+			v[j] = number_value(n.value);
+			break;
+		case kind::neg:
+			v[j] = -v[n.left];
+			break;
+		case kind::plus:
+			v[j] = v[n.left] + v[n.right];
+			break;
+		case kind::minus:
+			v[j] = v[n.left] - v[n.right];
+			break;
+		case kind::mul:
+			v[j] = v[n.left] * v[n.right];
+			break;
+		case kind::div:
+			v[j] = v[n.left] / v[n.right];
+			break;
+		default:
+			break;
+		}
+	}
+
+	return v[i];
+}
+
+template <double>
+struct probe {
+};
+
+/* Whether the compiler accepts the value of the subtree as a constant */
+template <literal E, std::size_t I>
+constexpr bool
+foldable()
+{
+
+	if constexpr (!program<E>.nodes[I].constant)
+		return false;
+	else
+		return requires { typename probe<fold(program<E>, I)>; };
+}
+
+template <literal E, std::size_t I>
+constexpr double
+eval(const double *vars)
+{
+	constexpr node n = program<E>.nodes[I];
+
+	if constexpr (n.type == kind::number) {
+		return number_value(n.value);
+	} else if constexpr (n.type == kind::variable) {
+		return vars[n.index];
+	} else if constexpr (foldable<E, I>()) {
+		constexpr double v = fold(program<E>, I);
+
+		return v;
+	} else if constexpr (n.type == kind::neg) {
+		return -eval<E, n.left>(vars);
+	} else if constexpr (n.type == kind::plus) {
+		return eval<E, n.left>(vars) + eval<E, n.right>(vars);
+	} else if constexpr (n.type == kind::minus) {
+		return eval<E, n.left>(vars) - eval<E, n.right>(vars);
+	} else if constexpr (n.type == kind::mul) {
+		return eval<E, n.left>(vars) * eval<E, n.right>(vars);
+	} else {
+		return eval<E, n.left>(vars) / eval<E, n.right>(vars);
+	}
+}
+
+} /* namespace detail */
+
+template <literal E>
+struct expression {
+	static constexpr std::size_t	nvariables = detail::program<E>.nvars;
+
+	/* The name of variable i, cf. parser_variable() */
+	static constexpr std::string_view
+	variable(std::size_t i)
+	{
+
+		return std::string_view(E.s + detail::program<E>.varoffsets[i],
+		    detail::program<E>.varlens[i]);
+	}
+
+	/* vars[i] is the value of variable i */
+	static constexpr double
+	eval(const double *vars)
+	{
+
+		return detail::eval<E, detail::program<E>.root>(vars);
+	}
+
+	/* The values of the variables in order */
+	template <class... T>
+	    requires (sizeof...(T) == nvariables &&
+	        (std::is_arithmetic_v<T> && ...))
+	static constexpr double
+	eval(T... v)
+	{
+		const double vars[sizeof...(T) + 1] = {
+		    static_cast<double>(v)..., 0
+		};
+
+		return eval(vars);
+	}
+};
+
+template <literal E>
+    requires (expression<E>::nvariables == 0)
+inline constexpr double value = expression<E>::eval();
+
+} /* namespace evalval */
+
+#endif /* __EVALVAL_CONSTEXPR_HPP__ */
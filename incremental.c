@@ -0,0 +1,499 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <util.h>
+
+#include "astnode.h"
+
+#include "incremental.h"
+
+#ifdef DEBUG_INCREMENTAL
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+/*
+ * Nodes are numbered in post-order, so operands come before the nodes
+ * computed from them.  The parents of node i are parents[parentoffsets[i]]
+ * up to parents[parentoffsets[i + 1]], and the nodes of variable v are
+ * leaves[leafoffsets[v]] up to leaves[leafoffsets[v + 1]].
+ */
+struct incremental_node {
+	enum astnode_type	 type;
+	uint32_t		 left;		/* or the variable */
+	uint32_t		 right;
+	double			 value;		/* astnode_type_number */
+};
+
+struct incremental {
+	struct incremental_node	*nodes;
+	size_t			 nnodes;
+	uint32_t		*parentoffsets;
+	uint32_t		*parents;
+	size_t			 nvars;
+	uint32_t		*leafoffsets;
+	uint32_t		*leaves;
+};
+
+struct incremental_state {
+	const struct incremental *graph;
+	double			*values;
+	char			*dirty;
+	size_t			 ndirty;
+	int			 sweep;		/* recompute everything */
+	uint32_t		*stack;
+};
+
+/* Above 1 / INCREMENTAL_SWEEP of the nodes dirty, recompute them all */
+#define INCREMENTAL_SWEEP	8
+
+/* Nodes on the explicit stack of incremental_compile() */
+struct incremental_frame {
+	struct astnode	*node;
+	int		 visited;	/* operands already numbered */
+};
+
+static uint32_t
+incremental_add(struct incremental *this, size_t *size, struct astnode *n,
+                uint32_t left, uint32_t right);
+
+static void
+incremental_link(struct incremental *this);
+
+static void
+incremental_state_compute(struct incremental_state *this, uint32_t i);
+
+/*
+ * Post-order walk with an explicit stack.  Shared nodes of a DAG are
+ * numbered once, see astnode_id(); a tree gets one graph node per node.
+ */
+struct incremental *
+incremental_compile(struct astnode *n, size_t nvars)
+{
+	struct incremental_frame *frames;
+	struct incremental_frame *f;
+	struct incremental *this;
+	uint32_t *results, *ids;
+	size_t id, idssize, newsize, nframes, nresults, size, stacksize;
+	uint32_t l, r;
+
+	assert(n);
+
+	this = ecalloc(1, sizeof(*this));
+	this->nvars = nvars;
+	size = 64;
+	this->nodes = emalloc(size * sizeof(*this->nodes));
+
+	/* ids[id] is the number of a shared node plus one, 0 if not seen */
+	ids = NULL;
+	idssize = 0;
+
+	stacksize = 64;
+	frames = emalloc(stacksize * sizeof(*frames));
+	results = emalloc(stacksize * sizeof(*results));
+	nframes = 0;
+	nresults = 0;
+	frames[nframes].node = n;
+	frames[nframes++].visited = 0;
+
+	while (nframes > 0) {
+		if (nframes == stacksize || nresults == stacksize) {
+			stacksize *= 2;
+			frames = erealloc(frames, stacksize * sizeof(*frames));
+			results = erealloc(results,
+			    stacksize * sizeof(*results));
+		}
+		f = &frames[nframes - 1];
+		n = f->node;
+
+		id = astnode_id(n);
+		if (f->visited == 0 && id != 0 && id < idssize &&
+		    ids[id] != 0) {
+			results[nresults++] = ids[id] - 1;
+			nframes--;
+			continue;
+		}
+
+		switch (astnode_type(n)) {
+		case astnode_type_number:
+			results[nresults++] = incremental_add(this, &size, n,
+			    0, 0);
+			nframes--;
+			continue;
+		case astnode_type_variable:
+			assert(astnode_index(n) < nvars);
+			results[nresults++] = incremental_add(this, &size, n,
+			    (uint32_t)astnode_index(n), 0);
+			nframes--;
+			continue;
+		case astnode_type_unaryminus:
+			if (f->visited++ == 0) {
+				frames[nframes].node = astnode_left(n);
+				frames[nframes++].visited = 0;
+				continue;
+			}
+			l = results[--nresults];
+			r = 0;
+			break;
+		default:
+			if (f->visited < 2) {
+				frames[nframes].node = f->visited++ == 0 ?
+				    astnode_left(n) : astnode_right(n);
+				frames[nframes++].visited = 0;
+				continue;
+			}
+			r = results[--nresults];
+			l = results[--nresults];
+			break;
+		}
+
+		results[nresults] = incremental_add(this, &size, n, l, r);
+		if (id != 0) {
+			if (id >= idssize) {
+				newsize = idssize > 0 ? idssize * 2 : 64;
+				while (newsize <= id)
+					newsize *= 2;
+				ids = erealloc(ids, newsize * sizeof(*ids));
+				memset(&ids[idssize], 0,
+				    (newsize - idssize) * sizeof(*ids));
+				idssize = newsize;
+			}
+			ids[id] = results[nresults] + 1;
+		}
+		nresults++;
+		nframes--;
+	}
+
+	assert(nresults == 1);
+	assert(results[0] == this->nnodes - 1);
+
+	free(frames);
+	free(results);
+	free(ids);
+
+	incremental_link(this);
+
+	DPRINTF(("%s(): graph=%p nnodes=%zu nvars=%zu\n", __func__, this,
+	    this->nnodes, this->nvars));
+
+	return this;
+}
+
+void
+incremental_delete(struct incremental *this)
+{
+
+	assert(this);
+
+	free(this->nodes);
+	free(this->parentoffsets);
+	free(this->parents);
+	free(this->leafoffsets);
+	free(this->leaves);
+	free(this);
+}
+
+struct incremental_state *
+incremental_state_new(const struct incremental *graph, const double *vars)
+{
+	struct incremental_state *this;
+	uint32_t i;
+
+	assert(graph);
+	assert(vars || graph->nvars == 0);
+
+	this = emalloc(sizeof(*this));
+	this->graph = graph;
+	this->values = emalloc(graph->nnodes * sizeof(*this->values));
+	this->dirty = ecalloc(graph->nnodes, sizeof(*this->dirty));
+	this->ndirty = 0;
+	this->sweep = 0;
+	/* Room for incremental_state_eval(), see there */
+	this->stack = emalloc((2 * graph->nnodes + 1) *
+	    sizeof(*this->stack));
+
+	for (i = 0; i < graph->nnodes; i++) {
+		if (graph->nodes[i].type == astnode_type_variable)
+			this->values[i] = vars[graph->nodes[i].left];
+		else
+			incremental_state_compute(this, i);
+	}
+
+	return this;
+}
+
+void
+incremental_state_delete(struct incremental_state *this)
+{
+
+	assert(this);
+
+	free(this->values);
+	free(this->dirty);
+	free(this->stack);
+	free(this);
+}
+
+/*
+ * Stores the value in the variable's nodes and marks every node above
+ * them dirty.  A node already dirty was marked with all its ancestors,
+ * so the walk stops there and each node is pushed at most once.  Past
+ * the point where incremental_state_eval() would rather recompute every
+ * node, marking stops.
+ */
+void
+incremental_state_set(struct incremental_state *this, size_t index,
+                      double value)
+{
+	const struct incremental *g;
+	uint32_t i, j, k;
+	size_t n;
+
+	assert(this);
+	assert(index < this->graph->nvars);
+
+	g = this->graph;
+	n = 0;
+	for (j = g->leafoffsets[index]; j < g->leafoffsets[index + 1]; j++) {
+		i = g->leaves[j];
+		/* Bit patterns, so that -0 and NaN payloads are not lost */
+		if (memcmp(&this->values[i], &value, sizeof(value)) == 0)
+			continue;
+		this->values[i] = value;
+		this->stack[n++] = i;
+	}
+
+	while (n > 0 && !this->sweep) {
+		i = this->stack[--n];
+		for (k = g->parentoffsets[i]; k < g->parentoffsets[i + 1];
+		    k++) {
+			j = g->parents[k];
+			if (this->dirty[j])
+				continue;
+			this->dirty[j] = 1;
+			this->stack[n++] = j;
+			if (++this->ndirty > g->nnodes / INCREMENTAL_SWEEP)
+				this->sweep = 1;
+		}
+	}
+}
+
+/*
+ * Post-order walk of the dirty nodes only, from the root down: a node is
+ * recomputed once none of its operands are dirty.  Each node is expanded
+ * at most once and pushes at most two operands, which bounds the stack.
+ * When much of the graph is dirty, as when a variable sits at the bottom
+ * of a long chain, one pass over all nodes in order is cheaper.
+ */
+double
+incremental_state_eval(struct incremental_state *this)
+{
+	const struct incremental_node *node;
+	uint32_t i, root;
+	size_t n, top;
+
+	assert(this);
+
+	root = (uint32_t)this->graph->nnodes - 1;
+	if (this->sweep) {
+		for (i = 0; i <= root; i++)
+			if (this->graph->nodes[i].type != astnode_type_variable)
+				incremental_state_compute(this, i);
+		memset(this->dirty, 0, this->graph->nnodes);
+		this->ndirty = 0;
+		this->sweep = 0;
+		return this->values[root];
+	}
+	if (!this->dirty[root])
+		return this->values[root];
+
+	n = 0;
+	this->stack[n++] = root;
+	while (n > 0) {
+		i = this->stack[n - 1];
+		if (!this->dirty[i]) {
+			n--;
+			continue;
+		}
+		node = &this->graph->nodes[i];
+		top = n;
+		if (this->dirty[node->left])
+			this->stack[n++] = node->left;
+		if (node->type != astnode_type_unaryminus &&
+		    this->dirty[node->right])
+			this->stack[n++] = node->right;
+		if (n > top)
+			continue;
+		incremental_state_compute(this, i);
+		this->dirty[i] = 0;
+		n--;
+	}
+	this->ndirty = 0;
+
+	return this->values[root];
+}
+
+/* Private functions */
+
+uint32_t
+incremental_add(struct incremental *this, size_t *size, struct astnode *n,
+                uint32_t left, uint32_t right)
+{
+	struct incremental_node *node;
+
+	if (this->nnodes == *size) {
+		*size *= 2;
+		this->nodes = erealloc(this->nodes,
+		    *size * sizeof(*this->nodes));
+	}
+	assert(this->nnodes < UINT32_MAX);
+
+	node = &this->nodes[this->nnodes];
+	node->type = astnode_type(n);
+	node->left = left;
+	node->right = right;
+	node->value = node->type == astnode_type_number ?
+	    astnode_value(n) : 0;
+
+	return (uint32_t)this->nnodes++;
+}
+
+/* Fills in the parents of each node and the nodes of each variable */
+void
+incremental_link(struct incremental *this)
+{
+	const struct incremental_node *node;
+	uint32_t *next;
+	size_t i;
+
+	this->parentoffsets = ecalloc(this->nnodes + 1,
+	    sizeof(*this->parentoffsets));
+	this->leafoffsets = ecalloc(this->nvars + 1,
+	    sizeof(*this->leafoffsets));
+
+	/* Count into offsets[i + 1], then sum up */
+	for (i = 0; i < this->nnodes; i++) {
+		node = &this->nodes[i];
+		switch (node->type) {
+		case astnode_type_number:
+			break;
+		case astnode_type_variable:
+			this->leafoffsets[node->left + 1]++;
+			break;
+		case astnode_type_unaryminus:
+			this->parentoffsets[node->left + 1]++;
+			break;
+		default:
+			this->parentoffsets[node->left + 1]++;
+			this->parentoffsets[node->right + 1]++;
+			break;
+		}
+	}
+	for (i = 0; i < this->nnodes; i++)
+		this->parentoffsets[i + 1] += this->parentoffsets[i];
+	for (i = 0; i < this->nvars; i++)
+		this->leafoffsets[i + 1] += this->leafoffsets[i];
+
+	/* Plus one as a lone number has neither */
+	this->parents = emalloc((this->parentoffsets[this->nnodes] + 1) *
+	    sizeof(*this->parents));
+	this->leaves = emalloc((this->leafoffsets[this->nvars] + 1) *
+	    sizeof(*this->leaves));
+
+	next = emalloc((this->nnodes + this->nvars) * sizeof(*next));
+	memcpy(next, this->parentoffsets, this->nnodes * sizeof(*next));
+	memcpy(&next[this->nnodes], this->leafoffsets,
+	    this->nvars * sizeof(*next));
+	for (i = 0; i < this->nnodes; i++) {
+		node = &this->nodes[i];
+		switch (node->type) {
+		case astnode_type_number:
+			break;
+		case astnode_type_variable:
+			this->leaves[next[this->nnodes + node->left]++] =
+			    (uint32_t)i;
+			break;
+		case astnode_type_unaryminus:
+			this->parents[next[node->left]++] = (uint32_t)i;
+			break;
+		default:
+			this->parents[next[node->left]++] = (uint32_t)i;
+			this->parents[next[node->right]++] = (uint32_t)i;
+			break;
+		}
+	}
+	free(next);
+}
+
+/* The operations the evaluator performs, on the operands' values */
+void
+incremental_state_compute(struct incremental_state *this, uint32_t i)
+{
+	const struct incremental_node *node;
+	double *v;
+
+	node = &this->graph->nodes[i];
+	v = this->values;
+
+	switch (node->type) {
+	case astnode_type_number:
+		v[i] = node->value;
+		break;
+	case astnode_type_unaryminus:
+		v[i] = -v[node->left];
+		break;
+	case astnode_type_plus:
+		v[i] = v[node->left] + v[node->right];
+		break;
+	case astnode_type_minus:
+		v[i] = v[node->left] - v[node->right];
+		break;
+	case astnode_type_mul:
+		v[i] = v[node->left] * v[node->right];
+		break;
+	case astnode_type_div:
+		v[i] = v[node->left] / v[node->right];
+		break;
+	default:
+		abort();
+	}
+}
@@ -0,0 +1,77 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef __EVALVAL_INCREMENTAL_H__
+#define __EVALVAL_INCREMENTAL_H__
+
+#include <stddef.h>
+
+/*
+ * Incremental evaluation for expressions whose variables change a few at
+ * a time.  incremental_compile() turns a tree or DAG into a dependency
+ * graph: every node is a value computed from its operands, and knows the
+ * nodes computed from it.  A state holds the value of every node for one
+ * set of bindings.  Changing a variable marks only the nodes above it, and
+ * only those are recomputed, so an update costs in proportion to the depth
+ * of the expression rather than its size.
+ *
+ * The graph does not refer to the tree, is immutable and may be shared
+ * between threads; a state is used by one thread at a time.
+ */
+
+struct astnode;
+struct incremental;
+struct incremental_state;
+
+struct incremental *
+incremental_compile(struct astnode *n, size_t nvars);
+
+void
+incremental_delete(struct incremental *this);
+
+/* Evaluates the whole graph once; vars may be NULL without variables */
+struct incremental_state *
+incremental_state_new(const struct incremental *graph, const double *vars);
+
+void
+incremental_state_delete(struct incremental_state *this);
+
+void
+incremental_state_set(struct incremental_state *this, size_t index,
+                      double value);
+
+/* The value for the current bindings, recomputing what they changed */
+double
+incremental_state_eval(struct incremental_state *this);
+
+#endif /* __EVALVAL_INCREMENTAL_H__ */
@@ -0,0 +1,418 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <util.h>
+
+#include "input.h"
+
+#ifdef DEBUG_INPUT
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+#define INPUT_BLOCKSIZE	(256 * 1024)
+
+/* Length prefix of a record */
+#define INPUT_RECORDHEADER	4
+
+struct input {
+	int		 fd;
+	char		*buf;		/* mapping or read buffer */
+	size_t		 bufsize;
+	int		 mapped;
+	size_t		 pos;		/* start of the next line */
+	size_t		 end;		/* end of valid data */
+	int		 eof;
+	enum input_framing framing;
+};
+
+static int
+input_getrecord(struct input *this, const char **record, size_t *len);
+
+static int
+input_getrecords(struct input *this, const char **block, size_t *len);
+
+static size_t
+input_records(const char *p, size_t n, size_t limit);
+
+static int
+input_fill(struct input *this);
+
+struct input *
+input_open(int fd)
+{
+	struct input *this;
+	struct stat st;
+	void *p;
+
+	this = ecalloc(1, sizeof(*this));
+	this->fd = fd;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+	    (unsigned long long)st.st_size <= SIZE_MAX) {
+		p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+		    fd, 0);
+		if (p != MAP_FAILED) {
+			(void)madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+			this->buf = p;
+			this->bufsize = (size_t)st.st_size;
+			this->end = this->bufsize;
+			this->mapped = 1;
+			this->eof = 1;
+		}
+	}
+
+	if (!this->mapped) {
+		this->bufsize = INPUT_BLOCKSIZE;
+		this->buf = emalloc(this->bufsize);
+	}
+
+	DPRINTF(("%s(): input=%p fd=%d mapped=%d\n", __func__, this, fd,
+	    this->mapped));
+
+	return this;
+}
+
+void
+input_close(struct input *this)
+{
+
+	assert(this);
+
+	if (this->mapped)
+		munmap(this->buf, this->bufsize);
+	else
+		free(this->buf);
+	free(this);
+}
+
+void
+input_setframing(struct input *this, enum input_framing framing)
+{
+
+	assert(this);
+	assert(this->pos == 0);
+
+	this->framing = framing;
+}
+
+enum input_framing
+input_framing(struct input *this)
+{
+
+	assert(this);
+
+	return this->framing;
+}
+
+int
+input_getline(struct input *this, const char **line, size_t *len)
+{
+	const char *nl;
+	size_t n;
+
+	assert(this);
+	assert(line);
+	assert(len);
+
+	if (this->framing == input_framing_records)
+		return input_getrecord(this, line, len);
+
+	for (;;) {
+		n = this->end - this->pos;
+		nl = memchr(&this->buf[this->pos], '\n', n);
+		if (nl != NULL) {
+			n = (size_t)(nl - &this->buf[this->pos]);
+			*line = &this->buf[this->pos];
+			this->pos += n + 1;
+			break;
+		}
+		if (this->eof) {
+			if (n == 0)
+				return 0;
+			/* Last line without a trailing newline */
+			*line = &this->buf[this->pos];
+			this->pos += n;
+			break;
+		}
+		if (input_fill(this) == -1)
+			err(EXIT_FAILURE, "read");
+	}
+
+	/* Strip trailing \r */
+	if (n > 0 && (*line)[n - 1] == '\r')
+		n--;
+	*len = n;
+
+	return 1;
+}
+
+int
+input_getblock(struct input *this, const char **block, size_t *len)
+{
+	const char *nl;
+	size_t n;
+
+	assert(this);
+	assert(block);
+	assert(len);
+
+	if (this->framing == input_framing_records)
+		return input_getrecords(this, block, len);
+
+	for (;;) {
+		n = this->end - this->pos;
+		if (this->eof) {
+			if (n == 0)
+				return 0;
+			/* A mapped file is handed out a block at a time */
+			if (n > INPUT_BLOCKSIZE) {
+				nl = memchr(
+				    &this->buf[this->pos + INPUT_BLOCKSIZE],
+				    '\n', n - INPUT_BLOCKSIZE);
+				if (nl != NULL)
+					n = (size_t)(nl -
+					    &this->buf[this->pos]) + 1;
+			}
+			break;
+		}
+		if (n >= INPUT_BLOCKSIZE / 2) {
+			/* Cut after the last complete line */
+			while (n > 0 && this->buf[this->pos + n - 1] != '\n')
+				n--;
+			if (n > 0)
+				break;
+		}
+		if (input_fill(this) == -1)
+			err(EXIT_FAILURE, "read");
+	}
+
+	*block = &this->buf[this->pos];
+	*len = n;
+	this->pos += n;
+
+	return 1;
+}
+
+int
+input_splitline(const char **pos, const char *end, const char **line,
+                size_t *len)
+{
+	const char *nl;
+	size_t n;
+
+	assert(pos);
+	assert(end);
+	assert(line);
+	assert(len);
+
+	if (*pos >= end)
+		return 0;
+
+	*line = *pos;
+	nl = memchr(*pos, '\n', (size_t)(end - *pos));
+	if (nl != NULL) {
+		n = (size_t)(nl - *pos);
+		*pos = nl + 1;
+	} else {
+		n = (size_t)(end - *pos);
+		*pos = end;
+	}
+
+	/* Strip trailing \r */
+	if (n > 0 && (*line)[n - 1] == '\r')
+		n--;
+	*len = n;
+
+	return 1;
+}
+
+int
+input_splitrecord(const char **pos, const char *end, const char **record,
+                  size_t *len)
+{
+	size_t n;
+
+	assert(pos);
+	assert(end);
+	assert(record);
+	assert(len);
+
+	if (*pos >= end)
+		return 0;
+
+	n = (size_t)(end - *pos);
+	if (input_records(*pos, n, 1) == 0)
+		errx(EXIT_FAILURE, "truncated record");
+
+	*len = le32dec(*pos);
+	*record = *pos + INPUT_RECORDHEADER;
+	*pos = *record + *len;
+
+	return 1;
+}
+
+/* Private functions */
+
+int
+input_getrecord(struct input *this, const char **record, size_t *len)
+{
+	size_t n;
+
+	for (;;) {
+		n = this->end - this->pos;
+		if (input_records(&this->buf[this->pos], n, 1) > 0)
+			break;
+		if (this->eof) {
+			if (n == 0)
+				return 0;
+			errx(EXIT_FAILURE, "truncated record");
+		}
+		if (input_fill(this) == -1)
+			err(EXIT_FAILURE, "read");
+	}
+
+	*len = le32dec(&this->buf[this->pos]);
+	*record = &this->buf[this->pos + INPUT_RECORDHEADER];
+	this->pos += INPUT_RECORDHEADER + *len;
+
+	return 1;
+}
+
+/* input_getblock() for records: cut after the last complete one */
+int
+input_getrecords(struct input *this, const char **block, size_t *len)
+{
+	size_t n;
+
+	for (;;) {
+		n = this->end - this->pos;
+		if (this->eof) {
+			if (n == 0)
+				return 0;
+			n = input_records(&this->buf[this->pos], n,
+			    INPUT_BLOCKSIZE);
+			if (n == 0)
+				errx(EXIT_FAILURE, "truncated record");
+			break;
+		}
+		if (n >= INPUT_BLOCKSIZE / 2) {
+			n = input_records(&this->buf[this->pos], n, n);
+			if (n > 0)
+				break;
+		}
+		if (input_fill(this) == -1)
+			err(EXIT_FAILURE, "read");
+	}
+
+	*block = &this->buf[this->pos];
+	*len = n;
+	this->pos += n;
+
+	return 1;
+}
+
+/*
+ * Length of the complete records at the start of the n bytes at p, stopping
+ * after the first that reaches limit bytes.  Only the headers are read.
+ */
+size_t
+input_records(const char *p, size_t n, size_t limit)
+{
+	size_t off, len;
+
+	off = 0;
+	while (off < limit && n - off >= INPUT_RECORDHEADER) {
+		len = le32dec(&p[off]);
+		if (len > n - off - INPUT_RECORDHEADER)
+			break;
+		off += INPUT_RECORDHEADER + len;
+	}
+
+	return off;
+}
+
+/*
+ * Moves the unconsumed tail to the front of the buffer and appends the next
+ * block, growing the buffer when a single line does not fit.
+ */
+int
+input_fill(struct input *this)
+{
+	ssize_t rv;
+
+	assert(this);
+	assert(!this->mapped);
+
+	if (this->pos > 0) {
+		memmove(this->buf, &this->buf[this->pos],
+		    this->end - this->pos);
+		this->end -= this->pos;
+		this->pos = 0;
+	}
+
+	if (this->bufsize - this->end < INPUT_BLOCKSIZE / 2) {
+		this->bufsize *= 2;
+		this->buf = erealloc(this->buf, this->bufsize);
+	}
+
+	do {
+		rv = read(this->fd, &this->buf[this->end],
+		    this->bufsize - this->end);
+	} while (rv == -1 && errno == EINTR);
+
+	if (rv == -1)
+		return -1;
+	if (rv == 0)
+		this->eof = 1;
+	this->end += (size_t)rv;
+
+	DPRINTF(("%s(): input=%p read=%zd end=%zu\n", __func__, this, rv,
+	    this->end));
+
+	return 0;
+}
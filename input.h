@@ -0,0 +1,91 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __EVALVAL_INPUT_H__
+#define __EVALVAL_INPUT_H__
+
+#include <stddef.h>
+
+/*
+ * Line reader handing out borrowed slices of its own buffer.  Regular files
+ * are mapped with mmap(2), anything else is read(2) in large blocks.
+ * A line returned by input_getline() is not NUL-terminated and stays valid
+ * until the next call to input_getline() or input_close().
+ */
+
+/*
+ * Lines end in a newline, an optional \r before it is dropped.  Records
+ * are a 32-bit little-endian length followed by that many bytes.  With
+ * records, "line" below means a record's contents; input that ends inside
+ * a record is fatal.
+ */
+enum input_framing {
+	input_framing_lines,
+	input_framing_records
+};
+
+struct input;
+
+struct input *
+input_open(int fd);
+
+/* Lines by default; to be set before the first read */
+void
+input_setframing(struct input *this, enum input_framing framing);
+
+enum input_framing
+input_framing(struct input *this);
+
+void
+input_close(struct input *this);
+
+int
+input_getline(struct input *this, const char **line, size_t *len);
+
+/*
+ * Returns the next chunk of input, a few hundred KiB of whole lines,
+ * valid until the next call.  Lines can then be split off with
+ * input_splitline(), or input_splitrecord() for records, which advance
+ * *pos towards end.  All return 0 when there is nothing left.  Do not mix
+ * with input_getline().
+ */
+int
+input_getblock(struct input *this, const char **block, size_t *len);
+
+int
+input_splitline(const char **pos, const char *end, const char **line,
+                size_t *len);
+
+int
+input_splitrecord(const char **pos, const char *end, const char **record,
+                  size_t *len);
+
+#endif /* __EVALVAL_INPUT_H__ */
@@ -0,0 +1,850 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/mman.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <util.h>
+
+#include "astnode.h"
+#include "bytecode.h"
+
+#include "jit.h"
+
+#ifdef DEBUG_JIT
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+typedef double (*jit_fn)(const double *);
+
+struct jit {
+	jit_fn			 fn;		/* NULL: run bc */
+	void			*map;
+	size_t			 mapsize;
+	struct bytecode		*bc;
+	size_t			 nvars;
+};
+
+#if defined(__x86_64__)
+#define JIT_NATIVE
+
+/*
+ * The generated function is double fn(const double *vars) in the SysV ABI:
+ * vars arrives in %rdi and the result leaves in %xmm0.  All sixteen xmm
+ * registers are caller-saved, so nothing needs saving.
+ *
+ * Nodes shared in a DAG, see astnode_id(), are computed once each, ahead
+ * of the expression and in an order where every one comes after those it
+ * uses, into spill slots in a frame below %rsp.  Everywhere else they are
+ * operands in memory like variables.  Without shared nodes there is no
+ * frame.  A DAG with more than JIT_MAXSPILLS of them runs as bytecode.
+ *
+ * Registers are assigned with Sethi-Ullman numbering: of the two operands
+ * of a binary node the one needing more registers is computed first, and an
+ * operand that is a number or a variable is used straight from memory.
+ * Operands are never swapped, so even NaN propagation follows the
+ * interpreter.  A tree needing more than JIT_NREGS registers, which takes
+ * tens of thousands of operands, runs as bytecode instead of spilling.
+ *
+ * Constants follow the code in the same mapping, addressed %rip-relative.
+ * The first 16 bytes hold the sign mask for negation, which xorpd requires
+ * to be aligned.
+ */
+#define JIT_NREGS	16
+
+/*
+ * Labeling and code generation recurse, so deeper trees, which are long
+ * chains rather than register-hungry ones, run as bytecode too.
+ */
+#define JIT_MAXDEPTH	4096
+
+#define JIT_MAXSPILLS	4096
+
+#define JIT_OP_MOVSD	0x10
+#define JIT_OP_MOVSDST	0x11		/* movsd to memory */
+#define JIT_OP_XORPD	0x57
+#define JIT_OP_ADDSD	0x58
+#define JIT_OP_MULSD	0x59
+#define JIT_OP_SUBSD	0x5c
+#define JIT_OP_DIVSD	0x5e
+
+#define JIT_RDI		7
+#define JIT_RSP		4
+
+struct jit_compiler {
+	uint8_t		*code;		/* NULL while sizing */
+	size_t		 len;
+	size_t		 pool;		/* offset of the constant pool */
+	size_t		 nconsts;
+	double		*consts;
+	size_t		 constssize;
+	unsigned	*need;		/* per node, in preorder */
+	size_t		*size;
+	size_t		 nodessize;
+	struct astnode	*root;		/* being generated */
+	struct astnode	**shared;	/* in the order they are computed */
+	size_t		 nshared;
+	uint32_t	*spills;	/* per id: spill slot plus one */
+	size_t		 nvars;
+	int		 regs[JIT_NREGS];
+	int		 nregs;
+	int		 error;
+};
+
+static void
+jit_collect(struct jit_compiler *this, struct astnode *n);
+
+static void
+jit_genall(struct jit_compiler *this, struct astnode *n);
+
+static void
+jit_unit(struct jit_compiler *this, struct astnode *n);
+
+static size_t
+jit_count(struct jit_compiler *this, struct astnode *n, size_t *depth);
+
+static size_t
+jit_label(struct jit_compiler *this, struct astnode *n, size_t i);
+
+static void
+jit_gen(struct jit_compiler *this, struct astnode *n, size_t i);
+
+static void
+jit_binop(struct jit_compiler *this, struct astnode *n, size_t i, uint8_t op);
+
+static void
+jit_operand(struct jit_compiler *this, uint8_t prefix, uint8_t op, int reg,
+            struct astnode *n);
+
+static void
+jit_emitrr(struct jit_compiler *this, uint8_t prefix, uint8_t op, int reg,
+           int rm);
+
+static void
+jit_emitvar(struct jit_compiler *this, uint8_t prefix, uint8_t op, int reg,
+            size_t index);
+
+static void
+jit_emitspill(struct jit_compiler *this, uint8_t prefix, uint8_t op, int reg,
+              size_t slot);
+
+static void
+jit_emitrip(struct jit_compiler *this, uint8_t prefix, uint8_t op, int reg,
+            size_t offset);
+
+static void
+jit_emitrsp(struct jit_compiler *this, uint8_t ext, size_t len);
+
+static void
+jit_emitbyte(struct jit_compiler *this, uint8_t b);
+
+static void
+jit_emit32(struct jit_compiler *this, uint32_t v);
+
+static size_t
+jit_const(struct jit_compiler *this, double v);
+
+static int
+jit_isleaf(struct jit_compiler *this, struct astnode *n);
+
+static int
+jit_native_compile(struct jit *this, struct astnode *n);
+#endif
+
+struct jit *
+jit_compile(struct astnode *n)
+{
+	struct jit *this;
+
+	assert(n);
+
+	this = ecalloc(1, sizeof(*this));
+
+#ifdef JIT_NATIVE
+	if (jit_native_compile(this, n))
+		return this;
+#endif
+
+	this->bc = bytecode_compile(n);
+	this->nvars = bytecode_nvariables(this->bc);
+
+	return this;
+}
+
+void
+jit_delete(struct jit *this)
+{
+
+	assert(this);
+
+	if (this->map != NULL)
+		munmap(this->map, this->mapsize);
+	if (this->bc != NULL)
+		bytecode_delete(this->bc);
+	free(this);
+}
+
+int
+jit_native(const struct jit *this)
+{
+
+	assert(this);
+
+	return this->fn != NULL;
+}
+
+size_t
+jit_nvariables(const struct jit *this)
+{
+
+	assert(this);
+
+	return this->nvars;
+}
+
+double
+jit_eval(const struct jit *this, const double *vars)
+{
+
+	assert(this);
+	assert(vars || this->nvars == 0);
+
+	if (this->fn != NULL)
+		return this->fn(vars);
+
+	return bytecode_eval(this->bc, vars);
+}
+
+/* Private functions */
+
+#ifdef JIT_NATIVE
+/*
+ * Sizes the code in a first pass with nothing written, then maps the
+ * buffer, emits for real and makes it executable.  Both passes walk the
+ * DAG in the same order, so instruction lengths and constant slots agree.
+ */
+int
+jit_native_compile(struct jit *this, struct astnode *n)
+{
+	struct jit_compiler c;
+	uint8_t *map;
+	size_t mapsize;
+	int prot;
+
+	memset(&c, 0, sizeof(c));
+
+	jit_collect(&c, n);
+	if (c.nshared > JIT_MAXSPILLS)
+		goto fail;
+
+	jit_genall(&c, n);
+	if (c.error)
+		goto fail;
+
+	c.pool = (c.len + 15) & ~(size_t)15;
+	mapsize = c.pool + 16 + c.nconsts * sizeof(double);
+	if (mapsize > INT32_MAX)
+		goto fail;
+
+	prot = PROT_READ | PROT_WRITE;
+#ifdef PROT_MPROTECT
+	prot |= PROT_MPROTECT(PROT_EXEC);
+#endif
+	map = mmap(NULL, mapsize, prot, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+
+	/* Pool first: the sign mask, then the constants */
+	memset(map, 0xcc, c.pool);
+	memset(map + c.pool, 0, 16);
+	map[c.pool + 7] = 0x80;
+	memcpy(map + c.pool + 16, c.consts, c.nconsts * sizeof(double));
+
+	c.code = map;
+	c.len = 0;
+	c.nconsts = 0;
+	jit_genall(&c, n);
+	assert(!c.error);
+	assert(c.len <= c.pool);
+
+	if (mprotect(map, mapsize, PROT_READ | PROT_EXEC) == -1) {
+		munmap(map, mapsize);
+		goto fail;
+	}
+
+	DPRINTF(("%s(): map=%p code=%zu consts=%zu shared=%zu\n", __func__,
+	    map, c.len, c.nconsts, c.nshared));
+
+	this->map = map;
+	this->mapsize = mapsize;
+	this->fn = (jit_fn)(uintptr_t)map;
+	this->nvars = c.nvars;
+
+	free(c.need);
+	free(c.size);
+	free(c.consts);
+	free(c.shared);
+	free(c.spills);
+
+	return 1;
+
+fail:
+	free(c.need);
+	free(c.size);
+	free(c.consts);
+	free(c.shared);
+	free(c.spills);
+
+	return 0;
+}
+
+/*
+ * Lists the shared nodes below n, each once, in post-order, so that every
+ * one comes after those it uses, and numbers their spill slots.  Walks
+ * the DAG with an explicit stack, one operand at a time, so a shared node
+ * met again has been listed already.
+ */
+void
+jit_collect(struct jit_compiler *this, struct astnode *n)
+{
+	struct jit_frame {
+		struct astnode	*node;
+		int		 visited;
+	} *frames, *f;
+	struct astnode *root;
+	size_t id, nframes, size, nspills, newsize, sharedsize;
+
+	root = n;
+	size = 64;
+	frames = emalloc(size * sizeof(*frames));
+	nframes = 0;
+	frames[nframes].node = n;
+	frames[nframes++].visited = 0;
+	nspills = 0;
+	sharedsize = 0;
+
+	while (nframes > 0) {
+		if (nframes == size) {
+			size *= 2;
+			frames = erealloc(frames, size * sizeof(*frames));
+		}
+		f = &frames[nframes - 1];
+		n = f->node;
+		id = n != root ? astnode_id(n) : 0;
+
+		if (f->visited == 0 && id != 0) {
+			if (id >= nspills) {
+				newsize = nspills > 0 ? nspills * 2 : 64;
+				while (newsize <= id)
+					newsize *= 2;
+				this->spills = erealloc(this->spills,
+				    newsize * sizeof(*this->spills));
+				memset(&this->spills[nspills], 0, (newsize -
+				    nspills) * sizeof(*this->spills));
+				nspills = newsize;
+			}
+			if (this->spills[id] != 0) {
+				nframes--;
+				continue;
+			}
+		}
+
+		switch (astnode_type(n)) {
+		case astnode_type_plus:
+		case astnode_type_minus:
+		case astnode_type_mul:
+		case astnode_type_div:
+			if (f->visited < 2) {
+				frames[nframes].node = f->visited++ == 0 ?
+				    astnode_left(n) : astnode_right(n);
+				frames[nframes++].visited = 0;
+				continue;
+			}
+			break;
+		case astnode_type_unaryminus:
+			if (f->visited++ == 0) {
+				frames[nframes].node = astnode_left(n);
+				frames[nframes++].visited = 0;
+				continue;
+			}
+			break;
+		default:
+			break;
+		}
+
+		if (id != 0) {
+			if (this->nshared == sharedsize) {
+				sharedsize = sharedsize ? sharedsize * 2 : 64;
+				this->shared = erealloc(this->shared,
+				    sharedsize * sizeof(*this->shared));
+			}
+			this->shared[this->nshared++] = n;
+			this->spills[id] = (uint32_t)this->nshared;
+		}
+		nframes--;
+	}
+
+	free(frames);
+}
+
+/*
+ * Emits the whole function: the shared nodes into their spill slots, then
+ * n, whose value is left in %xmm0.
+ */
+void
+jit_genall(struct jit_compiler *this, struct astnode *n)
+{
+	size_t i, frame;
+
+	/* Kept a multiple of 16, as the ABI wants %rsp */
+	frame = (this->nshared * sizeof(double) + 15) & ~(size_t)15;
+	if (frame > 0)
+		jit_emitrsp(this, 5, frame);		/* sub $frame, %rsp */
+
+	for (i = 0; i < this->nshared; i++) {
+		jit_unit(this, this->shared[i]);
+		jit_emitspill(this, 0xf2, JIT_OP_MOVSDST,
+		    this->regs[this->nregs - 1], i);
+	}
+	jit_unit(this, n);
+
+	if (frame > 0)
+		jit_emitrsp(this, 0, frame);		/* add $frame, %rsp */
+	jit_emitbyte(this, 0xc3);			/* ret */
+}
+
+/*
+ * Emits code leaving n in %xmm0, the shared nodes below it being spilled
+ * already.  Labels n first, so the node arrays are sized here.
+ */
+void
+jit_unit(struct jit_compiler *this, struct astnode *n)
+{
+	size_t nnodes, depth;
+	int i;
+
+	if (this->error)
+		return;
+
+	this->root = n;
+	nnodes = jit_count(this, n, &depth);
+	if (depth > JIT_MAXDEPTH) {
+		this->error = 1;
+		return;
+	}
+	if (nnodes > this->nodessize) {
+		this->nodessize = nnodes;
+		this->need = erealloc(this->need, nnodes * sizeof(*this->need));
+		this->size = erealloc(this->size, nnodes * sizeof(*this->size));
+	}
+	jit_label(this, n, 0);
+	if (this->error || this->need[0] > JIT_NREGS) {
+		this->error = 1;
+		return;
+	}
+
+	/* xmm0 on top, so the result ends up where the ABI wants it */
+	for (i = 0; i < JIT_NREGS; i++)
+		this->regs[i] = JIT_NREGS - 1 - i;
+	this->nregs = JIT_NREGS;
+
+	jit_gen(this, n, 0);
+}
+
+/*
+ * Counts the nodes and measures the depth, without recursion; spilled
+ * nodes count as leaves
+ */
+size_t
+jit_count(struct jit_compiler *this, struct astnode *n, size_t *depth)
+{
+	struct jit_frame {
+		struct astnode	*node;
+		size_t		 depth;
+	} *stack;
+	size_t nstack, size, nnodes, d;
+
+	assert(n);
+	assert(depth);
+
+	size = 64;
+	stack = emalloc(size * sizeof(*stack));
+	nstack = 0;
+	stack[nstack].node = n;
+	stack[nstack++].depth = 1;
+
+	nnodes = 0;
+	*depth = 0;
+	while (nstack > 0) {
+		if (size - nstack < 2) {
+			size *= 2;
+			stack = erealloc(stack, size * sizeof(*stack));
+		}
+		n = stack[--nstack].node;
+		d = stack[nstack].depth;
+		nnodes++;
+		if (d > *depth)
+			*depth = d;
+		if (jit_isleaf(this, n))
+			continue;
+
+		switch (astnode_type(n)) {
+		case astnode_type_plus:
+		case astnode_type_minus:
+		case astnode_type_mul:
+		case astnode_type_div:
+			stack[nstack].node = astnode_right(n);
+			stack[nstack++].depth = d + 1;
+			/* FALLTHROUGH */
+		case astnode_type_unaryminus:
+			stack[nstack].node = astnode_left(n);
+			stack[nstack++].depth = d + 1;
+			break;
+		default:
+			break;
+		}
+	}
+
+	free(stack);
+
+	return nnodes;
+}
+
+/*
+ * Records the registers needed by node i, numbered in preorder, and the size
+ * of its subtree, which locates the right operand.  Returns the size.
+ */
+size_t
+jit_label(struct jit_compiler *this, struct astnode *n, size_t i)
+{
+	size_t nl, nr;
+	unsigned l, r, need;
+
+	assert(this);
+	assert(n);
+
+	switch (jit_isleaf(this, n) ? astnode_type_variable : astnode_type(n)) {
+	case astnode_type_number:
+	case astnode_type_variable:
+		nl = nr = 0;
+		need = 1;
+		break;
+	case astnode_type_unaryminus:
+		nl = jit_label(this, astnode_left(n), i + 1);
+		nr = 0;
+		need = this->need[i + 1];
+		break;
+	case astnode_type_plus:
+	case astnode_type_minus:
+	case astnode_type_mul:
+	case astnode_type_div:
+		nl = jit_label(this, astnode_left(n), i + 1);
+		nr = jit_label(this, astnode_right(n), i + 1 + nl);
+		l = this->need[i + 1];
+		r = jit_isleaf(this, astnode_right(n)) ? 0 :
+		    this->need[i + 1 + nl];
+		need = l == r ? l + 1 : (l > r ? l : r);
+		break;
+	default:
+		this->error = 1;
+		return 1;
+	}
+
+	this->need[i] = need;
+	this->size[i] = 1 + nl + nr;
+
+	return 1 + nl + nr;
+}
+
+/* Emits code leaving node i in the register on top of the stack */
+void
+jit_gen(struct jit_compiler *this, struct astnode *n, size_t i)
+{
+	int top;
+
+	assert(this);
+	assert(n);
+	assert(this->nregs >= (int)this->need[i]);
+
+	top = this->regs[this->nregs - 1];
+
+	if (jit_isleaf(this, n)) {
+		jit_operand(this, 0xf2, JIT_OP_MOVSD, top, n);
+		return;
+	}
+
+	switch (astnode_type(n)) {
+	case astnode_type_unaryminus:
+		jit_gen(this, astnode_left(n), i + 1);
+		jit_emitrip(this, 0x66, JIT_OP_XORPD, top, this->pool);
+		break;
+	case astnode_type_plus:
+		jit_binop(this, n, i, JIT_OP_ADDSD);
+		break;
+	case astnode_type_minus:
+		jit_binop(this, n, i, JIT_OP_SUBSD);
+		break;
+	case astnode_type_mul:
+		jit_binop(this, n, i, JIT_OP_MULSD);
+		break;
+	case astnode_type_div:
+		jit_binop(this, n, i, JIT_OP_DIVSD);
+		break;
+	default:
+		this->error = 1;
+		break;
+	}
+}
+
+void
+jit_binop(struct jit_compiler *this, struct astnode *n, size_t i, uint8_t op)
+{
+	struct astnode *l, *r;
+	size_t li, ri;
+	int dst, src, tmp;
+
+	l = astnode_left(n);
+	r = astnode_right(n);
+	li = i + 1;
+	ri = li + this->size[li];
+
+	if (jit_isleaf(this, r)) {
+		jit_gen(this, l, li);
+		jit_operand(this, 0xf2, op, this->regs[this->nregs - 1], r);
+		return;
+	}
+
+	if (this->need[li] >= this->need[ri]) {
+		jit_gen(this, l, li);
+		dst = this->regs[--this->nregs];
+		jit_gen(this, r, ri);
+		src = this->regs[this->nregs - 1];
+		this->nregs++;
+	} else {
+		/* Right first, into the second register; left into the top */
+		tmp = this->regs[this->nregs - 1];
+		this->regs[this->nregs - 1] = this->regs[this->nregs - 2];
+		this->regs[this->nregs - 2] = tmp;
+
+		jit_gen(this, r, ri);
+		src = this->regs[--this->nregs];
+		jit_gen(this, l, li);
+		dst = this->regs[this->nregs - 1];
+		this->nregs++;
+
+		tmp = this->regs[this->nregs - 1];
+		this->regs[this->nregs - 1] = this->regs[this->nregs - 2];
+		this->regs[this->nregs - 2] = tmp;
+	}
+
+	jit_emitrr(this, 0xf2, op, dst, src);
+}
+
+/* op reg, n for a leaf n, taken from memory */
+void
+jit_operand(struct jit_compiler *this, uint8_t prefix, uint8_t op, int reg,
+            struct astnode *n)
+{
+	size_t index;
+
+	switch (astnode_type(n)) {
+	case astnode_type_number:
+		jit_emitrip(this, prefix, op, reg, this->pool + 16 +
+		    jit_const(this, astnode_value(n)) * sizeof(double));
+		break;
+	case astnode_type_variable:
+		index = astnode_index(n);
+		if (index >= this->nvars)
+			this->nvars = index + 1;
+		jit_emitvar(this, prefix, op, reg, index);
+		break;
+	default:
+		jit_emitspill(this, prefix, op, reg,
+		    this->spills[astnode_id(n)] - 1);
+		break;
+	}
+}
+
+/* op xmm(reg), xmm(rm) */
+void
+jit_emitrr(struct jit_compiler *this, uint8_t prefix, uint8_t op, int reg,
+           int rm)
+{
+
+	jit_emitbyte(this, prefix);
+	if (reg >= 8 || rm >= 8)
+		jit_emitbyte(this, 0x40 | (reg >= 8) << 2 | (rm >= 8));
+	jit_emitbyte(this, 0x0f);
+	jit_emitbyte(this, op);
+	jit_emitbyte(this, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/* op xmm(reg), index*8(%rdi) */
+void
+jit_emitvar(struct jit_compiler *this, uint8_t prefix, uint8_t op, int reg,
+            size_t index)
+{
+	size_t disp;
+
+	if (index > INT32_MAX / sizeof(double)) {
+		this->error = 1;
+		return;
+	}
+	disp = index * sizeof(double);
+
+	jit_emitbyte(this, prefix);
+	if (reg >= 8)
+		jit_emitbyte(this, 0x44);
+	jit_emitbyte(this, 0x0f);
+	jit_emitbyte(this, op);
+	if (disp == 0) {
+		jit_emitbyte(this, 0x00 | (reg & 7) << 3 | JIT_RDI);
+	} else if (disp < 128) {
+		jit_emitbyte(this, 0x40 | (reg & 7) << 3 | JIT_RDI);
+		jit_emitbyte(this, (uint8_t)disp);
+	} else {
+		jit_emitbyte(this, 0x80 | (reg & 7) << 3 | JIT_RDI);
+		jit_emit32(this, (uint32_t)disp);
+	}
+}
+
+/* op xmm(reg), slot*8(%rsp) */
+void
+jit_emitspill(struct jit_compiler *this, uint8_t prefix, uint8_t op, int reg,
+              size_t slot)
+{
+	size_t disp;
+
+	disp = slot * sizeof(double);
+
+	jit_emitbyte(this, prefix);
+	if (reg >= 8)
+		jit_emitbyte(this, 0x44);
+	jit_emitbyte(this, 0x0f);
+	jit_emitbyte(this, op);
+	if (disp == 0) {
+		jit_emitbyte(this, 0x00 | (reg & 7) << 3 | JIT_RSP);
+		jit_emitbyte(this, 0x24);
+	} else if (disp < 128) {
+		jit_emitbyte(this, 0x40 | (reg & 7) << 3 | JIT_RSP);
+		jit_emitbyte(this, 0x24);
+		jit_emitbyte(this, (uint8_t)disp);
+	} else {
+		jit_emitbyte(this, 0x80 | (reg & 7) << 3 | JIT_RSP);
+		jit_emitbyte(this, 0x24);
+		jit_emit32(this, (uint32_t)disp);
+	}
+}
+
+/* op xmm(reg), offset(%rip), offset counting from the start of the code */
+void
+jit_emitrip(struct jit_compiler *this, uint8_t prefix, uint8_t op, int reg,
+            size_t offset)
+{
+
+	jit_emitbyte(this, prefix);
+	if (reg >= 8)
+		jit_emitbyte(this, 0x44);
+	jit_emitbyte(this, 0x0f);
+	jit_emitbyte(this, op);
+	jit_emitbyte(this, 0x05 | (reg & 7) << 3);
+	/* Relative to the end of the instruction, i.e. after the disp32 */
+	jit_emit32(this, (uint32_t)(offset - (this->len + 4)));
+}
+
+/* add (ext 0) or sub (ext 5) $len, %rsp */
+void
+jit_emitrsp(struct jit_compiler *this, uint8_t ext, size_t len)
+{
+
+	jit_emitbyte(this, 0x48);
+	jit_emitbyte(this, 0x81);
+	jit_emitbyte(this, 0xc0 | ext << 3 | JIT_RSP);
+	jit_emit32(this, (uint32_t)len);
+}
+
+void
+jit_emitbyte(struct jit_compiler *this, uint8_t b)
+{
+
+	if (this->code != NULL)
+		this->code[this->len] = b;
+	this->len++;
+}
+
+void
+jit_emit32(struct jit_compiler *this, uint32_t v)
+{
+
+	jit_emitbyte(this, v & 0xff);
+	jit_emitbyte(this, (v >> 8) & 0xff);
+	jit_emitbyte(this, (v >> 16) & 0xff);
+	jit_emitbyte(this, (v >> 24) & 0xff);
+}
+
+/* Slot of a new constant; the values are collected while sizing */
+size_t
+jit_const(struct jit_compiler *this, double v)
+{
+
+	if (this->code == NULL) {
+		if (this->nconsts == this->constssize) {
+			this->constssize = this->constssize ?
+			    this->constssize * 2 : 16;
+			this->consts = erealloc(this->consts,
+			    this->constssize * sizeof(*this->consts));
+		}
+		this->consts[this->nconsts] = v;
+	}
+
+	return this->nconsts++;
+}
+
+/* Numbers, variables and spilled nodes are operands in memory */
+int
+jit_isleaf(struct jit_compiler *this, struct astnode *n)
+{
+
+	return astnode_type(n) == astnode_type_number ||
+	    astnode_type(n) == astnode_type_variable ||
+	    (astnode_id(n) != 0 && n != this->root);
+}
+#endif /* JIT_NATIVE */
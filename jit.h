@@ -29,59 +29,41 @@
  * SUCH DAMAGE.
  */
 
-#include <sys/cdefs.h>
-__RCSID("$NetBSD$");
 
-#include <assert.h>
-#include <err.h>
-#include <regex.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
+#ifndef __EVALVAL_JIT_H__
+#define __EVALVAL_JIT_H__
 
-#include "util.h"
+#include <stddef.h>
 
-#ifdef DEBUG_MY_GETLINE
-#define DPRINTF(a) printf a
-#else
-#define DPRINTF(a)
-#endif
+/*
+ * Native code for expressions that are evaluated many times with different
+ * variables.  On x86-64 the tree is compiled to SSE2 scalar code, which
+ * rounds exactly like the interpreter, so results are bit-identical.
+ * Elsewhere, or when native compilation is not possible, the same interface
+ * runs the bytecode instead.
+ *
+ * A compiled expression does not refer to the tree it was made from.
+ */
 
-char *
-my_getline(FILE *stream)
-{
-	char *buf, *lbuf;
-	size_t len;
+struct astnode;
+struct jit;
 
-	assert(stream);
+struct jit *
+jit_compile(struct astnode *n);
 
-	DPRINTF(("Getting line from stream=%p\n", stream));
+void
+jit_delete(struct jit *this);
 
-	if ((buf = fgetln(stream, &len)) != NULL) {
-		if (buf[len - 1] == '\n') {
-			buf[len - 1] = '\0';
-			/* Strip trailing \r */
-			if (len - 2 > 0 && buf[len - 2] == '\r')
-				buf[len - 2] = '\0';
-			lbuf = strndup(buf, len);
-			if (lbuf == NULL)
-				err(EXIT_FAILURE, "strndup");
-		} else {
-			lbuf = strndup(buf, len + 1);
-			if (lbuf == NULL)
-				err(EXIT_FAILURE, "strndup");
-			lbuf[len] = '\0';
-			/* Strip trailing \r */
-			if (len - 1 > 0 && lbuf[len - 1] == '\r')
-				lbuf[len - 1] = '\0';
-		}
-		return lbuf;
-	}
+/* Nonzero if jit_eval() runs native code */
+int
+jit_native(const struct jit *this);
 
-	if (ferror(stream))
-		err(EXIT_FAILURE, "ferror");
+/* Number of variables referenced, i.e. the highest index plus one */
+size_t
+jit_nvariables(const struct jit *this);
 
-	assert(feof(stream));
+/* vars[i] is the value of variable i; may be NULL without variables */
+double
+jit_eval(const struct jit *this, const double *vars);
 
-	return NULL;
-}
+#endif /* __EVALVAL_JIT_H__ */
@@ -0,0 +1,265 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNEL_X86
+#include <immintrin.h>
+#endif
+
+#include "kernel.h"
+
+#ifdef DEBUG_KERNEL
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+/*
+ * Each operation is a single IEEE instruction per element, in vector or
+ * scalar form, so there is nothing for the compiler to contract or
+ * reassociate and every implementation rounds identically.  Negation
+ * flips the sign bit, like the scalar unary minus.  Every operation is
+ * instantiated for double and, with the suffix _f, for float.
+ */
+
+#define KERNEL_SCALAR_BINOP(T, sfx, name, op)				\
+static void								\
+kernel_scalar##sfx##_##name(T *dst, const T *a, const T *b, size_t n)	\
+{									\
+	size_t i;							\
+									\
+	for (i = 0; i < n; i++)						\
+		dst[i] = a[i] op b[i];					\
+}									\
+									\
+static void								\
+kernel_scalar##sfx##_##name##k(T *dst, const T *a, T k, size_t n)	\
+{									\
+	size_t i;							\
+									\
+	for (i = 0; i < n; i++)						\
+		dst[i] = a[i] op k;					\
+}
+
+#define KERNEL_SCALAR(T, sfx, st)					\
+KERNEL_SCALAR_BINOP(T, sfx, add, +)					\
+KERNEL_SCALAR_BINOP(T, sfx, sub, -)					\
+KERNEL_SCALAR_BINOP(T, sfx, mul, *)					\
+KERNEL_SCALAR_BINOP(T, sfx, div, /)					\
+									\
+static void								\
+kernel_scalar##sfx##_neg(T *dst, const T *a, size_t n)			\
+{									\
+	size_t i;							\
+									\
+	for (i = 0; i < n; i++)						\
+		dst[i] = -a[i];						\
+}									\
+									\
+static const struct st kernel_scalar##sfx = {				\
+	"scalar",							\
+	kernel_scalar##sfx##_add, kernel_scalar##sfx##_sub,		\
+	kernel_scalar##sfx##_mul, kernel_scalar##sfx##_div,		\
+	kernel_scalar##sfx##_addk, kernel_scalar##sfx##_subk,		\
+	kernel_scalar##sfx##_mulk, kernel_scalar##sfx##_divk,		\
+	kernel_scalar##sfx##_neg					\
+};
+
+KERNEL_SCALAR(double, , kernel)
+KERNEL_SCALAR(float, _f, kernel_float)
+
+#ifdef KERNEL_X86
+
+/*
+ * KERNEL_VECTOR(isa, target, element type, suffix, vector type, lanes,
+ * prefix, type) instantiates the operations with the _<prefix>_*_<type>
+ * intrinsics and a scalar tail.
+ */
+
+#define KERNEL_VECTOR_BINOP(isa, target, T, sfx, vt, w, px, ty, name, op) \
+static void __attribute__((__target__(target)))				\
+kernel_##isa##sfx##_##name(T *dst, const T *a, const T *b, size_t n)	\
+{									\
+	size_t i;							\
+									\
+	for (i = 0; i + (w) <= n; i += (w))				\
+		px##_storeu_##ty(&dst[i], px##_##name##_##ty(		\
+		    px##_loadu_##ty(&a[i]), px##_loadu_##ty(&b[i])));	\
+	for (; i < n; i++)						\
+		dst[i] = a[i] op b[i];					\
+}									\
+									\
+static void __attribute__((__target__(target)))				\
+kernel_##isa##sfx##_##name##k(T *dst, const T *a, T k, size_t n)	\
+{									\
+	vt vk;								\
+	size_t i;							\
+									\
+	vk = px##_set1_##ty(k);						\
+	for (i = 0; i + (w) <= n; i += (w))				\
+		px##_storeu_##ty(&dst[i], px##_##name##_##ty(		\
+		    px##_loadu_##ty(&a[i]), vk));			\
+	for (; i < n; i++)						\
+		dst[i] = a[i] op k;					\
+}
+
+#define KERNEL_VECTOR(isa, target, T, sfx, st, vt, w, px, ty)		\
+KERNEL_VECTOR_BINOP(isa, target, T, sfx, vt, w, px, ty, add, +)	\
+KERNEL_VECTOR_BINOP(isa, target, T, sfx, vt, w, px, ty, sub, -)	\
+KERNEL_VECTOR_BINOP(isa, target, T, sfx, vt, w, px, ty, mul, *)	\
+KERNEL_VECTOR_BINOP(isa, target, T, sfx, vt, w, px, ty, div, /)	\
+									\
+static void __attribute__((__target__(target)))				\
+kernel_##isa##sfx##_neg(T *dst, const T *a, size_t n)			\
+{									\
+	vt sign;							\
+	size_t i;							\
+									\
+	sign = px##_set1_##ty(-0.0);					\
+	for (i = 0; i + (w) <= n; i += (w))				\
+		px##_storeu_##ty(&dst[i], px##_xor_##ty(		\
+		    px##_loadu_##ty(&a[i]), sign));			\
+	for (; i < n; i++)						\
+		dst[i] = -a[i];						\
+}									\
+									\
+static const struct st kernel_##isa##sfx = {				\
+	#isa,								\
+	kernel_##isa##sfx##_add, kernel_##isa##sfx##_sub,		\
+	kernel_##isa##sfx##_mul, kernel_##isa##sfx##_div,		\
+	kernel_##isa##sfx##_addk, kernel_##isa##sfx##_subk,		\
+	kernel_##isa##sfx##_mulk, kernel_##isa##sfx##_divk,		\
+	kernel_##isa##sfx##_neg						\
+};
+
+/* Floats fill twice the lanes of a vector */
+KERNEL_VECTOR(sse2, "sse2", double, , kernel, __m128d, 2, _mm, pd)
+KERNEL_VECTOR(sse2, "sse2", float, _f, kernel_float, __m128, 4, _mm, ps)
+KERNEL_VECTOR(avx2, "avx2", double, , kernel, __m256d, 4, _mm256, pd)
+KERNEL_VECTOR(avx2, "avx2", float, _f, kernel_float, __m256, 8, _mm256, ps)
+KERNEL_VECTOR(avx512, "avx512f,avx512dq", double, , kernel, __m512d, 8,
+    _mm512, pd)
+KERNEL_VECTOR(avx512, "avx512f,avx512dq", float, _f, kernel_float, __m512,
+    16, _mm512, ps)
+
+#endif /* KERNEL_X86 */
+
+static const struct kernel *kernel_selected;
+static const struct kernel_float *kernel_selected_float;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void
+kernel_init(void);
+
+const struct kernel *
+kernel_select(void)
+{
+
+	pthread_once(&kernel_once, kernel_init);
+
+	return kernel_selected;
+}
+
+const struct kernel_float *
+kernel_select_float(void)
+{
+
+	pthread_once(&kernel_once, kernel_init);
+
+	return kernel_selected_float;
+}
+
+/* Private functions */
+
+void
+kernel_init(void)
+{
+	const struct kernel *const *k;
+	const char *force;
+	size_t i;
+
+	/* Widest first */
+	static const struct kernel *const kernels[] = {
+#ifdef KERNEL_X86
+		&kernel_avx512,
+		&kernel_avx2,
+		&kernel_sse2,
+#endif
+		&kernel_scalar,
+		NULL
+	};
+	static const struct kernel_float *const kernels_float[] = {
+#ifdef KERNEL_X86
+		&kernel_avx512_f,
+		&kernel_avx2_f,
+		&kernel_sse2_f,
+#endif
+		&kernel_scalar_f,
+		NULL
+	};
+
+	force = getenv("EVALVAL_KERNEL");
+
+	for (k = kernels; *k != NULL; k++) {
+		if (force != NULL && strcmp(force, (*k)->name) != 0)
+			continue;
+#ifdef KERNEL_X86
+		__builtin_cpu_init();
+		if (*k == &kernel_avx512 &&
+		    (!__builtin_cpu_supports("avx512f") ||
+		     !__builtin_cpu_supports("avx512dq")))
+			continue;
+		if (*k == &kernel_avx2 && !__builtin_cpu_supports("avx2"))
+			continue;
+		if (*k == &kernel_sse2 && !__builtin_cpu_supports("sse2"))
+			continue;
+#endif
+		break;
+	}
+
+	/* Both tables list the same instruction sets in the same order */
+	if (*k == NULL)
+		k = &kernels[__arraycount(kernels) - 2];
+	i = (size_t)(k - kernels);
+	kernel_selected = kernels[i];
+	kernel_selected_float = kernels_float[i];
+
+	DPRINTF(("%s(): kernel=%s\n", __func__, kernel_selected->name));
+}
@@ -0,0 +1,83 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __EVALVAL_KERNEL_H__
+#define __EVALVAL_KERNEL_H__
+
+#include <stddef.h>
+
+/*
+ * Element-wise operations over contiguous arrays of doubles, used by the
+ * batch evaluator.  kernel_select() picks the widest implementation the CPU
+ * supports (AVX-512, AVX2, SSE2 or plain C) once per process; setting
+ * EVALVAL_KERNEL to one of those names forces a narrower one.  All of them
+ * round identically to the scalar evaluator.  The float operations of
+ * kernel_select_float() process twice as many elements per instruction.
+ */
+
+struct kernel {
+	const char	*name;
+	void		(*add)(double *, const double *, const double *,
+			    size_t);
+	void		(*sub)(double *, const double *, const double *,
+			    size_t);
+	void		(*mul)(double *, const double *, const double *,
+			    size_t);
+	void		(*div)(double *, const double *, const double *,
+			    size_t);
+	void		(*addk)(double *, const double *, double, size_t);
+	void		(*subk)(double *, const double *, double, size_t);
+	void		(*mulk)(double *, const double *, double, size_t);
+	void		(*divk)(double *, const double *, double, size_t);
+	void		(*neg)(double *, const double *, size_t);
+};
+
+struct kernel_float {
+	const char	*name;
+	void		(*add)(float *, const float *, const float *, size_t);
+	void		(*sub)(float *, const float *, const float *, size_t);
+	void		(*mul)(float *, const float *, const float *, size_t);
+	void		(*div)(float *, const float *, const float *, size_t);
+	void		(*addk)(float *, const float *, float, size_t);
+	void		(*subk)(float *, const float *, float, size_t);
+	void		(*mulk)(float *, const float *, float, size_t);
+	void		(*divk)(float *, const float *, float, size_t);
+	void		(*neg)(float *, const float *, size_t);
+};
+
+const struct kernel *
+kernel_select(void);
+
+/* The same instruction set as kernel_select() */
+const struct kernel_float *
+kernel_select_float(void);
+
+#endif /* __EVALVAL_KERNEL_H__ */
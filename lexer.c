@@ -0,0 +1,531 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <util.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LEXER_X86
+#include <immintrin.h>
+#endif
+
+#include "number.h"
+#include "token.h"
+
+#include "lexer.h"
+
+#ifdef DEBUG_LEXER
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+/* Bytes classified at once; one bit per byte in struct lexer_masks */
+#define LEXER_WINDOW	64
+
+/*
+ * Character classes, chosen so that each one is the AND of a property of
+ * the low nibble and one of the high nibble; the AVX2 and AVX-512
+ * classifiers look both up with a byte shuffle.
+ */
+#define LEXER_SPACE1	0x01		/* \t \n \v \f \r */
+#define LEXER_SPACE2	0x02		/* " " */
+#define LEXER_OP	0x04		/* + - * / ( ) */
+#define LEXER_DOT	0x08
+#define LEXER_DIGIT	0x10
+#define LEXER_ALPHA1	0x20		/* A-O a-o */
+#define LEXER_ALPHA2	0x40		/* P-Z p-z */
+#define LEXER_UNDERSCORE 0x80
+
+#define LEXER_WS	(LEXER_SPACE1 | LEXER_SPACE2)
+#define LEXER_NUM	(LEXER_DIGIT | LEXER_DOT)
+#define LEXER_NAME	(LEXER_DIGIT | LEXER_ALPHA1 | LEXER_ALPHA2 | \
+			 LEXER_UNDERSCORE)
+
+#define LEXER_LO_0	(LEXER_SPACE2 | LEXER_DIGIT | LEXER_ALPHA2)
+#define LEXER_LO_1_7	(LEXER_DIGIT | LEXER_ALPHA1 | LEXER_ALPHA2)
+#define LEXER_LO_8	(LEXER_LO_1_7 | LEXER_OP)
+#define LEXER_LO_9	(LEXER_LO_1_7 | LEXER_OP | LEXER_SPACE1)
+#define LEXER_LO_A	(LEXER_SPACE1 | LEXER_OP | LEXER_ALPHA1 | LEXER_ALPHA2)
+#define LEXER_LO_B	(LEXER_SPACE1 | LEXER_OP | LEXER_ALPHA1)
+#define LEXER_LO_C	(LEXER_SPACE1 | LEXER_ALPHA1)
+#define LEXER_LO_D	(LEXER_SPACE1 | LEXER_OP | LEXER_ALPHA1)
+#define LEXER_LO_E	(LEXER_DOT | LEXER_ALPHA1)
+#define LEXER_LO_F	(LEXER_OP | LEXER_ALPHA1 | LEXER_UNDERSCORE)
+
+#define LEXER_HI_0	LEXER_SPACE1
+#define LEXER_HI_2	(LEXER_SPACE2 | LEXER_OP | LEXER_DOT)
+#define LEXER_HI_3	LEXER_DIGIT
+#define LEXER_HI_4	LEXER_ALPHA1
+#define LEXER_HI_5	(LEXER_ALPHA2 | LEXER_UNDERSCORE)
+#define LEXER_HI_6	LEXER_ALPHA1
+#define LEXER_HI_7	LEXER_ALPHA2
+
+#define LEXER_LO_TABLE							\
+	LEXER_LO_0, LEXER_LO_1_7, LEXER_LO_1_7, LEXER_LO_1_7,		\
+	LEXER_LO_1_7, LEXER_LO_1_7, LEXER_LO_1_7, LEXER_LO_1_7,		\
+	LEXER_LO_8, LEXER_LO_9, LEXER_LO_A, LEXER_LO_B,			\
+	LEXER_LO_C, LEXER_LO_D, LEXER_LO_E, (char)LEXER_LO_F
+
+#define LEXER_HI_TABLE							\
+	LEXER_HI_0, 0, LEXER_HI_2, LEXER_HI_3,				\
+	LEXER_HI_4, (char)LEXER_HI_5, LEXER_HI_6, LEXER_HI_7,		\
+	0, 0, 0, 0, 0, 0, 0, 0
+
+struct lexer_masks {
+	uint64_t	ws;
+	uint64_t	op;
+	uint64_t	num;		/* may start a number */
+	uint64_t	name;		/* may continue a name */
+};
+
+struct lexer_classifier {
+	const char	*name;
+	void		(*classify)(const unsigned char *,
+			    struct lexer_masks *);
+};
+
+struct lexer {
+	const struct lexer_classifier *classifier;
+	struct token	*tokens;
+	size_t		 ntokens;
+	size_t		 size;
+};
+
+static void
+lexer_init(void);
+
+static void
+lexer_window(struct lexer *this, const unsigned char *s, size_t len,
+             size_t base, struct lexer_masks *m);
+
+static struct token *
+lexer_push(struct lexer *this, enum token_type type, size_t offset);
+
+static void
+lexer_classify_scalar(const unsigned char *s, struct lexer_masks *m);
+
+#ifdef LEXER_X86
+static void
+lexer_classify_sse42(const unsigned char *s, struct lexer_masks *m);
+
+static void
+lexer_classify_avx2(const unsigned char *s, struct lexer_masks *m);
+
+static void
+lexer_classify_avx512(const unsigned char *s, struct lexer_masks *m);
+#endif
+
+static const struct lexer_classifier lexer_scalar = {
+	"scalar", lexer_classify_scalar
+};
+
+#ifdef LEXER_X86
+static const struct lexer_classifier lexer_sse42 = {
+	"sse4.2", lexer_classify_sse42
+};
+
+static const struct lexer_classifier lexer_avx2 = {
+	"avx2", lexer_classify_avx2
+};
+
+static const struct lexer_classifier lexer_avx512 = {
+	"avx512", lexer_classify_avx512
+};
+#endif
+
+static const struct lexer_classifier *lexer_selected;
+static pthread_once_t lexer_once = PTHREAD_ONCE_INIT;
+static unsigned char lexer_class[256];
+
+struct lexer *
+lexer_new(void)
+{
+	struct lexer *this;
+
+	pthread_once(&lexer_once, lexer_init);
+
+	this = ecalloc(1, sizeof(*this));
+	this->classifier = lexer_selected;
+
+	return this;
+}
+
+void
+lexer_delete(struct lexer *this)
+{
+
+	assert(this);
+
+	free(this->tokens);
+	free(this);
+}
+
+size_t
+lexer_scan(struct lexer *this, const char *text, size_t len,
+           const struct token **tokens)
+{
+	const unsigned char *s;
+	struct lexer_masks m;
+	struct token *t;
+	uint64_t rest, bit;
+	size_t base, p, n;
+	double v;
+
+	assert(this);
+	assert(text || len == 0);
+	assert(tokens);
+
+	s = (const unsigned char *)text;
+	this->ntokens = 0;
+
+	/* A new window starts at the first byte past the current one */
+	base = 0;
+	if (len > 0)
+		lexer_window(this, s, len, base, &m);
+
+	for (p = 0;;) {
+		if (p >= len) {
+			lexer_push(this, token_type_eot, len);
+			break;
+		}
+		if (p - base >= LEXER_WINDOW) {
+			base = p;
+			lexer_window(this, s, len, base, &m);
+		}
+
+		/* Whitespace: to the first clear bit, or the next window */
+		rest = ~m.ws >> (p - base);
+		if (rest == 0) {
+			p = base + LEXER_WINDOW;
+			continue;
+		}
+		p += (size_t)__builtin_ctzll(rest);
+		if (p >= len)
+			continue;
+		bit = (uint64_t)1 << (p - base);
+
+		if (m.op & bit) {
+			switch (s[p]) {
+			case '+':
+				lexer_push(this, token_type_plus, p);
+				break;
+			case '-':
+				lexer_push(this, token_type_minus, p);
+				break;
+			case '*':
+				lexer_push(this, token_type_mul, p);
+				break;
+			case '/':
+				lexer_push(this, token_type_div, p);
+				break;
+			case '(':
+				lexer_push(this, token_type_openparen, p);
+				break;
+			default:
+				lexer_push(this, token_type_closeparen, p);
+				break;
+			}
+			p++;
+		} else if (m.num & bit) {
+			n = number_scan(text + p, len - p, &v);
+			if (n == 0) {
+				lexer_push(this, token_type_error, p);
+				break;
+			}
+			t = lexer_push(this, token_type_number, p);
+			t->value = v;
+			p += n;
+		} else if (m.name & bit) {
+			/* Letters or "_"; digits were taken as a number */
+			n = p;
+			rest = ~m.name >> (p - base);
+			if (rest != 0) {
+				p += (size_t)__builtin_ctzll(rest);
+			} else {
+				p = base + LEXER_WINDOW;
+				while (p < len &&
+				    (lexer_class[s[p]] & LEXER_NAME))
+					p++;
+			}
+			if (p > len)
+				p = len;
+			t = lexer_push(this, token_type_variable, n);
+			t->name = text + n;
+			t->namelen = p - n;
+		} else if (s[p] == '\0') {
+			lexer_push(this, token_type_eot, p);
+			break;
+		} else {
+			lexer_push(this, token_type_error, p);
+			break;
+		}
+	}
+
+	DPRINTF(("%s(): len=%zu ntokens=%zu\n", __func__, len,
+	    this->ntokens));
+
+	*tokens = this->tokens;
+
+	return this->ntokens;
+}
+
+const char *
+lexer_name(struct lexer *this)
+{
+
+	assert(this);
+
+	return this->classifier->name;
+}
+
+/* Private functions */
+
+void
+lexer_init(void)
+{
+	const struct lexer_classifier *const *c;
+	const char *force;
+	const char *p;
+	int ch;
+
+	/* Widest first */
+	static const struct lexer_classifier *const classifiers[] = {
+#ifdef LEXER_X86
+		&lexer_avx512,
+		&lexer_avx2,
+		&lexer_sse42,
+#endif
+		&lexer_scalar,
+		NULL
+	};
+
+	/* Spelled out rather than <ctype.h>, which depends on the locale */
+	for (p = "\t\n\v\f\r"; *p != '\0'; p++)
+		lexer_class[(unsigned char)*p] = LEXER_SPACE1;
+	lexer_class[' '] = LEXER_SPACE2;
+	for (p = "+-*/()"; *p != '\0'; p++)
+		lexer_class[(unsigned char)*p] = LEXER_OP;
+	lexer_class['.'] = LEXER_DOT;
+	for (ch = '0'; ch <= '9'; ch++)
+		lexer_class[ch] = LEXER_DIGIT;
+	for (ch = 'A'; ch <= 'Z'; ch++) {
+		lexer_class[ch] = ch < 'P' ? LEXER_ALPHA1 : LEXER_ALPHA2;
+		lexer_class[ch - 'A' + 'a'] = lexer_class[ch];
+	}
+	lexer_class['_'] = LEXER_UNDERSCORE;
+
+	force = getenv("EVALVAL_LEXER");
+
+	for (c = classifiers; *c != NULL; c++) {
+		if (force != NULL && strcmp(force, (*c)->name) != 0)
+			continue;
+#ifdef LEXER_X86
+		__builtin_cpu_init();
+		if (*c == &lexer_avx512 &&
+		    (!__builtin_cpu_supports("avx512f") ||
+		     !__builtin_cpu_supports("avx512bw")))
+			continue;
+		if (*c == &lexer_avx2 && !__builtin_cpu_supports("avx2"))
+			continue;
+		if (*c == &lexer_sse42 && !__builtin_cpu_supports("sse4.2"))
+			continue;
+#endif
+		break;
+	}
+
+	lexer_selected = *c != NULL ? *c : &lexer_scalar;
+
+	DPRINTF(("%s(): classifier=%s\n", __func__, lexer_selected->name));
+}
+
+/*
+ * Classifies the window at base.  Near the end of the text it is copied
+ * into a zero-padded buffer: NUL belongs to no class, so scanning stops
+ * there without reading past the input.
+ */
+void
+lexer_window(struct lexer *this, const unsigned char *s, size_t len,
+             size_t base, struct lexer_masks *m)
+{
+	unsigned char pad[LEXER_WINDOW];
+
+	if (len - base >= LEXER_WINDOW) {
+		this->classifier->classify(s + base, m);
+	} else {
+		memset(pad, 0, sizeof(pad));
+		memcpy(pad, s + base, len - base);
+		this->classifier->classify(pad, m);
+	}
+}
+
+struct token *
+lexer_push(struct lexer *this, enum token_type type, size_t offset)
+{
+	struct token *t;
+
+	if (this->ntokens == this->size) {
+		this->size = this->size ? this->size * 2 : 64;
+		this->tokens = erealloc(this->tokens,
+		    this->size * sizeof(*this->tokens));
+	}
+
+	t = &this->tokens[this->ntokens++];
+	t->type = type;
+	t->offset = offset;
+
+	return t;
+}
+
+void
+lexer_classify_scalar(const unsigned char *s, struct lexer_masks *m)
+{
+	uint64_t bit;
+	unsigned char c;
+	size_t i;
+
+	memset(m, 0, sizeof(*m));
+
+	for (i = 0; i < LEXER_WINDOW; i++) {
+		c = lexer_class[s[i]];
+		bit = (uint64_t)1 << i;
+		if (c & LEXER_WS)
+			m->ws |= bit;
+		if (c & LEXER_OP)
+			m->op |= bit;
+		if (c & LEXER_NUM)
+			m->num |= bit;
+		if (c & LEXER_NAME)
+			m->name |= bit;
+	}
+}
+
+#ifdef LEXER_X86
+/*
+ * SSE4.2 string compares against each set.  They treat NUL as the end of
+ * the block, so bytes after one get no class; scanning stops at the NUL
+ * anyway.
+ */
+static void __attribute__((__target__("sse4.2")))
+lexer_classify_sse42(const unsigned char *s, struct lexer_masks *m)
+{
+	const __m128i ws = _mm_setr_epi8(' ', '\t', '\n', '\v', '\f', '\r',
+	    0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i op = _mm_setr_epi8('+', '-', '*', '/', '(', ')',
+	    0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i num = _mm_setr_epi8('0', '9', '.', '.',
+	    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i name = _mm_setr_epi8('a', 'z', 'A', 'Z', '0', '9',
+	    '_', '_', 0, 0, 0, 0, 0, 0, 0, 0);
+	__m128i v;
+	uint64_t shift;
+	size_t i;
+
+	memset(m, 0, sizeof(*m));
+
+	for (i = 0; i < LEXER_WINDOW; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(const void *)(s + i));
+		shift = i;
+#define LEXER_SSE42_MASK(set, mode)					\
+	((uint64_t)(uint32_t)_mm_cvtsi128_si32(_mm_cmpistrm((set), v,	\
+	    _SIDD_UBYTE_OPS | (mode) | _SIDD_BIT_MASK)) << shift)
+		m->ws |= LEXER_SSE42_MASK(ws, _SIDD_CMP_EQUAL_ANY);
+		m->op |= LEXER_SSE42_MASK(op, _SIDD_CMP_EQUAL_ANY);
+		m->num |= LEXER_SSE42_MASK(num, _SIDD_CMP_RANGES);
+		m->name |= LEXER_SSE42_MASK(name, _SIDD_CMP_RANGES);
+#undef LEXER_SSE42_MASK
+	}
+}
+
+static void __attribute__((__target__("avx2")))
+lexer_classify_avx2(const unsigned char *s, struct lexer_masks *m)
+{
+	const __m256i lo = _mm256_setr_epi8(LEXER_LO_TABLE, LEXER_LO_TABLE);
+	const __m256i hi = _mm256_setr_epi8(LEXER_HI_TABLE, LEXER_HI_TABLE);
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i v, c;
+	uint64_t shift;
+	size_t i;
+
+	memset(m, 0, sizeof(*m));
+
+	for (i = 0; i < LEXER_WINDOW; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(const void *)(s + i));
+		c = _mm256_and_si256(
+		    _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble)),
+		    _mm256_shuffle_epi8(hi,
+		    _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+		shift = i;
+#define LEXER_AVX2_MASK(bits)						\
+	((uint64_t)(uint32_t)~_mm256_movemask_epi8(_mm256_cmpeq_epi8(	\
+	    _mm256_and_si256(c, _mm256_set1_epi8((char)(bits))),	\
+	    zero)) << shift)
+		m->ws |= LEXER_AVX2_MASK(LEXER_WS);
+		m->op |= LEXER_AVX2_MASK(LEXER_OP);
+		m->num |= LEXER_AVX2_MASK(LEXER_NUM);
+		m->name |= LEXER_AVX2_MASK(LEXER_NAME);
+#undef LEXER_AVX2_MASK
+	}
+}
+
+static void __attribute__((__target__("avx512f,avx512bw")))
+lexer_classify_avx512(const unsigned char *s, struct lexer_masks *m)
+{
+	const __m512i lo = _mm512_broadcast_i32x4(_mm_setr_epi8(
+	    LEXER_LO_TABLE));
+	const __m512i hi = _mm512_broadcast_i32x4(_mm_setr_epi8(
+	    LEXER_HI_TABLE));
+	const __m512i nibble = _mm512_set1_epi8(0x0f);
+	__m512i v, c;
+
+	v = _mm512_loadu_si512((const void *)s);
+	c = _mm512_and_si512(
+	    _mm512_shuffle_epi8(lo, _mm512_and_si512(v, nibble)),
+	    _mm512_shuffle_epi8(hi,
+	    _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble)));
+
+	m->ws = _mm512_test_epi8_mask(c, _mm512_set1_epi8(LEXER_WS));
+	m->op = _mm512_test_epi8_mask(c, _mm512_set1_epi8(LEXER_OP));
+	m->num = _mm512_test_epi8_mask(c, _mm512_set1_epi8(LEXER_NUM));
+	m->name = _mm512_test_epi8_mask(c,
+	    _mm512_set1_epi8((char)LEXER_NAME));
+}
+#endif /* LEXER_X86 */
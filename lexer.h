@@ -0,0 +1,72 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef __EVALVAL_LEXER_H__
+#define __EVALVAL_LEXER_H__
+
+#include <stddef.h>
+
+#include "token.h"
+
+/*
+ * Splits a whole expression into tokens up front.  Input is classified 64
+ * bytes at a time into whitespace, operator, number and name bitmasks, so
+ * whitespace runs and names are skipped with a bit scan rather than byte by
+ * byte.  lexer_new() picks the widest classifier the CPU supports
+ * (AVX-512BW, AVX2, SSE4.2 or plain C) once per process; setting
+ * EVALVAL_LEXER to one of those names forces a narrower one.
+ */
+
+struct lexer;
+
+struct lexer *
+lexer_new(void);
+
+void
+lexer_delete(struct lexer *this);
+
+/*
+ * Tokenizes len bytes at text, which need not be NUL-terminated.  The
+ * tokens end with token_type_eot, at the end of the text or at a NUL byte,
+ * or with token_type_error at the first byte that starts no token.  The
+ * array is owned by the lexer and valid until the next call; names point
+ * into text.  Returns the number of tokens.
+ */
+size_t
+lexer_scan(struct lexer *this, const char *text, size_t len,
+           const struct token **tokens);
+
+/* The classifier in use: "avx512", "avx2", "sse4.2" or "scalar" */
+const char *
+lexer_name(struct lexer *this);
+
+#endif /* __EVALVAL_LEXER_H__ */
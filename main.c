@@ -34,53 +34,280 @@ __RCSID("$NetBSD$");
 
 #include <assert.h>
 #include <err.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <util.h>
 
-#include "my_getline.h"
+#include "cache.h"
+#include "calc.h"
+#include "catalog.h"
+#include "input.h"
+#include "output.h"
+#include "pipeline.h"
+#include "server.h"
+#include "stats.h"
 
-#include "astnode.h"
-#include "parser.h"
-#include "evaluator.h"
+static void
+usage(void) __dead;
+
+static const struct option longopts[] = {
+	{ "stats",	optional_argument,	NULL,	'S' },
+	{ NULL,		0,			NULL,	0 }
+};
+
+static struct output *out;
+static struct calc **calcs;
+static unsigned jobs;
+static enum input_framing framing;
+static struct catalog_builder *catalog;	/* -o: compile, do not evaluate */
+static struct stats *iostats;	/* reading and writing; NULL without --stats */
 
 static void
-calc(char *s)
+process(int fd)
 {
-	struct parser *p;
-	struct astnode *n;
-	struct evaluator *e;
-	double v;
+	struct input *in;
+	const char *line;
+	char buf[OUTPUT_MAXSIZE];
+	uint64_t t;
+	size_t len, n;
+
+	in = input_open(fd);
+	input_setframing(in, framing);
+
+	if (catalog != NULL) {
+		while (input_getline(in, &line, &len))
+			calc_compile(calcs[0], line, len, catalog);
+	} else if (jobs > 1) {
+		pipeline_run(in, out, calcs, jobs, iostats);
+	} else {
+		for (;;) {
+			STATS_START(iostats, t);
+			if (!input_getline(in, &line, &len))
+				break;
+			STATS_STOP(iostats, stats_phase_input, t);
+
+			n = calc_line(calcs[0], line, len, buf);
+
+			STATS_START(iostats, t);
+			output_write(out, buf, n);
+			STATS_STOP(iostats, stats_phase_output, t);
+
+			if (iostats != NULL)
+				stats_poll();
+		}
+	}
+
+	input_close(in);
+}
 
-	assert(s);
+static void
+cachereport(void)
+{
+	struct cache_stats st, total;
+	unsigned i;
 
-	p = parser_new();
-	n = parser_parse(p, s);
-	if (!n)
-		goto err1;
-	e = evaluator_singleton();
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < jobs; i++) {
+		cache_stats(calc_cache(calcs[i]), &st);
+		total.hits += st.hits;
+		total.misses += st.misses;
+		total.evictions += st.evictions;
+		total.uncacheable += st.uncacheable;
+	}
 
-	v = evaluator_eval(e, n);
+	fprintf(stderr, "cache: %" PRIu64 " hits, %" PRIu64 " misses, "
+	    "%" PRIu64 " evictions, %" PRIu64 " uncacheable\n",
+	    total.hits, total.misses, total.evictions, total.uncacheable);
+}
 
-	printf("%lf\n", v);
+static void
+rejectreport(void)
+{
+	uint64_t total;
+	unsigned i;
 
-	astnode_delete_tree(n);
+	total = 0;
+	for (i = 0; i < jobs; i++)
+		total += calc_rejected(calcs[i]);
 
-err1:
-	parser_delete(p);
+	if (total > 0)
+		fprintf(stderr, "%" PRIu64 " lines rejected\n", total);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-b | -f] [-q] [-C entries] [-j jobs] "
+	    "[-t type] [--stats[=json]] [file ...]\n", getprogname());
+	fprintf(stderr, "       %s [-b | -f] [-C entries] [-j jobs] [-t type] "
+	    "[--stats[=json]] [-l socket] [-p port]\n", getprogname());
+	fprintf(stderr, "       %s [-bq] -o catalog [file ...]\n",
+	    getprogname());
+	exit(EXIT_FAILURE);
 }
 
 int
 main(int argc, char **argv)
 {
-	char *line;
+	enum output_format format;
+	enum calc_type type;
+	struct server *server;
+	const char *errstr, *catalogpath, *path, *port;
+	size_t cachesize;
+	unsigned u;
+	int ch, fd, i, qflag, sflag;
+	enum stats_format sformat;
 
 	setprogname(argv[0]);
 
-	while ((line = my_getline(stdin)) != NULL) {
-		calc(line);
-		free(line);
+	format = output_format_shortest;
+	type = calc_type_auto;
+	cachesize = 0;
+	jobs = 1;
+	qflag = 0;
+	sflag = 0;
+	sformat = stats_format_text;
+	catalogpath = NULL;
+	path = NULL;
+	port = NULL;
+
+	while ((ch = getopt_long(argc, argv, "bC:fj:l:o:p:qt:", longopts,
+	    NULL)) != -1) {
+		switch (ch) {
+		case 'b':
+			/* Length-prefixed records in, binary records out */
+			format = output_format_binary;
+			framing = input_framing_records;
+			break;
+		case 'C':
+			cachesize = (size_t)strtonum(optarg, 1, 1 << 30,
+			    &errstr);
+			if (errstr != NULL)
+				errx(EXIT_FAILURE, "cache size is %s: %s",
+				    errstr, optarg);
+			break;
+		case 'f':
+			format = output_format_fixed;
+			break;
+		case 'j':
+			jobs = (unsigned)strtonum(optarg, 1, 1024, &errstr);
+			if (errstr != NULL)
+				errx(EXIT_FAILURE, "jobs is %s: %s", errstr,
+				    optarg);
+			break;
+		case 'l':
+			path = optarg;
+			break;
+		case 'o':
+			catalogpath = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'q':
+			/* Count malformed lines, report only the total */
+			qflag = 1;
+			break;
+		case 't':
+			if (!calc_parsetype(optarg, &type))
+				errx(EXIT_FAILURE, "unknown type: %s", optarg);
+			break;
+		case 'S':
+			sflag = 1;
+			if (optarg == NULL || strcmp(optarg, "text") == 0)
+				sformat = stats_format_text;
+			else if (strcmp(optarg, "json") == 0)
+				sformat = stats_format_json;
+			else
+				errx(EXIT_FAILURE, "unknown stats format: %s",
+				    optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if ((path != NULL || port != NULL) &&
+	    (argc > 0 || catalogpath != NULL || qflag))
+		usage();
+	if (framing == input_framing_records && format != output_format_binary)
+		usage();
+
+	out = output_new(STDOUT_FILENO, format);
+	if (catalogpath != NULL)
+		catalog = catalog_builder_new();
+
+	/* One evaluation context per worker, each with its own cache */
+	calcs = ecalloc(jobs, sizeof(*calcs));
+	for (u = 0; u < jobs; u++) {
+		calcs[u] = calc_new(format, cachesize);
+		calc_settype(calcs[u], type);
+		calc_setquiet(calcs[u], qflag);
 	}
 
+	if (sflag) {
+		stats_init(sformat);
+		iostats = stats_new();
+		for (u = 0; u < jobs; u++)
+			calc_setstats(calcs[u], stats_new());
+	}
+
+	if (path != NULL || port != NULL) {
+		/* Workers are the jobs, each with its own context */
+		server = server_new(calcs, jobs, framing);
+		if (path != NULL)
+			server_listen_unix(server, path);
+		if (port != NULL)
+			server_listen_tcp(server, port);
+		server_run(server);
+		server_delete(server);
+	} else if (argc == 0)
+		process(STDIN_FILENO);
+
+	for (i = 0; i < argc; i++) {
+		if (strcmp(argv[i], "-") == 0) {
+			process(STDIN_FILENO);
+			continue;
+		}
+		if ((fd = open(argv[i], O_RDONLY)) == -1)
+			err(EXIT_FAILURE, "%s", argv[i]);
+		process(fd);
+		close(fd);
+	}
+
+	output_delete(out);
+
+	if (catalog != NULL) {
+		if ((fd = open(catalogpath, O_WRONLY | O_CREAT | O_TRUNC,
+		    0666)) == -1)
+			err(EXIT_FAILURE, "%s", catalogpath);
+		if (catalog_builder_write(catalog, fd) == -1 ||
+		    close(fd) == -1)
+			err(EXIT_FAILURE, "%s", catalogpath);
+		catalog_builder_delete(catalog);
+	}
+
+	if (cachesize > 0)
+		cachereport();
+	if (qflag)
+		rejectreport();
+
+	if (sflag) {
+		stats_report(stderr);
+		stats_fini();
+	}
+
+	for (u = 0; u < jobs; u++)
+		calc_delete(calcs[u]);
+	free(calcs);
+
 	return EXIT_SUCCESS;
 }
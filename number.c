@@ -0,0 +1,350 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <float.h>
+#include <locale.h>
+#include <math.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <util.h>
+
+#include "number.h"
+
+#ifdef DEBUG_NUMBER
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+/* Significant digits that always fit in a uint64_t */
+#define NUMBER_MAXDIGITS	19
+
+/* Literals up to this length are copied to the stack for the slow path */
+#define NUMBER_BUFSIZE		64
+
+#define NUMBER_ISDIGIT(c)	((unsigned)((c) - '0') < 10)
+
+/* Powers of ten that are exactly representable as doubles */
+static const double number_pow10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+	1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+	1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static double
+number_slow(const char *s, size_t len);
+
+static size_t
+number_formatint(uint64_t m, int neg, size_t point, char *buf);
+
+static int
+number_roundtrips(int64_t m, size_t k, double v);
+
+size_t
+number_scan(const char *s, size_t len, double *val)
+{
+	uint64_t mantissa;
+	size_t i, ndigits;
+	long exp10, e;
+	int truncated, expneg;
+	int c;
+
+	assert(s || len == 0);
+	assert(val);
+
+	mantissa = 0;
+	ndigits = 0;
+	exp10 = 0;
+	truncated = 0;
+	i = 0;
+
+	/* Integer part; leading zeros are not significant */
+	while (i < len && s[i] == '0')
+		i++;
+	while (i < len && NUMBER_ISDIGIT(c = s[i])) {
+		if (ndigits < NUMBER_MAXDIGITS) {
+			mantissa = mantissa * 10 + (unsigned)(c - '0');
+			ndigits++;
+		} else {
+			truncated |= c != '0';
+			exp10++;
+		}
+		i++;
+	}
+
+	/* Fractional part */
+	if (i < len && s[i] == '.') {
+		i++;
+		if (ndigits == 0) {
+			while (i < len && s[i] == '0') {
+				exp10--;
+				i++;
+			}
+		}
+		while (i < len && NUMBER_ISDIGIT(c = s[i])) {
+			if (ndigits < NUMBER_MAXDIGITS) {
+				mantissa = mantissa * 10 + (unsigned)(c - '0');
+				ndigits++;
+				exp10--;
+			} else {
+				truncated |= c != '0';
+			}
+			i++;
+		}
+	}
+
+	/* A lone "." is not a number */
+	if (i == 0 || (i == 1 && s[0] == '.'))
+		return 0;
+
+	/* Exponent, only if it has at least one digit */
+	if (i + 1 < len && (s[i] == 'e' || s[i] == 'E')) {
+		size_t j = i + 1;
+
+		expneg = 0;
+		if (s[j] == '+' || s[j] == '-') {
+			expneg = s[j] == '-';
+			j++;
+		}
+		if (j < len && NUMBER_ISDIGIT(s[j])) {
+			e = 0;
+			while (j < len && NUMBER_ISDIGIT(c = s[j])) {
+				/* Saturate, the result is 0 or inf anyway */
+				if (e < 100000)
+					e = e * 10 + (c - '0');
+				j++;
+			}
+			exp10 += expneg ? -e : e;
+			i = j;
+		}
+	}
+
+	DPRINTF(("%s(): mantissa=%" PRIu64 " exp10=%ld truncated=%d\n",
+	    __func__, mantissa, exp10, truncated));
+
+	if (mantissa == 0) {
+		*val = 0;
+		return i;
+	}
+
+	/*
+	 * Clinger's fast path: when the mantissa and the power of ten are
+	 * both exact doubles, a single multiplication or division rounds
+	 * correctly.  This needs arithmetic in double precision proper.
+	 */
+	if (!truncated && mantissa <= (UINT64_C(1) << DBL_MANT_DIG)) {
+		if (exp10 == 0) {
+			*val = (double)mantissa;
+			return i;
+		}
+#if FLT_EVAL_METHOD == 0
+		if (exp10 > 0 && exp10 < (long)__arraycount(number_pow10)) {
+			*val = (double)mantissa * number_pow10[exp10];
+			return i;
+		}
+		if (exp10 < 0 && -exp10 < (long)__arraycount(number_pow10)) {
+			*val = (double)mantissa / number_pow10[-exp10];
+			return i;
+		}
+#endif
+	}
+
+	*val = number_slow(s, i);
+
+	return i;
+}
+
+size_t
+number_format(double v, char *buf)
+{
+	double a, m;
+	int64_t im;
+	size_t k, n;
+	int prec, d;
+
+	assert(buf);
+
+	if (isnan(v)) {
+		memcpy(buf, "nan", 3);
+		return 3;
+	}
+	if (isinf(v)) {
+		if (v < 0) {
+			memcpy(buf, "-inf", 4);
+			return 4;
+		}
+		memcpy(buf, "inf", 3);
+		return 3;
+	}
+	if (v == 0) {
+		if (signbit(v)) {
+			memcpy(buf, "-0", 2);
+			return 2;
+		}
+		buf[0] = '0';
+		return 1;
+	}
+
+	a = fabs(v);
+
+	/*
+	 * Fast path: look for the fewest fractional digits k such that an
+	 * integer m < 2^53 gives m / 10^k == v.  That is exactly how
+	 * number_scan() would read the digits back, so the result is the
+	 * shortest fixed-point form that round-trips.  m is computed in
+	 * floating point and may be off by one, so neighbours are tried too.
+	 * Like %g, values below 1e-4 use exponential notation instead.
+	 */
+	for (k = 0; a >= 1e-4 && k < __arraycount(number_pow10); k++) {
+		m = nearbyint(a * number_pow10[k]);
+		if (m >= (double)(UINT64_C(1) << DBL_MANT_DIG))
+			break;
+		im = (int64_t)m;
+		for (d = 0; d <= 2; d++) {
+			/* Try m, m - 1 and m + 1 in that order */
+			int64_t c = im + (d == 0 ? 0 : (d == 1 ? -1 : 1));
+
+			if (c > 0 && number_roundtrips(c, k, a))
+				return number_formatint((uint64_t)c, v < 0, k,
+				    buf);
+		}
+	}
+
+	/*
+	 * Very large, very small or 17-digit values.  Every double has a
+	 * round-tripping form with 15 to 17 digits, except subnormals, which
+	 * can need fewer.
+	 */
+	prec = fpclassify(v) == FP_SUBNORMAL ? 1 : DBL_DIG;
+	for (; prec <= DBL_DECIMAL_DIG; prec++) {
+		n = (size_t)snprintf(buf, NUMBER_FORMATSIZE, "%.*g", prec, v);
+		assert(n < NUMBER_FORMATSIZE);
+		if (number_scan(v < 0 ? buf + 1 : buf, v < 0 ? n - 1 : n,
+		    &m) != 0 && m == a)
+			break;
+	}
+
+	return n;
+}
+
+/* Private functions */
+
+int
+number_roundtrips(int64_t m, size_t k, double v)
+{
+
+#if FLT_EVAL_METHOD == 0
+	return (double)m / number_pow10[k] == v;
+#else
+	char buf[NUMBER_FORMATSIZE];
+	double rv;
+	size_t n;
+
+	n = number_formatint((uint64_t)m, 0, k, buf);
+	return number_scan(buf, n, &rv) == n && rv == v;
+#endif
+}
+
+/*
+ * Writes m / 10^point in fixed-point notation with trailing fractional
+ * zeros removed.
+ */
+size_t
+number_formatint(uint64_t m, int neg, size_t point, char *buf)
+{
+	char digits[NUMBER_FORMATSIZE];
+	size_t nd, n, i;
+
+	while (point > 0 && m % 10 == 0) {
+		m /= 10;
+		point--;
+	}
+
+	nd = 0;
+	do {
+		digits[nd++] = (char)('0' + m % 10);
+		m /= 10;
+	} while (m != 0);
+
+	n = 0;
+	if (neg)
+		buf[n++] = '-';
+	if (nd <= point) {
+		/* 0.000ddd */
+		buf[n++] = '0';
+		buf[n++] = '.';
+		for (i = nd; i < point; i++)
+			buf[n++] = '0';
+		point = 0;
+	}
+	while (nd > 0) {
+		if (nd == point)
+			buf[n++] = '.';
+		buf[n++] = digits[--nd];
+	}
+
+	assert(n <= NUMBER_FORMATSIZE);
+
+	return n;
+}
+
+/*
+ * Long mantissas and large exponents go through strtod(3) in the C locale,
+ * which rounds correctly but needs a NUL-terminated copy.
+ */
+double
+number_slow(const char *s, size_t len)
+{
+	char buffer[NUMBER_BUFSIZE];
+	char *p;
+	double rv;
+
+	if (len < sizeof(buffer))
+		p = buffer;
+	else
+		p = emalloc(len + 1);
+
+	memcpy(p, s, len);
+	p[len] = '\0';
+
+	rv = strtod_l(p, NULL, LC_C_LOCALE);
+
+	if (p != buffer)
+		free(p);
+
+	return rv;
+}
@@ -0,0 +1,63 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __EVALVAL_NUMBER_H__
+#define __EVALVAL_NUMBER_H__
+
+#include <stddef.h>
+
+/*
+ * Scans a decimal literal of the form
+ *
+ *	digits [ "." [ digits ] ] [ ("e" | "E") [ "+" | "-" ] digits ]
+ *	| "." digits [ ("e" | "E") [ "+" | "-" ] digits ]
+ *
+ * from the first len bytes at s and stores the correctly rounded double in
+ * *val.  The input need not be NUL-terminated and is not locale dependent.
+ * Returns the number of bytes consumed, or 0 if s does not start with a
+ * literal.
+ */
+size_t
+number_scan(const char *s, size_t len, double *val);
+
+/* Enough for any output of number_format(), without a terminating NUL */
+#define NUMBER_FORMATSIZE	32
+
+/*
+ * Formats v as the shortest decimal string that number_scan() reads back as
+ * exactly v, e.g. "0.1", "-42" or "1e+300", plus "inf", "-inf" and "nan".
+ * Writes at most NUMBER_FORMATSIZE bytes to buf, without a NUL, and returns
+ * the number of bytes written.
+ */
+size_t
+number_format(double v, char *buf);
+
+#endif /* __EVALVAL_NUMBER_H__ */
@@ -0,0 +1,258 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <util.h>
+
+#include "astnode.h"
+
+#include "optimizer.h"
+
+#ifdef DEBUG_OPTIMIZER
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+/* Nodes on the explicit stack of optimizer_optimize() */
+struct optimizer_frame {
+	struct astnode	*node;
+	int		 visited;	/* operands already optimized */
+};
+
+static struct astnode *
+optimizer_unary(struct astnode_table *nodes, struct astnode *n,
+                struct astnode *l);
+
+static struct astnode *
+optimizer_binary(struct astnode_table *nodes, struct astnode *n,
+                 struct astnode *l, struct astnode *r);
+
+static struct astnode *
+optimizer_negate(struct astnode_table *nodes, struct astnode *n);
+
+static int
+optimizer_isconst(struct astnode *n, double v);
+
+static double
+optimizer_fold(enum astnode_type type, double v1, double v2);
+
+/*
+ * Post-order walk with an explicit stack: each node is rewritten once its
+ * operands have been, their results being on top of the result stack.
+ */
+struct astnode *
+optimizer_optimize(struct astnode_table *nodes, struct astnode *n)
+{
+	struct optimizer_frame *frames;
+	struct optimizer_frame *f;
+	struct astnode **results;
+	struct astnode *l, *r;
+	size_t nframes, nresults, size;
+
+	assert(nodes);
+	assert(n);
+
+	size = 64;
+	frames = emalloc(size * sizeof(*frames));
+	results = emalloc(size * sizeof(*results));
+	nframes = 0;
+	nresults = 0;
+	frames[nframes].node = n;
+	frames[nframes++].visited = 0;
+
+	while (nframes > 0) {
+		if (nframes == size || nresults == size) {
+			size *= 2;
+			frames = erealloc(frames, size * sizeof(*frames));
+			results = erealloc(results, size * sizeof(*results));
+		}
+		f = &frames[nframes - 1];
+		n = f->node;
+
+		switch (astnode_type(n)) {
+		case astnode_type_number:
+		case astnode_type_variable:
+			results[nresults++] = n;
+			nframes--;
+			break;
+		case astnode_type_unaryminus:
+			if (f->visited++ == 0) {
+				frames[nframes].node = astnode_left(n);
+				frames[nframes++].visited = 0;
+				break;
+			}
+			l = results[nresults - 1];
+			results[nresults - 1] = optimizer_unary(nodes, n, l);
+			nframes--;
+			break;
+		default:
+			if (f->visited < 2) {
+				frames[nframes].node = f->visited++ == 0 ?
+				    astnode_left(n) : astnode_right(n);
+				frames[nframes++].visited = 0;
+				break;
+			}
+			r = results[--nresults];
+			l = results[nresults - 1];
+			results[nresults - 1] =
+			    optimizer_binary(nodes, n, l, r);
+			nframes--;
+			break;
+		}
+	}
+
+	assert(nresults == 1);
+	n = results[0];
+
+	free(frames);
+	free(results);
+
+	return n;
+}
+
+/* Private functions */
+
+/* -l for the optimized operand l of n */
+struct astnode *
+optimizer_unary(struct astnode_table *nodes, struct astnode *n,
+                struct astnode *l)
+{
+
+	if (l == astnode_left(n) && astnode_type(l) != astnode_type_number &&
+	    astnode_type(l) != astnode_type_unaryminus)
+		return n;
+
+	return optimizer_negate(nodes, l);
+}
+
+/* Returns -n for an already optimized n */
+struct astnode *
+optimizer_negate(struct astnode_table *nodes, struct astnode *n)
+{
+
+	/* -c */
+	if (astnode_type(n) == astnode_type_number)
+		return astnode_table_numbernode(nodes, -astnode_value(n));
+
+	/* --x => x */
+	if (astnode_type(n) == astnode_type_unaryminus)
+		return astnode_left(n);
+
+	return astnode_table_unarynode(nodes, n);
+}
+
+/* l op r for the optimized operands l and r of n */
+struct astnode *
+optimizer_binary(struct astnode_table *nodes, struct astnode *n,
+                 struct astnode *l, struct astnode *r)
+{
+	enum astnode_type type;
+
+	type = astnode_type(n);
+
+	/* c1 op c2, including division by zero */
+	if (astnode_type(l) == astnode_type_number &&
+	    astnode_type(r) == astnode_type_number) {
+		DPRINTF(("%s(): fold node=%p\n", __func__, n));
+		return astnode_table_numbernode(nodes, optimizer_fold(type,
+		    astnode_value(l), astnode_value(r)));
+	}
+
+	switch (type) {
+	case astnode_type_plus:
+		/* x + -0 => x, -0 + x => x; but x + 0 is +0 for x = -0 */
+		if (optimizer_isconst(r, -0.0))
+			return l;
+		if (optimizer_isconst(l, -0.0))
+			return r;
+		break;
+	case astnode_type_minus:
+		/* x - 0 => x */
+		if (optimizer_isconst(r, 0.0))
+			return l;
+		break;
+	case astnode_type_mul:
+	case astnode_type_div:
+		/* x * 1 => x, x / 1 => x, 1 * x => x */
+		if (optimizer_isconst(r, 1.0))
+			return l;
+		if (type == astnode_type_mul && optimizer_isconst(l, 1.0))
+			return r;
+		break;
+	default:
+		abort();
+	}
+
+	if (l == astnode_left(n) && r == astnode_right(n))
+		return n;
+
+	return astnode_table_node(nodes, type, l, r);
+}
+
+/* Compares bit patterns, so 0 and -0 are told apart */
+int
+optimizer_isconst(struct astnode *n, double v)
+{
+	double nv;
+
+	if (astnode_type(n) != astnode_type_number)
+		return 0;
+
+	nv = astnode_value(n);
+
+	return memcmp(&nv, &v, sizeof(v)) == 0;
+}
+
+/* The same operations the evaluator performs at run time */
+double
+optimizer_fold(enum astnode_type type, double v1, double v2)
+{
+
+	switch (type) {
+	case astnode_type_plus:
+		return v1 + v2;
+	case astnode_type_minus:
+		return v1 - v2;
+	case astnode_type_mul:
+		return v1 * v2;
+	case astnode_type_div:
+		return v1 / v2;
+	default:
+		abort();
+	}
+}
@@ -0,0 +1,56 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __EVALVAL_OPTIMIZER_H__
+#define __EVALVAL_OPTIMIZER_H__
+
+/*
+ * Simplifies a tree before it is evaluated or compiled: constant subtrees
+ * are folded and identities such as x*1, x/1, x-0 and --x are removed.
+ * Only rewrites that give the same IEEE result for every input, including
+ * infinities, NaN and signed zeros, are applied, so x+0 and x*0 are kept.
+ * A NaN keeps its sign and payload as well: x*-1 and x + -y are kept too,
+ * as -x and x - y would flip the sign of a NaN x or y.
+ *
+ * The input is not modified.  New nodes are built through nodes, the table
+ * the input was built with, so the result is a DAG like the input: a
+ * rewritten subexpression that turns out equal to another one is the same
+ * node, numbered by astnode_id() if used more than once.  Unchanged
+ * subtrees are shared with the input, so the result must not outlive it.
+ */
+
+struct astnode;
+struct astnode_table;
+
+struct astnode *
+optimizer_optimize(struct astnode_table *nodes, struct astnode *n);
+
+#endif /* __EVALVAL_OPTIMIZER_H__ */
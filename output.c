@@ -0,0 +1,226 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/endian.h>
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <float.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <util.h>
+
+#include "number.h"
+
+#include "output.h"
+
+#ifdef DEBUG_OUTPUT
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+#define OUTPUT_BUFSIZE	(64 * 1024)
+
+struct output {
+	int			 fd;
+	enum output_format	 format;
+	int			 linebuffered;
+	size_t			 used;
+	char			 buf[OUTPUT_BUFSIZE];
+};
+
+static void
+output_writeall(struct output *this, const char *buf, size_t len);
+
+struct output *
+output_new(int fd, enum output_format format)
+{
+	struct output *this;
+
+	this = emalloc(sizeof(*this));
+
+	this->fd = fd;
+	this->format = format;
+	this->linebuffered = isatty(fd);
+	this->used = 0;
+
+	return this;
+}
+
+void
+output_delete(struct output *this)
+{
+
+	assert(this);
+
+	output_flush(this);
+	free(this);
+}
+
+void
+output_double(struct output *this, double v)
+{
+
+	assert(this);
+
+	if (sizeof(this->buf) - this->used < OUTPUT_MAXSIZE)
+		output_flush(this);
+
+	this->used += output_formatdouble(this->format, v,
+	    &this->buf[this->used]);
+
+	if (this->linebuffered)
+		output_flush(this);
+}
+
+void
+output_write(struct output *this, const char *buf, size_t len)
+{
+
+	assert(this);
+	assert(buf || len == 0);
+
+	if (sizeof(this->buf) - this->used < len) {
+		output_flush(this);
+		/* Large chunks bypass the buffer */
+		if (len >= sizeof(this->buf)) {
+			output_writeall(this, buf, len);
+			return;
+		}
+	}
+
+	memcpy(&this->buf[this->used], buf, len);
+	this->used += len;
+
+	if (this->linebuffered)
+		output_flush(this);
+}
+
+void
+output_flush(struct output *this)
+{
+
+	assert(this);
+
+	DPRINTF(("%s(): output=%p used=%zu\n", __func__, this, this->used));
+
+	output_writeall(this, this->buf, this->used);
+	this->used = 0;
+}
+
+size_t
+output_formatdouble(enum output_format format, double v, char *buf)
+{
+	uint64_t bits;
+	size_t n;
+
+	assert(buf);
+
+	switch (format) {
+	case output_format_binary:
+		memcpy(&bits, &v, sizeof(bits));
+		buf[0] = 0;
+		le64enc(&buf[1], bits);
+		return OUTPUT_RECORDSIZE;
+	case output_format_fixed:
+		/* "%f" of -DBL_MAX is 317 bytes */
+		n = (size_t)snprintf(buf, OUTPUT_MAXSIZE, "%f", v);
+		break;
+	case output_format_shortest:
+	default:
+		n = number_format(v, buf);
+		break;
+	}
+	buf[n++] = '\n';
+
+	return n;
+}
+
+size_t
+output_formatint64(enum output_format format, int64_t v, char *buf)
+{
+	size_t n;
+
+	assert(buf);
+
+	if (format == output_format_binary ||
+	    (v >= -(INT64_C(1) << DBL_MANT_DIG) &&
+	     v <= INT64_C(1) << DBL_MANT_DIG))
+		return output_formatdouble(format, (double)v, buf);
+
+	n = (size_t)snprintf(buf, OUTPUT_MAXSIZE,
+	    format == output_format_fixed ? "%" PRId64 ".000000" :
+	    "%" PRId64, v);
+	buf[n++] = '\n';
+
+	return n;
+}
+
+size_t
+output_formaterror(int status, uint64_t offset, char *buf)
+{
+
+	assert(status > 0 && status <= UINT8_MAX);
+	assert(buf);
+
+	buf[0] = (char)status;
+	le64enc(&buf[1], offset);
+
+	return OUTPUT_RECORDSIZE;
+}
+
+/* Private functions */
+
+void
+output_writeall(struct output *this, const char *buf, size_t len)
+{
+	size_t off;
+	ssize_t rv;
+
+	for (off = 0; off < len; off += (size_t)rv) {
+		rv = write(this->fd, &buf[off], len - off);
+		if (rv == -1) {
+			if (errno == EINTR) {
+				rv = 0;
+				continue;
+			}
+			err(EXIT_FAILURE, "write");
+		}
+	}
+}
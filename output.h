@@ -0,0 +1,97 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __EVALVAL_OUTPUT_H__
+#define __EVALVAL_OUTPUT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Buffered result writer.  Results are formatted straight into a large
+ * buffer that is written out with write(2) in blocks; output to a terminal
+ * is flushed after every line.
+ */
+
+enum output_format {
+	output_format_shortest,		/* number_format(), round-trips */
+	output_format_fixed,		/* printf("%f"), 6 decimal places */
+	output_format_binary		/* fixed-size records, see below */
+};
+
+/* Enough for any result formatted by output_formatdouble(), plus newline */
+#define OUTPUT_MAXSIZE	512
+
+/*
+ * A binary record is a status byte followed by 8 little-endian bytes: 0
+ * and the IEEE 754 double result, or an enum evalval_error and the byte
+ * offset of the error in the expression as an unsigned integer.
+ */
+#define OUTPUT_RECORDSIZE	9
+
+struct output;
+
+struct output *
+output_new(int fd, enum output_format format);
+
+void
+output_delete(struct output *this);
+
+void
+output_double(struct output *this, double v);
+
+void
+output_write(struct output *this, const char *buf, size_t len);
+
+void
+output_flush(struct output *this);
+
+/*
+ * Formats v followed by a newline, or a binary record, into buf, which
+ * must have room for OUTPUT_MAXSIZE bytes, and returns the length.  No NUL
+ * is written.
+ */
+size_t
+output_formatdouble(enum output_format format, double v, char *buf);
+
+/*
+ * The same for an integer result: values that doubles hold exactly are
+ * formatted as by output_formatdouble(), larger ones in full, with all
+ * their digits.  Binary records can only carry the nearest double.
+ */
+size_t
+output_formatint64(enum output_format format, int64_t v, char *buf);
+
+/* Formats the binary record of a rejected expression, see above */
+size_t
+output_formaterror(int status, uint64_t offset, char *buf);
+
+#endif /* __EVALVAL_OUTPUT_H__ */
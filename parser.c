@@ -33,14 +33,16 @@
 __RCSID("$NetBSD$");
 
 #include <assert.h>
-#include <ctype.h>
-#include <setjmp.h>
+#include <float.h>
+#include <stdint.h>
 #include <stdlib.h>
-#include <stdio.h>
 #include <string.h>
 #include <util.h>
 
+#include "arena.h"
 #include "astnode.h"
+#include "lexer.h"
+#include "stats.h"
 #include "token.h"
 
 #include "parser.h"
@@ -62,8 +64,11 @@ term =
     | term "/" factor .
 factor = 
     number
+    | variable
     | - expression
     | "(" expression ")" .
+variable =
+    (letter | "_") { letter | digit | "_" } .
 
 => Left recursion elimination http://web.cs.wpi.edu/~kal/PLT/PLT4.1.2.html
 
@@ -85,50 +90,97 @@ term1 =
 
 factor = 
     number
+    | variable
     | - expression
     | "(" expression ")"
+
+which parser_expression() recognizes by operator precedence rather than by
+recursive descent:
+
+expression =
+    operand { ("+" | "-" | "*" | "/") operand }
+
+operand =
+    { "-" | "(" } (number | variable) { ")" }
+
+Pending operators and operands live on explicit stacks that grow with the
+input, so neither deep nesting nor long operator chains consume C stack.
+An operator is applied as soon as one of lower or equal precedence
+follows, which keeps "+" "-" and "*" "/" left-associative; unary minus
+binds tighter than any binary operator, as in the factor rule.
 */
 
+/* Operators waiting on the stack in parser_expression() */
+enum parser_op {
+	parser_op_paren,
+	parser_op_plus,
+	parser_op_minus,
+	parser_op_mul,
+	parser_op_div,
+	parser_op_neg
+};
+
 struct parser {
-	struct token	 token;
-	char 		*text;
-	size_t 		 index;
-	jmp_buf		 jmpbuf;
+	const struct token *token;
+	struct lexer	*lexer;
+	const struct token *tokens;
+	size_t		 ntokens;
+	size_t		 next;
+	struct arena	*arena;
+	struct astnode_table *nodes;
+	char		**vars;
+	size_t		*varoffsets;
+	size_t		 nvars;
+	size_t		 varssize;
+	struct astnode	**operands;
+	size_t		 noperands;
+	size_t		 operandssize;
+	enum parser_op	*ops;
+	size_t		 nops;
+	size_t		 opssize;
+	struct stats	*stats;
+	enum parser_error error;
+	size_t		 erroroffset;
+	int		 integral;	/* see parser_integral() */
 };
 
-static void
+static int
 parser_getnexttoken(struct parser *this);
 
-static void
-parser_skipwhitespace(struct parser *this);
+static struct astnode *
+parser_fail(struct parser *this, enum parser_error error);
 
-static double
-parser_getnumber(struct parser *this);
+static size_t
+parser_lookupvariable(struct parser *this, const char *name, size_t len,
+                      size_t offset);
 
 static struct astnode *
 parser_expression(struct parser *this);
 
-static struct astnode *
-parser_expression1(struct parser *this);
+static void
+parser_pushoperand(struct parser *this, struct astnode *n);
 
-static struct astnode *
-parser_term(struct parser *this);
+static void
+parser_pushop(struct parser *this, enum parser_op op);
 
-static struct astnode *
-parser_term1(struct parser *this);
+static void
+parser_reduce(struct parser *this, int precedence);
+
+static int
+parser_precedence(enum parser_op op);
 
 static struct astnode *
-parser_factor(struct parser *this);
+parser_new_node(struct parser *this, enum astnode_type type,
+                struct astnode *left, struct astnode *right);
 
 static struct astnode *
-parser_new_node(enum astnode_type type, struct astnode *left,
-                struct astnode *right);
+parser_new_unarynode(struct parser *this, struct astnode *left);
 
 static struct astnode *
-parser_new_unarynode(struct astnode *left);
+parser_new_numbernode(struct parser *this, double val);
 
 static struct astnode *
-parser_new_numbernode(double val);
+parser_new_variablenode(struct parser *this, size_t index);
 
 struct parser *
 parser_new(void)
@@ -136,6 +188,9 @@ parser_new(void)
 	struct parser *this;
 
 	this = ecalloc(1, sizeof(*this));
+	this->arena = arena_new();
+	this->nodes = astnode_table_new(this->arena);
+	this->lexer = lexer_new();
 
 	return this;
 }
@@ -146,252 +201,411 @@ parser_delete(struct parser *this)
 
 	assert(this);
 
-	free(this->text);
+	astnode_table_delete(this->nodes);
+	arena_delete(this->arena);
+	lexer_delete(this->lexer);
+	free(this->vars);
+	free(this->varoffsets);
+	free(this->operands);
+	free(this->ops);
 	free(this);
 }
 
+void
+parser_reset(struct parser *this)
+{
+
+	assert(this);
+
+	astnode_table_reset(this->nodes);
+	arena_reset(this->arena);
+	this->nvars = 0;
+	this->noperands = 0;
+	this->nops = 0;
+
+	this->error = parser_error_none;
+	this->erroroffset = 0;
+	this->integral = 1;
+	this->token = NULL;
+	this->tokens = NULL;
+	this->ntokens = 0;
+	this->next = 0;
+}
+
 struct astnode *
-parser_parse(struct parser *this, char *text)
+parser_parse(struct parser *this, const char *text, size_t len)
 {
+	uint64_t t;
 
 	assert(this);
-	assert(text);
+	assert(text || len == 0);
 
-	this->text = estrdup(text);
-	this->index = 0;
+	/*
+	 * The previous tree, including whatever a failed parse left behind,
+	 * is released here in one go.
+	 */
+	parser_reset(this);
 
+	STATS_START(this->stats, t);
+	this->ntokens = lexer_scan(this->lexer, text, len, &this->tokens);
+	STATS_STOP(this->stats, stats_phase_lex, t);
 
-	if (setjmp(this->jmpbuf) == 0) {
-		parser_getnexttoken(this);
-		return parser_expression(this);
-	} else {
+	if (!parser_getnexttoken(this))
 		return NULL;
-	}
+
+	return parser_expression(this);
 }
 
-/* Private functions */
+enum parser_error
+parser_error(struct parser *this, size_t *offset)
+{
 
-void
-parser_getnexttoken(struct parser *this)
+	assert(this);
+
+	if (offset != NULL)
+		*offset = this->erroroffset;
+
+	return this->error;
+}
+
+size_t
+parser_nvariables(struct parser *this)
 {
 
 	assert(this);
 
-	parser_skipwhitespace(this);
-
-	switch (this->text[this->index]) {
-	case '\0':
-		this->token.type = token_type_eot;
-		break;
-	case '0': case '1': case '2': case '3': case '4':
-	case '5': case '6': case '7': case '8': case '9':
-	case '.':
-		this->token.type = token_type_number;
-		this->token.value = parser_getnumber(this);
-		break;
-	case '+':
-		this->token.type = token_type_plus;
-		++this->index;
-		break;
-	case '-':
-		this->token.type = token_type_minus;
-		++this->index;
-		break;
-	case '*':
-		this->token.type = token_type_mul;
-		++this->index;
-		break;
-	case '/':
-		this->token.type = token_type_div;
-		++this->index;
-		break;
-	case '(':
-		this->token.type = token_type_openparen;
-		++this->index;
-		break;
-	case ')':
-		this->token.type = token_type_closeparen;
-		++this->index;
-		break;
-	default:
-		fprintf(stderr, "Unrecognized input symbol: '%c'\n",
-		        this->text[this->index]);
-		longjmp(this->jmpbuf, 1);
-	}
+	return this->nvars;
 }
 
-void
-parser_skipwhitespace(struct parser *this) 
-{               
+const char *
+parser_variable(struct parser *this, size_t index)
+{
 
 	assert(this);
+	assert(index < this->nvars);
 
-	while(isspace((unsigned char)this->text[this->index]))
-		this->index++;
+	return this->vars[index];
 }
 
-double
-parser_getnumber(struct parser *this) 
+size_t
+parser_variableoffset(struct parser *this, size_t index)
 {
-	char buffer[32] = {};
-	size_t index;
-	size_t delta;
-	double rv;
 
 	assert(this);
+	assert(index < this->nvars);
 
-	parser_skipwhitespace(this);
+	return this->varoffsets[index];
+}
 
-	index = this->index;
+int
+parser_integral(struct parser *this)
+{
 
-	while (isdigit((unsigned char)this->text[this->index]))
-		this->index++;
+	assert(this);
 
-	if (this->text[this->index] == '.')
-		this->index++;
+	return this->integral;
+}
 
-	while (isdigit((unsigned char)this->text[this->index]))
-		this->index++;
+struct arena *
+parser_arena(struct parser *this)
+{
 
-	delta = this->index - index;        
-	if (delta == 0 || delta > __arraycount(buffer)) {
-		fprintf(stderr, "Unrecognized input symbol: '%c'\n",
-		        this->text[this->index]);
-		longjmp(this->jmpbuf, 1);
-	}
+	assert(this);
 
-	memcpy(buffer, &this->text[index], delta);
+	return this->arena;
+}
 
-	/* strtod(3) */
-	rv = atof(buffer);
+struct astnode_table *
+parser_nodes(struct parser *this)
+{
 
-	return rv;
+	assert(this);
+
+	return this->nodes;
 }
 
 void
-parser_match(struct parser *this, enum token_type token)
+parser_setstats(struct parser *this, struct stats *st)
 {
 
 	assert(this);
 
-	if (this->token.type != token) {
-		fprintf(stderr, "Unrecognized input symbol: '%c'\n",
-		        this->text[this->index]);
-		longjmp(this->jmpbuf, 1);
-	}
+	this->stats = st;
 }
 
-struct astnode *
-parser_expression(struct parser *this)
+/* Private functions */
+
+/*
+ * Steps through the lexer's tokens.  The last one, end of text or an
+ * error, is never passed.  Returns 0 after recording an error token.
+ */
+int
+parser_getnexttoken(struct parser *this)
 {
-	struct astnode *tn;
-	struct astnode *e1n;
 
 	assert(this);
+	assert(this->next < this->ntokens);
 
-	tn = parser_term(this);
-	e1n = parser_expression1(this);
+	this->token = &this->tokens[this->next];
+	if (this->next + 1 < this->ntokens)
+		this->next++;
 
-	return parser_new_node(astnode_type_plus, tn, e1n);
+	if (this->token->type == token_type_error) {
+		parser_fail(this, parser_error_symbol);
+		return 0;
+	}
+
+	return 1;
 }
 
+/*
+ * Records the error at the current token and abandons the parse.  Whatever
+ * was built so far stays in the arena until the next reset.
+ */
 struct astnode *
-parser_expression1(struct parser *this)
+parser_fail(struct parser *this, enum parser_error error)
 {
-	struct astnode *tn;
-	struct astnode *e1n;
 
 	assert(this);
+	assert(this->token);
 
-	if (this->token.type == token_type_plus) {
-		parser_getnexttoken(this);
-		tn = parser_term(this);
-		e1n = parser_expression1(this);
-		return parser_new_node(astnode_type_plus, e1n, tn);
-	} else if (this->token.type == token_type_minus) {
-		parser_getnexttoken(this);
-		tn = parser_term(this);
-		e1n = parser_expression1(this);
-		return parser_new_node(astnode_type_minus, e1n, tn);
-	}
+	this->error = error;
+	this->erroroffset = this->token->offset;
 
-	return parser_new_numbernode(0);
+	DPRINTF(("%s(): error=%d offset=%zu\n", __func__, error,
+	    this->erroroffset));
+
+	return NULL;
 }
 
-struct astnode *
-parser_term(struct parser *this)
+/*
+ * Returns the index of the named variable, adding it on first use.
+ * Expressions have few variables, so a linear scan is fine.
+ */
+size_t
+parser_lookupvariable(struct parser *this, const char *name, size_t len,
+                      size_t offset)
 {
-	struct astnode *fn;
-	struct astnode *t1n;
+	char *var;
+	size_t i;
 
 	assert(this);
+	assert(name);
 
-	fn = parser_factor(this);
-	t1n = parser_term1(this);
+	for (i = 0; i < this->nvars; i++) {
+		if (strncmp(this->vars[i], name, len) == 0 &&
+		    this->vars[i][len] == '\0')
+			return i;
+	}
 
-	return parser_new_node(astnode_type_mul, fn, t1n);
+	if (this->nvars == this->varssize) {
+		this->varssize = this->varssize ? this->varssize * 2 : 8;
+		this->vars = erealloc(this->vars,
+		    this->varssize * sizeof(*this->vars));
+		this->varoffsets = erealloc(this->varoffsets,
+		    this->varssize * sizeof(*this->varoffsets));
+	}
+
+	var = arena_alloc(this->arena, len + 1);
+	memcpy(var, name, len);
+	var[len] = '\0';
+
+	this->vars[this->nvars] = var;
+	this->varoffsets[this->nvars] = offset;
+
+	return this->nvars++;
 }
 
 struct astnode *
-parser_term1(struct parser *this)
+parser_expression(struct parser *this)
 {
-	struct astnode *fn;
-	struct astnode *t1n;
+	enum parser_op op;
+	size_t i;
 
 	assert(this);
 
-	if (this->token.type == token_type_mul) {
-		parser_getnexttoken(this);
-		fn = parser_factor(this);
-		t1n = parser_term1(this);
+	for (;;) {
+		/* Prefix operators, then a number or a variable */
+		for (;;) {
+			if (this->token->type == token_type_minus)
+				parser_pushop(this, parser_op_neg);
+			else if (this->token->type == token_type_openparen)
+				parser_pushop(this, parser_op_paren);
+			else
+				break;
+			if (!parser_getnexttoken(this))
+				return NULL;
+		}
+
+		if (this->token->type == token_type_number) {
+			parser_pushoperand(this,
+			    parser_new_numbernode(this, this->token->value));
+		} else if (this->token->type == token_type_variable) {
+			i = parser_lookupvariable(this, this->token->name,
+			    this->token->namelen, this->token->offset);
+			parser_pushoperand(this,
+			    parser_new_variablenode(this, i));
+		} else {
+			return parser_fail(this, parser_error_operand);
+		}
+		if (!parser_getnexttoken(this))
+			return NULL;
+
+		/* Closing parentheses; an unmatched one ends the expression */
+		while (this->token->type == token_type_closeparen) {
+			parser_reduce(this, 1);
+			if (this->nops == 0)
+				break;
+			this->nops--;
+			if (!parser_getnexttoken(this))
+				return NULL;
+		}
+
+		switch (this->token->type) {
+		case token_type_plus:
+			op = parser_op_plus;
+			break;
+		case token_type_minus:
+			op = parser_op_minus;
+			break;
+		case token_type_mul:
+			op = parser_op_mul;
+			break;
+		case token_type_div:
+			op = parser_op_div;
+			break;
+		default:
+			parser_reduce(this, 1);
+			if (this->nops > 0)
+				return parser_fail(this, parser_error_paren);
+			assert(this->noperands == 1);
+
+			return this->operands[0];
+		}
+
+		parser_reduce(this, parser_precedence(op));
+		parser_pushop(this, op);
+		if (!parser_getnexttoken(this))
+			return NULL;
+	}
+}
 
-		return parser_new_node(astnode_type_mul, t1n, fn);
-	} else if (this->token.type == token_type_div) {
-		parser_getnexttoken(this);
-		fn = parser_factor(this);
-		t1n = parser_term1(this);
+void
+parser_pushoperand(struct parser *this, struct astnode *n)
+{
 
-		return parser_new_node(astnode_type_div, t1n, fn);
-	}
+	assert(this);
+	assert(n);
 
-	return parser_new_numbernode(1);
+	if (this->noperands == this->operandssize) {
+		this->operandssize = this->operandssize ?
+		    this->operandssize * 2 : 64;
+		this->operands = erealloc(this->operands,
+		    this->operandssize * sizeof(*this->operands));
+	}
+	this->operands[this->noperands++] = n;
 }
 
-struct astnode *
-parser_factor(struct parser *this)
+void
+parser_pushop(struct parser *this, enum parser_op op)
 {
-	struct astnode *n;
-	double v;
 
 	assert(this);
 
-	if (this->token.type == token_type_openparen) {
-		parser_getnexttoken(this);
-		n = parser_expression(this);
-		parser_match(this, token_type_closeparen);
-		parser_getnexttoken(this);
+	if (this->nops == this->opssize) {
+		this->opssize = this->opssize ? this->opssize * 2 : 64;
+		this->ops = erealloc(this->ops,
+		    this->opssize * sizeof(*this->ops));
+	}
+	this->ops[this->nops++] = op;
+}
+
+/*
+ * Applies the operators on top of the stack whose precedence is at least
+ * the given one.  Parentheses have the lowest precedence, so reducing with
+ * precedence 1 stops at the innermost open one.
+ */
+void
+parser_reduce(struct parser *this, int precedence)
+{
+	struct astnode *l, *r;
+	enum parser_op op;
+	enum astnode_type type;
 
-		return n;
-	} else if (this->token.type == token_type_minus) {
-		parser_getnexttoken(this);
-		n = parser_factor(this);
+	assert(this);
+	assert(precedence > 0);
+
+	while (this->nops > 0) {
+		op = this->ops[this->nops - 1];
+		if (parser_precedence(op) < precedence)
+			break;
+		this->nops--;
+
+		if (op == parser_op_neg) {
+			assert(this->noperands >= 1);
+			l = this->operands[this->noperands - 1];
+			this->operands[this->noperands - 1] =
+			    parser_new_unarynode(this, l);
+			continue;
+		}
+
+		switch (op) {
+		case parser_op_plus:
+			type = astnode_type_plus;
+			break;
+		case parser_op_minus:
+			type = astnode_type_minus;
+			break;
+		case parser_op_mul:
+			type = astnode_type_mul;
+			break;
+		case parser_op_div:
+			type = astnode_type_div;
+			break;
+		default:
+			abort();
+		}
+
+		assert(this->noperands >= 2);
+		r = this->operands[--this->noperands];
+		l = this->operands[this->noperands - 1];
+		this->operands[this->noperands - 1] =
+		    parser_new_node(this, type, l, r);
+	}
+}
 
-		return parser_new_unarynode(n);
-	} else if (this->token.type == token_type_number) {
-		v = this->token.value;
-		parser_getnexttoken(this);
+int
+parser_precedence(enum parser_op op)
+{
 
-		return parser_new_numbernode(v);
+	switch (op) {
+	case parser_op_paren:
+		return 0;
+	case parser_op_plus:
+	case parser_op_minus:
+		return 1;
+	case parser_op_mul:
+	case parser_op_div:
+		return 2;
+	case parser_op_neg:
+		return 3;
+	default:
+		abort();
 	}
 }
 
 struct astnode *
-parser_new_node(enum astnode_type type, struct astnode *left,
-                struct astnode *right)
+parser_new_node(struct parser *this, enum astnode_type type,
+                struct astnode *left, struct astnode *right)
 {
 	struct astnode *n;
 
-	n = astnode_new_node(type, left, right);
+	n = astnode_table_node(this->nodes, type, left, right);
+	if (type == astnode_type_div)
+		this->integral = 0;
+
+	if (this->stats != NULL)
+		this->stats->nodes++;
 
 	DPRINTF(("%s(): node=%p type=%d left=%p right=%p\n", __func__, n, type, left, right));
 
@@ -399,11 +613,14 @@ parser_new_node(enum astnode_type type, struct astnode *left,
 }
 
 struct astnode *
-parser_new_unarynode(struct astnode *left)
+parser_new_unarynode(struct parser *this, struct astnode *left)
 {
 	struct astnode *n;
 
-	n = astnode_new_unarynode(left);
+	n = astnode_table_unarynode(this->nodes, left);
+
+	if (this->stats != NULL)
+		this->stats->nodes++;
 
 	DPRINTF(("%s(): node=%p left=%p\n", __func__, n, left));
 
@@ -411,13 +628,34 @@ parser_new_unarynode(struct astnode *left)
 }
 
 struct astnode *
-parser_new_numbernode(double val)
+parser_new_numbernode(struct parser *this, double val)
 {
 	struct astnode *n;
 
-	n = astnode_new_numbernode(val);
+	n = astnode_table_numbernode(this->nodes, val);
+	if (!(val < (double)(INT64_C(1) << DBL_MANT_DIG) &&
+	    val == (double)(int64_t)val))
+		this->integral = 0;
+
+	if (this->stats != NULL)
+		this->stats->nodes++;
 
 	DPRINTF(("%s(): node=%p val=%lf\n", __func__, n, val));
 
 	return n;
 }
+
+struct astnode *
+parser_new_variablenode(struct parser *this, size_t index)
+{
+	struct astnode *n;
+
+	n = astnode_table_variablenode(this->nodes, index);
+
+	if (this->stats != NULL)
+		this->stats->nodes++;
+
+	DPRINTF(("%s(): node=%p index=%zu\n", __func__, n, index));
+
+	return n;
+}
@@ -32,7 +32,26 @@
 #ifndef __EVALVAL_PARSER_H__
 #define __EVALVAL_PARSER_H__
 
+#include <stddef.h>
+
+/*
+ * A parser is meant to be long-lived: create it once with parser_new(),
+ * call parser_parse() for each input and parser_reset() when the tree is no
+ * longer needed, and parser_delete() it at the end.  Node storage is kept
+ * across resets, so after warm-up parsing does not allocate.
+ */
+
+struct astnode_table;
 struct parser;
+struct stats;
+
+/* Why the last parser_parse() returned NULL */
+enum parser_error {
+	parser_error_none,
+	parser_error_symbol,		/* byte that starts no token */
+	parser_error_operand,		/* no number, variable, "-" or "(" */
+	parser_error_paren		/* ")" expected */
+};
 
 struct parser *
 parser_new(void);
@@ -40,7 +59,71 @@ parser_new(void);
 void
 parser_delete(struct parser *this);
 
+/*
+ * Releases the tree returned by the last parser_parse() in O(1).  Storage is
+ * retained for reuse.  parser_parse() implies a reset.
+ */
+void
+parser_reset(struct parser *this);
+
+/*
+ * Parses len bytes at text, which need not be NUL-terminated and is not
+ * copied: it must stay valid for the duration of the call.  The returned
+ * tree is owned by the parser and stays valid until the next call to
+ * parser_reset(), parser_parse() or parser_delete().  Returns NULL on a
+ * syntax error, which parser_error() then describes.  Nothing is printed.
+ * Identical subexpressions are built once and shared, so the tree is in
+ * fact a DAG; see astnode_table_node().
+ */
 struct astnode *
-parser_parse(struct parser *this, char *text);
+parser_parse(struct parser *this, const char *text, size_t len);
+
+/*
+ * The error of the last parser_parse(), parser_error_none after a success.
+ * If offset is not NULL it receives the byte offset into the text of the
+ * offending token; len when the text ended too early.
+ */
+enum parser_error
+parser_error(struct parser *this, size_t *offset);
+
+/*
+ * Variables of the last parsed expression, numbered in order of first
+ * appearance; astnode_index() of a variable node indexes this list.  Names
+ * are NUL-terminated and share the lifetime of the tree.
+ */
+size_t
+parser_nvariables(struct parser *this);
+
+const char *
+parser_variable(struct parser *this, size_t index);
+
+/* Byte offset into the text of the first appearance of a variable */
+size_t
+parser_variableoffset(struct parser *this, size_t index);
+
+/*
+ * Whether every number of the last tree is an integer smaller than 2^53
+ * and no "/" appears, so that evaluator_eval_exact() is likely to succeed.
+ */
+int
+parser_integral(struct parser *this);
+
+/*
+ * The arena holding the parser's trees.  Nodes allocated from it, e.g. by
+ * optimizer_optimize(), are released together with the tree.
+ */
+struct arena *
+parser_arena(struct parser *this);
+
+/*
+ * The hash-consing table the parser builds its DAGs with, for building
+ * further nodes that share with them, see optimizer_optimize()
+ */
+struct astnode_table *
+parser_nodes(struct parser *this);
+
+/* Count tokenizer time and nodes into st; NULL, the default, disables */
+void
+parser_setstats(struct parser *this, struct stats *st);
 
 #endif /* __EVALVAL_PARSER_H__ */
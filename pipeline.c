@@ -0,0 +1,240 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <err.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <util.h>
+
+#include "calc.h"
+#include "input.h"
+#include "output.h"
+#include "queue.h"
+#include "stats.h"
+
+#include "pipeline.h"
+
+#ifdef DEBUG_PIPELINE
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+/* Batches queued per worker in each direction */
+#define PIPELINE_QUEUEDEPTH	4
+
+struct pipeline_batch {
+	char			*text;
+	size_t			 len;
+	char			*out;
+	size_t			 outlen;
+	size_t			 outsize;
+};
+
+struct pipeline_worker {
+	pthread_t		 thread;
+	struct queue		*in;
+	struct queue		*out;
+	struct calc		*calc;
+	enum input_framing	 framing;
+};
+
+struct pipeline_writer {
+	pthread_t		 thread;
+	struct pipeline_worker	*workers;
+	unsigned		 nworkers;
+	struct output		*out;
+	struct stats		*stats;
+};
+
+static void *
+pipeline_work(void *arg);
+
+static void *
+pipeline_write(void *arg);
+
+static void
+pipeline_calc(struct pipeline_worker *this, struct pipeline_batch *b);
+
+void
+pipeline_run(struct input *in, struct output *out, struct calc **calcs,
+             unsigned nworkers, struct stats *st)
+{
+	struct pipeline_worker *workers;
+	struct pipeline_writer writer;
+	struct pipeline_batch *b;
+	const char *block;
+	uint64_t t;
+	size_t len;
+	unsigned i, next;
+	int error;
+
+	assert(in);
+	assert(out);
+	assert(calcs);
+	assert(nworkers > 0);
+
+	workers = ecalloc(nworkers, sizeof(*workers));
+	for (i = 0; i < nworkers; i++) {
+		workers[i].in = queue_new(PIPELINE_QUEUEDEPTH);
+		workers[i].out = queue_new(PIPELINE_QUEUEDEPTH);
+		workers[i].calc = calcs[i];
+		workers[i].framing = input_framing(in);
+		error = pthread_create(&workers[i].thread, NULL, pipeline_work,
+		    &workers[i]);
+		if (error)
+			errc(EXIT_FAILURE, error, "pthread_create");
+	}
+
+	writer.workers = workers;
+	writer.nworkers = nworkers;
+	writer.out = out;
+	writer.stats = st;
+	error = pthread_create(&writer.thread, NULL, pipeline_write, &writer);
+	if (error)
+		errc(EXIT_FAILURE, error, "pthread_create");
+
+	/* Reader */
+	next = 0;
+	for (;;) {
+		STATS_START(st, t);
+		if (!input_getblock(in, &block, &len))
+			break;
+		b = emalloc(sizeof(*b));
+		b->text = emalloc(len);
+		memcpy(b->text, block, len);
+		b->len = len;
+		b->out = NULL;
+		b->outlen = 0;
+		b->outsize = 0;
+		STATS_STOP(st, stats_phase_input, t);
+
+		DPRINTF(("%s(): batch=%p len=%zu worker=%u\n", __func__, b,
+		    len, next));
+
+		queue_push(workers[next].in, b);
+		next = (next + 1) % nworkers;
+
+		if (st != NULL)
+			stats_poll();
+	}
+
+	/*
+	 * End of stream.  The writer stops at the first worker that passes
+	 * the marker on, which is the one whose turn it is.
+	 */
+	for (i = 0; i < nworkers; i++)
+		queue_push(workers[(next + i) % nworkers].in, NULL);
+
+	pthread_join(writer.thread, NULL);
+	for (i = 0; i < nworkers; i++) {
+		pthread_join(workers[i].thread, NULL);
+		queue_delete(workers[i].in);
+		queue_delete(workers[i].out);
+	}
+	free(workers);
+}
+
+/* Private functions */
+
+void *
+pipeline_work(void *arg)
+{
+	struct pipeline_worker *this;
+	struct pipeline_batch *b;
+
+	this = arg;
+
+	while ((b = queue_pop(this->in)) != NULL) {
+		pipeline_calc(this, b);
+		free(b->text);
+		b->text = NULL;
+		queue_push(this->out, b);
+	}
+	queue_push(this->out, NULL);
+
+	return NULL;
+}
+
+void
+pipeline_calc(struct pipeline_worker *this, struct pipeline_batch *b)
+{
+	const char *pos, *end, *line;
+	size_t len;
+
+	/* Results are usually much shorter than the expressions */
+	b->outsize = b->len + OUTPUT_MAXSIZE;
+	b->out = emalloc(b->outsize);
+
+	pos = b->text;
+	end = b->text + b->len;
+	while (this->framing == input_framing_records ?
+	    input_splitrecord(&pos, end, &line, &len) :
+	    input_splitline(&pos, end, &line, &len)) {
+		if (b->outsize - b->outlen < OUTPUT_MAXSIZE) {
+			b->outsize *= 2;
+			b->out = erealloc(b->out, b->outsize);
+		}
+		b->outlen += calc_line(this->calc, line, len,
+		    &b->out[b->outlen]);
+	}
+}
+
+void *
+pipeline_write(void *arg)
+{
+	struct pipeline_writer *this;
+	struct pipeline_batch *b;
+	unsigned next;
+	uint64_t t;
+
+	this = arg;
+
+	for (next = 0;; next = (next + 1) % this->nworkers) {
+		b = queue_pop(this->workers[next].out);
+		if (b == NULL)
+			break;
+		STATS_START(this->stats, t);
+		output_write(this->out, b->out, b->outlen);
+		STATS_STOP(this->stats, stats_phase_output, t);
+		free(b->out);
+		free(b);
+	}
+
+	return NULL;
+}
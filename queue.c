@@ -0,0 +1,177 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <err.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <util.h>
+
+#include "queue.h"
+
+#ifdef DEBUG_QUEUE
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+#define QUEUE_CACHELINE	64
+
+#define QUEUE_SPINS	128
+#define QUEUE_YIELDS	1024
+#define QUEUE_SLEEPNS	50000
+
+/*
+ * head is written only by the consumer and tail only by the producer; each
+ * side keeps a cached copy of the other's index so that the shared cache
+ * line is only touched when the queue looks full or empty.
+ */
+struct queue {
+	_Alignas(QUEUE_CACHELINE) _Atomic size_t head;
+	size_t			 tailcache;
+	_Alignas(QUEUE_CACHELINE) _Atomic size_t tail;
+	size_t			 headcache;
+	_Alignas(QUEUE_CACHELINE) size_t mask;
+	void			**items;
+};
+
+static void
+queue_backoff(unsigned *attempt);
+
+struct queue *
+queue_new(size_t capacity)
+{
+	struct queue *this;
+	size_t n;
+
+	assert(capacity > 0);
+
+	for (n = 1; n < capacity; n <<= 1)
+		continue;
+
+	this = aligned_alloc(QUEUE_CACHELINE, sizeof(*this));
+	if (this == NULL)
+		err(EXIT_FAILURE, "aligned_alloc");
+	memset(this, 0, sizeof(*this));
+
+	atomic_init(&this->head, 0);
+	atomic_init(&this->tail, 0);
+	this->mask = n - 1;
+	this->items = ecalloc(n, sizeof(*this->items));
+
+	return this;
+}
+
+void
+queue_delete(struct queue *this)
+{
+
+	assert(this);
+
+	free(this->items);
+	free(this);
+}
+
+void
+queue_push(struct queue *this, void *item)
+{
+	size_t tail;
+	unsigned attempt;
+
+	assert(this);
+
+	tail = atomic_load_explicit(&this->tail, memory_order_relaxed);
+
+	for (attempt = 0; tail - this->headcache > this->mask;) {
+		this->headcache = atomic_load_explicit(&this->head,
+		    memory_order_acquire);
+		if (tail - this->headcache <= this->mask)
+			break;
+		queue_backoff(&attempt);
+	}
+
+	this->items[tail & this->mask] = item;
+	atomic_store_explicit(&this->tail, tail + 1, memory_order_release);
+}
+
+void *
+queue_pop(struct queue *this)
+{
+	size_t head;
+	unsigned attempt;
+	void *item;
+
+	assert(this);
+
+	head = atomic_load_explicit(&this->head, memory_order_relaxed);
+
+	for (attempt = 0; head == this->tailcache;) {
+		this->tailcache = atomic_load_explicit(&this->tail,
+		    memory_order_acquire);
+		if (head != this->tailcache)
+			break;
+		queue_backoff(&attempt);
+	}
+
+	item = this->items[head & this->mask];
+	atomic_store_explicit(&this->head, head + 1, memory_order_release);
+
+	return item;
+}
+
+/* Private functions */
+
+void
+queue_backoff(unsigned *attempt)
+{
+	struct timespec ts;
+
+	if (*attempt < QUEUE_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+		__asm __volatile("pause");
+#endif
+	} else if (*attempt < QUEUE_YIELDS) {
+		sched_yield();
+	} else {
+		ts.tv_sec = 0;
+		ts.tv_nsec = QUEUE_SLEEPNS;
+		nanosleep(&ts, NULL);
+		return;
+	}
+	(*attempt)++;
+}
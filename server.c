@@ -0,0 +1,827 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/types.h>
+#include <sys/endian.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <sys/event.h>
+#endif
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <util.h>
+
+#include "calc.h"
+#include "input.h"
+#include "output.h"
+#include "stats.h"
+
+#include "server.h"
+
+#ifdef DEBUG_SERVER
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+#define SERVER_READSIZE		(64 * 1024)
+#define SERVER_MAXLINE		(1024 * 1024)
+/* Replies waiting to be sent before a client is no longer read from */
+#define SERVER_MAXPENDING	(256 * 1024)
+#define SERVER_RECORDHEADER	4
+#define SERVER_MAXLISTEN	8
+#define SERVER_NEVENTS		64
+
+struct server_conn {
+	LIST_ENTRY(server_conn) entries;
+	int		 fd;
+	char		*in;
+	size_t		 inoff;		/* consumed */
+	size_t		 inlen;
+	size_t		 insize;
+	char		*out;
+	size_t		 outoff;	/* sent */
+	size_t		 outlen;
+	size_t		 outsize;
+	int		 eof;
+	int		 reading;	/* events asked for */
+	int		 writing;
+};
+
+struct server_worker {
+	struct server	*server;
+	struct calc	*calc;
+	int		 pfd;		/* epoll or kqueue descriptor */
+	pthread_t	 thread;
+	LIST_HEAD(, server_conn) conns;
+};
+
+struct server {
+	struct server_worker *workers;
+	unsigned	 nworkers;
+	int		 listeners[SERVER_MAXLISTEN];
+	unsigned	 nlisteners;
+	char		*path;		/* Unix socket, removed at the end */
+	int		 wake[2];	/* readable once stopping */
+	enum input_framing framing;
+};
+
+struct server_event {
+	void		*ptr;		/* listener, wake[0] or connection */
+	int		 readable;
+	int		 writable;
+};
+
+static volatile sig_atomic_t server_stop;
+
+static void
+server_catch(int sig);
+
+static void
+server_listen(struct server *this, int fd);
+
+static void *
+server_work(void *arg);
+
+static void
+server_accept(struct server_worker *w, int fd);
+
+static void
+server_conn_io(struct server_worker *w, struct server_conn *c, int readable,
+               int writable);
+
+static int
+server_conn_read(struct server_conn *c);
+
+static int
+server_conn_process(struct server_worker *w, struct server_conn *c);
+
+static int
+server_conn_split(struct server *s, struct server_conn *c, const char **line,
+                  size_t *len);
+
+static int
+server_conn_write(struct server_conn *c);
+
+static void
+server_conn_reserve(struct server_conn *c, size_t n);
+
+static void
+server_conn_close(struct server_worker *w, struct server_conn *c);
+
+static void
+server_poll_new(struct server_worker *w);
+
+static void
+server_poll_add(struct server_worker *w, int fd, void *ptr, int exclusive);
+
+static void
+server_poll_set(struct server_worker *w, struct server_conn *c, int reading,
+                int writing);
+
+static int
+server_poll_wait(struct server_worker *w, struct server_event *ev, int n);
+
+struct server *
+server_new(struct calc **calcs, unsigned nworkers,
+           enum input_framing framing)
+{
+	struct server *this;
+	unsigned i;
+
+	assert(calcs);
+	assert(nworkers > 0);
+
+	this = ecalloc(1, sizeof(*this));
+	this->nworkers = nworkers;
+	this->framing = framing;
+	this->workers = ecalloc(nworkers, sizeof(*this->workers));
+	for (i = 0; i < nworkers; i++) {
+		this->workers[i].server = this;
+		this->workers[i].calc = calcs[i];
+		this->workers[i].pfd = -1;
+		LIST_INIT(&this->workers[i].conns);
+		calc_setreply(calcs[i], 1);
+	}
+
+	if (pipe(this->wake) == -1)
+		err(EXIT_FAILURE, "pipe");
+
+	return this;
+}
+
+void
+server_delete(struct server *this)
+{
+	unsigned i;
+
+	assert(this);
+
+	for (i = 0; i < this->nlisteners; i++)
+		close(this->listeners[i]);
+	if (this->path != NULL) {
+		unlink(this->path);
+		free(this->path);
+	}
+	close(this->wake[0]);
+	close(this->wake[1]);
+	free(this->workers);
+	free(this);
+}
+
+void
+server_listen_unix(struct server *this, const char *path)
+{
+	struct sockaddr_un sun;
+	struct stat st;
+	int fd;
+
+	assert(this);
+	assert(path);
+	assert(this->path == NULL);
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlcpy(sun.sun_path, path, sizeof(sun.sun_path)) >=
+	    sizeof(sun.sun_path))
+		errx(EXIT_FAILURE, "%s: socket path too long", path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		err(EXIT_FAILURE, "socket");
+	/* Only ever remove a socket, never a file given by mistake */
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode))
+			errc(EXIT_FAILURE, EEXIST, "%s", path);
+		if (unlink(path) == -1)
+			err(EXIT_FAILURE, "%s", path);
+	} else if (errno != ENOENT)
+		err(EXIT_FAILURE, "%s", path);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+		err(EXIT_FAILURE, "%s", path);
+
+	this->path = estrdup(path);
+	server_listen(this, fd);
+}
+
+void
+server_listen_tcp(struct server *this, const char *port)
+{
+	struct addrinfo hints, *res, *ai;
+	int error, fd, on;
+
+	assert(this);
+	assert(port);
+
+	/* Without AI_PASSIVE and a host name these are the loopback ones */
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	error = getaddrinfo(NULL, port, &hints, &res);
+	if (error != 0)
+		errx(EXIT_FAILURE, "%s: %s", port, gai_strerror(error));
+
+	on = 1;
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd == -1)
+			continue;
+		(void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on,
+		    sizeof(on));
+		if (ai->ai_family == AF_INET6)
+			(void)setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on,
+			    sizeof(on));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+			close(fd);
+			continue;
+		}
+		server_listen(this, fd);
+	}
+	freeaddrinfo(res);
+
+	if (this->nlisteners == 0)
+		err(EXIT_FAILURE, "port %s", port);
+}
+
+void
+server_run(struct server *this)
+{
+	struct sigaction sa;
+	sigset_t mask, omask;
+	unsigned i;
+	int rv;
+
+	assert(this);
+	assert(this->nlisteners > 0);
+
+	/*
+	 * Signals are taken by this thread only: the workers inherit a mask
+	 * blocking them and are told to stop through the wake pipe.
+	 */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
+	if ((rv = pthread_sigmask(SIG_BLOCK, &mask, &omask)) != 0)
+		errc(EXIT_FAILURE, rv, "pthread_sigmask");
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = server_catch;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGINT, &sa, NULL) == -1 ||
+	    sigaction(SIGTERM, &sa, NULL) == -1)
+		err(EXIT_FAILURE, "sigaction");
+	server_stop = 0;
+
+	for (i = 0; i < this->nworkers; i++) {
+		rv = pthread_create(&this->workers[i].thread, NULL,
+		    server_work, &this->workers[i]);
+		if (rv != 0)
+			errc(EXIT_FAILURE, rv, "pthread_create");
+	}
+
+	while (!server_stop) {
+		sigsuspend(&omask);
+		stats_poll();
+	}
+
+	DPRINTF(("%s(): stopping\n", __func__));
+
+	if (write(this->wake[1], "", 1) == -1)
+		err(EXIT_FAILURE, "write");
+	for (i = 0; i < this->nworkers; i++)
+		pthread_join(this->workers[i].thread, NULL);
+
+	if ((rv = pthread_sigmask(SIG_SETMASK, &omask, NULL)) != 0)
+		errc(EXIT_FAILURE, rv, "pthread_sigmask");
+}
+
+/* Private functions */
+
+void
+server_catch(int sig)
+{
+
+	(void)sig;
+
+	server_stop = 1;
+}
+
+void
+server_listen(struct server *this, int fd)
+{
+
+	assert(this);
+
+	if (this->nlisteners == SERVER_MAXLISTEN)
+		errx(EXIT_FAILURE, "too many listening sockets");
+	if (listen(fd, SOMAXCONN) == -1)
+		err(EXIT_FAILURE, "listen");
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+		err(EXIT_FAILURE, "fcntl");
+
+	this->listeners[this->nlisteners++] = fd;
+}
+
+void *
+server_work(void *arg)
+{
+	struct server_event ev[SERVER_NEVENTS];
+	struct server_worker *w;
+	struct server_conn *c;
+	struct server *s;
+	unsigned i;
+	int j, n;
+
+	w = arg;
+	s = w->server;
+
+	server_poll_new(w);
+	server_poll_add(w, s->wake[0], &s->wake[0], 0);
+	for (i = 0; i < s->nlisteners; i++)
+		server_poll_add(w, s->listeners[i], &s->listeners[i], 1);
+
+	for (;;) {
+		n = server_poll_wait(w, ev, SERVER_NEVENTS);
+		for (j = 0; j < n; j++) {
+			if (ev[j].ptr == &s->wake[0])
+				goto out;
+			if (ev[j].ptr >= (void *)&s->listeners[0] &&
+			    ev[j].ptr < (void *)&s->listeners[s->nlisteners])
+				server_accept(w, *(int *)ev[j].ptr);
+			else
+				server_conn_io(w, ev[j].ptr, ev[j].readable,
+				    ev[j].writable);
+		}
+	}
+
+out:
+	while ((c = LIST_FIRST(&w->conns)) != NULL)
+		server_conn_close(w, c);
+	close(w->pfd);
+
+	return NULL;
+}
+
+/*
+ * Takes one connection per wakeup, leaving the rest to whichever workers
+ * are woken next, so that connections spread over the workers.
+ */
+void
+server_accept(struct server_worker *w, int fd)
+{
+	struct server_conn *c;
+	int cfd, on;
+
+	cfd = accept(fd, NULL, NULL);
+	if (cfd == -1) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK &&
+		    errno != ECONNABORTED && errno != EINTR)
+			warn("accept");
+		return;
+	}
+	if (fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK) == -1)
+		err(EXIT_FAILURE, "fcntl");
+
+	/* Pipelined replies are written in batches already; fails on AF_UNIX */
+	on = 1;
+	(void)setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+	c = ecalloc(1, sizeof(*c));
+	c->fd = cfd;
+	LIST_INSERT_HEAD(&w->conns, c, entries);
+	server_poll_add(w, cfd, c, 0);
+	c->reading = 1;
+
+	DPRINTF(("%s(): conn=%p fd=%d\n", __func__, c, cfd));
+}
+
+/*
+ * Reads what is there, answers every complete line and sends as much as
+ * the socket takes.  Once too much is pending, reading stops until the
+ * client has caught up.
+ */
+void
+server_conn_io(struct server_worker *w, struct server_conn *c, int readable,
+               int writable)
+{
+	size_t pending;
+	int more;
+
+	assert(w);
+	assert(c);
+
+	(void)writable;
+
+	if (readable && c->reading && !server_conn_read(c)) {
+		server_conn_close(w, c);
+		return;
+	}
+
+	for (;;) {
+		more = server_conn_process(w, c);
+		if (!server_conn_write(c)) {
+			server_conn_close(w, c);
+			return;
+		}
+		/* Sent everything: there may be lines left to answer */
+		if (!more || c->outlen > 0)
+			break;
+	}
+
+	pending = c->outlen - c->outoff;
+	if (c->eof && c->inoff == c->inlen && pending == 0) {
+		server_conn_close(w, c);
+		return;
+	}
+
+	server_poll_set(w, c, !c->eof && pending < SERVER_MAXPENDING,
+	    pending > 0);
+}
+
+/* Returns 0 if the connection failed */
+int
+server_conn_read(struct server_conn *c)
+{
+	ssize_t n;
+
+	if (c->inoff > 0) {
+		memmove(c->in, c->in + c->inoff, c->inlen - c->inoff);
+		c->inlen -= c->inoff;
+		c->inoff = 0;
+	}
+	if (c->insize - c->inlen < SERVER_READSIZE) {
+		c->insize = c->inlen + SERVER_READSIZE;
+		c->in = erealloc(c->in, c->insize);
+	}
+
+	n = read(c->fd, c->in + c->inlen, SERVER_READSIZE);
+	if (n == -1)
+		return errno == EAGAIN || errno == EWOULDBLOCK ||
+		    errno == EINTR;
+	if (n == 0)
+		c->eof = 1;
+	c->inlen += (size_t)n;
+
+	return 1;
+}
+
+/*
+ * Answers complete lines until too many replies are pending, in which case
+ * 1 is returned.  Input that cannot be framed ends the session, a line too
+ * long with an error reply.
+ */
+int
+server_conn_process(struct server_worker *w, struct server_conn *c)
+{
+	const char *line;
+	size_t len;
+	int rv;
+
+	while (c->outlen - c->outoff < SERVER_MAXPENDING) {
+		rv = server_conn_split(w->server, c, &line, &len);
+		if (rv == 0)
+			return 0;
+		if (rv == -1) {
+			if (w->server->framing == input_framing_lines) {
+				server_conn_reserve(c, OUTPUT_MAXSIZE);
+				c->outlen += strlcpy(c->out + c->outlen,
+				    "error: Line too long\n", OUTPUT_MAXSIZE);
+			}
+			c->inoff = c->inlen;
+			c->eof = 1;
+			return 0;
+		}
+
+		server_conn_reserve(c, OUTPUT_MAXSIZE);
+		c->outlen += calc_line(w->calc, line, len,
+		    c->out + c->outlen);
+	}
+
+	return 1;
+}
+
+/*
+ * Splits off the next complete line or record; after end of file an
+ * unterminated last line counts.  Returns 0 if there is none yet, or -1 if
+ * the input is longer than SERVER_MAXLINE or ends inside a record.
+ */
+int
+server_conn_split(struct server *s, struct server_conn *c, const char **line,
+                  size_t *len)
+{
+	const char *p, *nl;
+	size_t avail;
+
+	p = c->in + c->inoff;
+	avail = c->inlen - c->inoff;
+
+	if (s->framing == input_framing_records) {
+		if (avail >= SERVER_RECORDHEADER) {
+			*len = le32dec(p);
+			if (*len > SERVER_MAXLINE)
+				return -1;
+			if (*len <= avail - SERVER_RECORDHEADER) {
+				*line = p + SERVER_RECORDHEADER;
+				c->inoff += SERVER_RECORDHEADER + *len;
+				return 1;
+			}
+		}
+		return c->eof && avail > 0 ? -1 : 0;
+	}
+
+	nl = memchr(p, '\n', avail);
+	if (nl != NULL) {
+		*line = p;
+		*len = (size_t)(nl - p);
+		c->inoff += *len + 1;
+		return 1;
+	}
+	if (avail >= SERVER_MAXLINE)
+		return -1;
+	if (c->eof && avail > 0) {
+		*line = p;
+		*len = avail;
+		c->inoff = c->inlen;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Returns 0 if the connection failed */
+int
+server_conn_write(struct server_conn *c)
+{
+	ssize_t n;
+
+	while (c->outoff < c->outlen) {
+		n = send(c->fd, c->out + c->outoff, c->outlen - c->outoff,
+		    MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return 0;
+		}
+		c->outoff += (size_t)n;
+	}
+	if (c->outoff == c->outlen)
+		c->outoff = c->outlen = 0;
+
+	return 1;
+}
+
+/* Makes room for n more bytes of replies */
+void
+server_conn_reserve(struct server_conn *c, size_t n)
+{
+
+	if (c->outsize - c->outlen >= n)
+		return;
+
+	if (c->outoff > 0) {
+		memmove(c->out, c->out + c->outoff, c->outlen - c->outoff);
+		c->outlen -= c->outoff;
+		c->outoff = 0;
+	}
+	while (c->outsize - c->outlen < n) {
+		c->outsize = c->outsize ? c->outsize * 2 : SERVER_READSIZE;
+		c->out = erealloc(c->out, c->outsize);
+	}
+}
+
+void
+server_conn_close(struct server_worker *w, struct server_conn *c)
+{
+
+	assert(w);
+	assert(c);
+
+	DPRINTF(("%s(): conn=%p fd=%d\n", __func__, c, c->fd));
+
+	LIST_REMOVE(c, entries);
+	close(c->fd);
+	free(c->in);
+	free(c->out);
+	free(c);
+}
+
+#ifdef __linux__
+
+void
+server_poll_new(struct server_worker *w)
+{
+
+	if ((w->pfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		err(EXIT_FAILURE, "epoll_create1");
+}
+
+/* Exclusive wakeups keep all workers from waking for one connection */
+void
+server_poll_add(struct server_worker *w, int fd, void *ptr, int exclusive)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+	if (exclusive)
+		ev.events |= EPOLLEXCLUSIVE;
+#endif
+	ev.data.ptr = ptr;
+	if (epoll_ctl(w->pfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+		err(EXIT_FAILURE, "epoll_ctl");
+}
+
+void
+server_poll_set(struct server_worker *w, struct server_conn *c, int reading,
+                int writing)
+{
+	struct epoll_event ev;
+
+	if (c->reading == reading && c->writing == writing)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (reading ? EPOLLIN : 0) | (writing ? EPOLLOUT : 0);
+	ev.data.ptr = c;
+	if (epoll_ctl(w->pfd, EPOLL_CTL_MOD, c->fd, &ev) == -1)
+		err(EXIT_FAILURE, "epoll_ctl");
+
+	c->reading = reading;
+	c->writing = writing;
+}
+
+int
+server_poll_wait(struct server_worker *w, struct server_event *ev, int n)
+{
+	struct epoll_event evs[SERVER_NEVENTS];
+	int i, rv;
+
+	assert(n <= SERVER_NEVENTS);
+
+	rv = epoll_wait(w->pfd, evs, n, -1);
+	if (rv == -1) {
+		if (errno == EINTR)
+			return 0;
+		err(EXIT_FAILURE, "epoll_wait");
+	}
+
+	for (i = 0; i < rv; i++) {
+		ev[i].ptr = evs[i].data.ptr;
+		ev[i].readable = (evs[i].events &
+		    (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+		ev[i].writable = (evs[i].events & EPOLLOUT) != 0;
+	}
+
+	return rv;
+}
+
+#else /* !__linux__ */
+
+void
+server_poll_new(struct server_worker *w)
+{
+
+	if ((w->pfd = kqueue()) == -1)
+		err(EXIT_FAILURE, "kqueue");
+}
+
+/*
+ * Listeners are watched by every worker's kqueue; those that lose the race
+ * for a connection see EAGAIN from accept(2).
+ */
+void
+server_poll_add(struct server_worker *w, int fd, void *ptr, int exclusive)
+{
+	struct kevent ev;
+
+	(void)exclusive;
+
+	EV_SET(&ev, fd, EVFILT_READ, EV_ADD, 0, 0, ptr);
+	if (kevent(w->pfd, &ev, 1, NULL, 0, NULL) == -1)
+		err(EXIT_FAILURE, "kevent");
+}
+
+void
+server_poll_set(struct server_worker *w, struct server_conn *c, int reading,
+                int writing)
+{
+	struct kevent ev[2];
+	int n;
+
+	/* EV_SET() evaluates its first argument more than once */
+	n = 0;
+	if (c->reading != reading) {
+		EV_SET(&ev[n], c->fd, EVFILT_READ,
+		    reading ? EV_ENABLE : EV_DISABLE, 0, 0, c);
+		n++;
+	}
+	/* The write filter is added when first needed */
+	if (c->writing != writing) {
+		EV_SET(&ev[n], c->fd, EVFILT_WRITE,
+		    writing ? EV_ADD | EV_ENABLE : EV_DISABLE, 0, 0, c);
+		n++;
+	}
+	if (n == 0)
+		return;
+	if (kevent(w->pfd, ev, n, NULL, 0, NULL) == -1)
+		err(EXIT_FAILURE, "kevent");
+
+	c->reading = reading;
+	c->writing = writing;
+}
+
+/*
+ * Read and write readiness of a connection come as separate events; they
+ * are merged so that each connection is handled once per batch, as it may
+ * be closed in between.
+ */
+int
+server_poll_wait(struct server_worker *w, struct server_event *ev, int n)
+{
+	struct kevent evs[SERVER_NEVENTS];
+	int i, j, m, rv;
+
+	assert(n <= SERVER_NEVENTS);
+
+	rv = kevent(w->pfd, NULL, 0, evs, n, NULL);
+	if (rv == -1) {
+		if (errno == EINTR)
+			return 0;
+		err(EXIT_FAILURE, "kevent");
+	}
+
+	m = 0;
+	for (i = 0; i < rv; i++) {
+		for (j = 0; j < m; j++) {
+			if (ev[j].ptr == (void *)evs[i].udata)
+				break;
+		}
+		if (j == m) {
+			ev[m].ptr = (void *)evs[i].udata;
+			ev[m].readable = 0;
+			ev[m].writable = 0;
+			m++;
+		}
+		if (evs[i].filter == EVFILT_READ)
+			ev[j].readable = 1;
+		else
+			ev[j].writable = 1;
+	}
+
+	return m;
+}
+
+#endif /* __linux__ */
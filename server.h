@@ -0,0 +1,79 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef __EVALVAL_SERVER_H__
+#define __EVALVAL_SERVER_H__
+
+/*
+ * Evaluation daemon.  Clients send newline-delimited expressions and get
+ * one reply line per expression, in order; they may pipeline any number
+ * of requests without waiting.  Rejected lines are answered with
+ * "error: <message>".  With input_framing_records, requests are records
+ * and replies the binary records of output_format_binary instead.
+ *
+ * Each worker thread runs its own event loop, epoll(7) on Linux and
+ * kqueue(2) elsewhere, with its own calc context.  All workers watch the
+ * listening sockets; a connection stays with the worker that accepted it.
+ */
+
+#include "input.h"
+
+struct calc;
+struct server;
+
+/* calcs[i] belongs to worker i; they are not deleted by the server */
+struct server *
+server_new(struct calc **calcs, unsigned nworkers,
+           enum input_framing framing);
+
+void
+server_delete(struct server *this);
+
+/*
+ * Listens on a Unix domain socket, replacing a stale socket at path; any
+ * other file there is left alone and is an error
+ */
+void
+server_listen_unix(struct server *this, const char *path);
+
+/* Listens on port of the loopback address */
+void
+server_listen_tcp(struct server *this, const char *port);
+
+/*
+ * Serves until SIGINT or SIGTERM, then closes all connections.  SIGUSR1
+ * reports statistics as in stats_poll().
+ */
+void
+server_run(struct server *this);
+
+#endif /* __EVALVAL_SERVER_H__ */
@@ -0,0 +1,224 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <assert.h>
+#include <err.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <util.h>
+
+#include "stats.h"
+
+#ifdef DEBUG_STATS
+#define DPRINTF(a) printf a
+#else
+#define DPRINTF(a)
+#endif
+
+static const char *const stats_phasenames[STATS_NPHASES] = {
+	"input",
+	"lex",
+	"parse",
+	"eval",
+	"cache",
+	"output"
+};
+
+static struct stats **stats_all;
+static size_t stats_n;
+static enum stats_format stats_format;
+static struct timespec stats_start;
+static volatile sig_atomic_t stats_requested;
+
+static void
+stats_catch(int sig);
+
+static void
+stats_sum(struct stats *total);
+
+static void
+stats_text(FILE *fp, const struct stats *st, double seconds);
+
+static void
+stats_json(FILE *fp, const struct stats *st, double seconds);
+
+void
+stats_init(enum stats_format format)
+{
+	struct sigaction sa;
+
+	stats_format = format;
+	clock_gettime(CLOCK_MONOTONIC, &stats_start);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stats_catch;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(SIGUSR1, &sa, NULL) == -1)
+		err(EXIT_FAILURE, "sigaction");
+}
+
+void
+stats_fini(void)
+{
+	size_t i;
+
+	for (i = 0; i < stats_n; i++)
+		free(stats_all[i]);
+	free(stats_all);
+	stats_all = NULL;
+	stats_n = 0;
+}
+
+struct stats *
+stats_new(void)
+{
+	struct stats *this;
+
+	this = ecalloc(1, sizeof(*this));
+
+	stats_all = erealloc(stats_all, (stats_n + 1) * sizeof(*stats_all));
+	stats_all[stats_n++] = this;
+
+	return this;
+}
+
+void
+stats_report(FILE *fp)
+{
+	struct stats total;
+	struct timespec now;
+	double seconds;
+
+	assert(fp);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	seconds = (double)(now.tv_sec - stats_start.tv_sec) +
+	    (double)(now.tv_nsec - stats_start.tv_nsec) / 1e9;
+
+	stats_sum(&total);
+
+	if (stats_format == stats_format_json)
+		stats_json(fp, &total, seconds);
+	else
+		stats_text(fp, &total, seconds);
+	fflush(fp);
+}
+
+void
+stats_poll(void)
+{
+
+	if (stats_requested) {
+		stats_requested = 0;
+		stats_report(stderr);
+	}
+}
+
+/* Private functions */
+
+void
+stats_catch(int sig)
+{
+
+	(void)sig;
+
+	stats_requested = 1;
+}
+
+void
+stats_sum(struct stats *total)
+{
+	const struct stats *st;
+	size_t i, p;
+
+	assert(total);
+
+	memset(total, 0, sizeof(*total));
+	for (i = 0; i < stats_n; i++) {
+		st = stats_all[i];
+		for (p = 0; p < STATS_NPHASES; p++)
+			total->cycles[p] += st->cycles[p];
+		total->lines += st->lines;
+		total->bytes += st->bytes;
+		total->nodes += st->nodes;
+		total->allocated += st->allocated;
+		total->errors += st->errors;
+	}
+}
+
+void
+stats_text(FILE *fp, const struct stats *st, double seconds)
+{
+	uint64_t sum;
+	size_t p;
+
+	sum = 0;
+	for (p = 0; p < STATS_NPHASES; p++)
+		sum += st->cycles[p];
+
+	fprintf(fp, "%" PRIu64 " lines, %" PRIu64 " bytes in %.3f s: "
+	    "%.0f lines/s, %.2f MB/s\n", st->lines, st->bytes, seconds,
+	    seconds > 0 ? (double)st->lines / seconds : 0.0,
+	    seconds > 0 ? (double)st->bytes / seconds / 1e6 : 0.0);
+	for (p = 0; p < STATS_NPHASES; p++)
+		fprintf(fp, "  %-8s %16" PRIu64 " %s %5.1f%%\n",
+		    stats_phasenames[p], st->cycles[p], STATS_CLOCKUNIT,
+		    sum > 0 ? 100.0 * (double)st->cycles[p] / (double)sum :
+		    0.0);
+	fprintf(fp, "%" PRIu64 " nodes, %" PRIu64 " bytes allocated, "
+	    "%" PRIu64 " errors\n", st->nodes, st->allocated, st->errors);
+}
+
+void
+stats_json(FILE *fp, const struct stats *st, double seconds)
+{
+	size_t p;
+
+	fprintf(fp, "{\"lines\": %" PRIu64 ", \"bytes\": %" PRIu64
+	    ", \"seconds\": %.6f, \"lines_per_second\": %.0f, "
+	    "\"unit\": \"%s\", \"phases\": {", st->lines, st->bytes, seconds,
+	    seconds > 0 ? (double)st->lines / seconds : 0.0, STATS_CLOCKUNIT);
+	for (p = 0; p < STATS_NPHASES; p++)
+		fprintf(fp, "%s\"%s\": %" PRIu64, p > 0 ? ", " : "",
+		    stats_phasenames[p], st->cycles[p]);
+	fprintf(fp, "}, \"nodes\": %" PRIu64 ", \"allocated\": %" PRIu64
+	    ", \"errors\": %" PRIu64 "}\n", st->nodes, st->allocated,
+	    st->errors);
+}
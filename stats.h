@@ -0,0 +1,135 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef __EVALVAL_STATS_H__
+#define __EVALVAL_STATS_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Performance counters.  Every thread updates its own struct stats, created
+ * with stats_new(); stats_report() sums all of them.  Code that may run
+ * without statistics takes a NULL struct stats pointer, so the cost of
+ * disabled counters is a branch.
+ *
+ * Phases are timed with the time-stamp counter where there is one and in
+ * nanoseconds otherwise.
+ */
+
+enum stats_phase {
+	stats_phase_input,		/* reading lines */
+	stats_phase_lex,		/* parser_getnexttoken() */
+	stats_phase_parse,		/* building the tree, excluding lex */
+	stats_phase_eval,
+	stats_phase_cache,		/* lookups and inserts */
+	stats_phase_output,		/* formatting and writing */
+	STATS_NPHASES
+};
+
+enum stats_format {
+	stats_format_text,
+	stats_format_json
+};
+
+struct stats {
+	uint64_t	cycles[STATS_NPHASES];
+	uint64_t	lines;
+	uint64_t	bytes;
+	uint64_t	nodes;
+	uint64_t	allocated;	/* arena bytes, summed over lines */
+	uint64_t	errors;		/* rejected lines */
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STATS_CLOCKUNIT	"cycles"
+
+static __inline uint64_t
+stats_clock(void)
+{
+
+	return __builtin_ia32_rdtsc();
+}
+#else
+#define STATS_CLOCKUNIT	"ns"
+
+static __inline uint64_t
+stats_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+/* Time a phase into st, unless st is NULL; t is a uint64_t scratch variable */
+#define STATS_START(st, t)						\
+	do {								\
+		(t) = (st) != NULL ? stats_clock() : 0;			\
+	} while (0)
+
+#define STATS_STOP(st, phase, t)					\
+	do {								\
+		if ((st) != NULL)					\
+			(st)->cycles[(phase)] += stats_clock() - (t);	\
+	} while (0)
+
+/*
+ * Starts the wall clock for lines/s and arranges for SIGUSR1 to request a
+ * report.  Call once, before creating threads.
+ */
+void
+stats_init(enum stats_format format);
+
+void
+stats_fini(void);
+
+/* A zeroed set of counters, included in every report until stats_fini() */
+struct stats *
+stats_new(void);
+
+/*
+ * Writes the sum of all counters to fp.  Counters of running threads are
+ * read without synchronization, so a report taken on SIGUSR1 is
+ * approximate.
+ */
+void
+stats_report(FILE *fp);
+
+/* Reports to stderr if SIGUSR1 arrived since the last call */
+void
+stats_poll(void);
+
+#endif /* __EVALVAL_STATS_H__ */
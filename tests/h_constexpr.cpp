@@ -0,0 +1,179 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <bit>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <err.h>
+
+#include "evalval_constexpr.hpp"
+
+/*
+ * h_constexpr evaluates the samples below through evalval_constexpr.hpp
+ * and prints each as "h_evalval library" prints the same text: the bits of
+ * the value, with the variables bound to h_values[] in order, and the
+ * variable names.  Its input must be the text of the samples, one per
+ * line, so both read the same file and their output can be compared with
+ * the same expected file, bit for bit.
+ *
+ * Constants go through value<>, the others through expression<>.  Those
+ * that value<> must reject are checked to be left to run time.
+ */
+
+static const double h_values[] = {
+	1.5, -2.25, 0.0, -0.0, 3e200, 4.9e-324, 7.0, -1e300, 0.1
+};
+
+static void
+expect(const char *text);
+
+static std::uint64_t
+bits(double v);
+
+/* Whether value<> accepts E */
+template <evalval::literal E>
+static constexpr bool
+constant()
+{
+
+	return evalval::detail::foldable<E,
+	    evalval::detail::program<E>.root>();
+}
+
+template <evalval::literal E>
+static void
+value()
+{
+
+	static_assert(constant<E>());
+	expect(E.s);
+	printf("%016" PRIx64 "\n", bits(evalval::value<E>));
+}
+
+template <evalval::literal E>
+static void
+expression()
+{
+	using expr = evalval::expression<E>;
+
+	static_assert(expr::nvariables <= __arraycount(h_values));
+	expect(E.s);
+	printf("%016" PRIx64, bits(expr::eval(h_values)));
+	for (std::size_t k = 0; k < expr::nvariables; k++)
+		printf(" %.*s", (int)expr::variable(k).size(),
+		    expr::variable(k).data());
+	putchar('\n');
+}
+
+template <evalval::literal E>
+static void
+rejected()
+{
+
+	static_assert(!constant<E>());
+	expression<E>();
+}
+
+int
+main(int argc, char **argv)
+{
+
+	setprogname(argv[0]);
+	if (argc != 1) {
+		fprintf(stderr, "usage: %s\n", getprogname());
+		exit(EXIT_FAILURE);
+	}
+
+	value<"2 * (3 + 4)">();
+	value<"1+2">();
+	value<"-0">();
+	value<"--1">();
+	value<"10-4-3">();
+	value<"2-3*4/5">();
+	value<"0.1+0.2">();
+	value<"1/3">();
+	value<"0.30000000000000004">();
+	value<"123456789012345678901234567890">();
+	value<"2.2250738585072011e-308">();
+	value<"4.9e-324/2">();
+	value<"1e-400">();
+	value<"1.5e308">();
+
+	expression<"x * x - 2 * x + 1">();
+	expression<"x/y+(x-y)*z">();
+	expression<"a+b+c+d+e+f+g+h+i">();
+	expression<"x*0.1+y*0.2+z*0.3+w*0.4-x*0.1">();
+	expression<"1.5-2.5/(x-0.5)">();
+	expression<"(1+2)*x-3/4">();
+
+	rejected<"2.5e308">();
+	rejected<"2.5e308/10">();
+	rejected<"-(1e400)">();
+	rejected<"1e308*10">();
+	rejected<"1/0">();
+	rejected<"x+1e308*10">();
+
+	expect(NULL);
+
+	return EXIT_SUCCESS;
+}
+
+/* Reads the next input line, which must be text, or the end if NULL */
+void
+expect(const char *text)
+{
+	static char *line;
+	static size_t size;
+	ssize_t len;
+
+	len = getline(&line, &size, stdin);
+	if (len > 0 && line[len - 1] == '\n')
+		line[--len] = '\0';
+	if (text == NULL && len != -1)
+		errx(EXIT_FAILURE, "%s: No such sample", line);
+	if (text != NULL && (len == -1 || strcmp(line, text) != 0))
+		errx(EXIT_FAILURE, "%s: Sample out of order", text);
+}
+
+std::uint64_t
+bits(double v)
+{
+
+	return std::bit_cast<std::uint64_t>(v);
+}
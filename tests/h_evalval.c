@@ -0,0 +1,443 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2016 Kamil Rytarowski
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <err.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <util.h>
+
+#include "astnode.h"
+#include "bytecode.h"
+#include "evaluator.h"
+#include "evalval.h"
+#include "incremental.h"
+#include "input.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "parser.h"
+
+/*
+ * Test helper for run.sh, for what evalval(1) cannot show.
+ *
+ * "h_evalval backends" reads one expression per line and prints the bits
+ * of its tree walk, evaluator_evalvars(), with the variables bound to
+ * h_values[] in order.  Every other backend must give the same bits: the
+ * optimized tree, the bytecode VM, the JIT, incremental re-evaluation
+ * and the batch kernels over H_ROWS rows.  One that does not is appended
+ * to the line with its own bits, so any difference fails the comparison.
+ * A line that does not parse prints its error and offset instead.
+ *
+ * "h_evalval library" runs each line through libevalval: evalval_compile()
+ * and evalval_expr_eval() with the variables bound the same way, printing
+ * the bits and the variable names, or the error, offset and message.  A
+ * line without variables must give the same bits through evalval_eval(),
+ * and one with them an unbound variable error there, and the same bits
+ * through evalval_live_eval() as each variable changes.
+ *
+ * "h_evalval catalog file" prints every entry of a catalog written by
+ * evalval -o the same way, or its error and offset.  A rejected or
+ * damaged entry must evaluate to NaN.
+ *
+ * "h_evalval client path" sends its input to the server listening on the
+ * Unix socket path, then closes its side and copies the replies to its
+ * output until the server closes.  The input must be small enough for the
+ * server to take it all before any reply is read.
+ */
+
+#define H_ROWS		19	/* leaves a tail in every kernel */
+
+static const double h_values[] = {
+	1.5, -2.25, 0.0, -0.0, 3e200, 4.9e-324, 7.0, -1e300, 0.1
+};
+
+#define H_NVALUES	__arraycount(h_values)
+
+static void
+usage(void) __dead;
+
+static void
+backends(void);
+
+static void
+backends_line(struct parser *p, struct evaluator *ev, const char *s,
+              size_t len);
+
+static void
+library(void);
+
+static void
+library_line(struct evalval *ev, const char *s, size_t len);
+
+static void
+catalog(const char *path);
+
+static void
+client(const char *path);
+
+static void
+client_write(int fd, const char *buf, size_t len);
+
+static void
+report(const char *name, double v, double want);
+
+static uint64_t
+bits(double v);
+
+int
+main(int argc, char **argv)
+{
+
+	setprogname(argv[0]);
+
+	if (argc == 2 && strcmp(argv[1], "backends") == 0)
+		backends();
+	else if (argc == 2 && strcmp(argv[1], "library") == 0)
+		library();
+	else if (argc == 3 && strcmp(argv[1], "catalog") == 0)
+		catalog(argv[2]);
+	else if (argc == 3 && strcmp(argv[1], "client") == 0)
+		client(argv[2]);
+	else
+		usage();
+
+	return EXIT_SUCCESS;
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s backends\n", getprogname());
+	fprintf(stderr, "       %s library\n", getprogname());
+	fprintf(stderr, "       %s catalog file\n", getprogname());
+	fprintf(stderr, "       %s client path\n", getprogname());
+	exit(EXIT_FAILURE);
+}
+
+/* Private functions */
+
+void
+backends(void)
+{
+	struct evaluator *ev;
+	struct parser *p;
+	struct input *in;
+	const char *line;
+	size_t len;
+
+	p = parser_new();
+	ev = evaluator_new();
+	in = input_open(STDIN_FILENO);
+
+	while (input_getline(in, &line, &len))
+		backends_line(p, ev, line, len);
+
+	input_close(in);
+	evaluator_delete(ev);
+	parser_delete(p);
+}
+
+void
+backends_line(struct parser *p, struct evaluator *ev, const char *s,
+              size_t len)
+{
+	struct incremental_state *st;
+	struct incremental *inc;
+	struct bytecode *bc;
+	struct astnode *n;
+	struct jit *jit;
+	double **columns, *vars, *out, want;
+	float **fcolumns, *fout;
+	enum parser_error error;
+	size_t i, k, nvars, offset;
+
+	n = parser_parse(p, s, len);
+	if (n == NULL) {
+		error = parser_error(p, &offset);
+		printf("error %d at %zu\n", error, offset);
+		parser_reset(p);
+		return;
+	}
+
+	nvars = parser_nvariables(p);
+	vars = ecalloc(nvars + 1, sizeof(*vars));
+	for (k = 0; k < nvars; k++)
+		vars[k] = h_values[k % H_NVALUES];
+
+	want = evaluator_evalvars(ev, n, vars);
+	printf("%016" PRIx64, bits(want));
+
+	n = optimizer_optimize(parser_nodes(p), n);
+	report("optimizer", evaluator_evalvars(ev, n, vars), want);
+
+	bc = bytecode_compile(n);
+	report("bytecode", bytecode_eval(bc, vars), want);
+
+	jit = jit_compile(n);
+	report("jit", jit_eval(jit, vars), want);
+	jit_delete(jit);
+
+	/* Each variable changed in turn, against a walk of the same values */
+	inc = incremental_compile(n, nvars);
+	st = incremental_state_new(inc, vars);
+	report("incremental", incremental_state_eval(st), want);
+	for (k = 0; k < nvars; k++) {
+		vars[k] = h_values[(k + 1) % H_NVALUES];
+		incremental_state_set(st, k, vars[k]);
+		report("incremental", incremental_state_eval(st),
+		    evaluator_evalvars(ev, n, vars));
+	}
+	incremental_state_delete(st);
+	incremental_delete(inc);
+
+	/* Row i binds variable k to h_values[(k + i) % H_NVALUES] */
+	columns = ecalloc(nvars + 1, sizeof(*columns));
+	fcolumns = ecalloc(nvars + 1, sizeof(*fcolumns));
+	for (k = 0; k < nvars; k++) {
+		columns[k] = ecalloc(H_ROWS, sizeof(**columns));
+		fcolumns[k] = ecalloc(H_ROWS, sizeof(**fcolumns));
+		for (i = 0; i < H_ROWS; i++) {
+			columns[k][i] = h_values[(k + i) % H_NVALUES];
+			fcolumns[k][i] = (float)columns[k][i];
+		}
+	}
+	out = ecalloc(H_ROWS, sizeof(*out));
+	fout = ecalloc(H_ROWS, sizeof(*fout));
+	evaluator_eval_batch(ev, bc, (const double *const *)columns, H_ROWS,
+	    out);
+	evaluator_eval_batch_float(ev, bc, (const float *const *)fcolumns,
+	    H_ROWS, fout);
+	for (i = 0; i < H_ROWS; i++) {
+		for (k = 0; k < nvars; k++)
+			vars[k] = columns[k][i];
+		report("batch", out[i], evaluator_evalvars(ev, n, vars));
+		for (k = 0; k < nvars; k++)
+			vars[k] = fcolumns[k][i];
+		report("batch_float", fout[i],
+		    evaluator_eval_float(ev, n, vars));
+	}
+	for (k = 0; k < nvars; k++) {
+		free(columns[k]);
+		free(fcolumns[k]);
+	}
+	free(columns);
+	free(fcolumns);
+	free(out);
+	free(fout);
+
+	putchar('\n');
+
+	bytecode_delete(bc);
+	free(vars);
+	parser_reset(p);
+}
+
+void
+library(void)
+{
+	struct evalval *ev;
+	struct input *in;
+	const char *line;
+	size_t len;
+
+	ev = evalval_new();
+	in = input_open(STDIN_FILENO);
+
+	while (input_getline(in, &line, &len))
+		library_line(ev, line, len);
+
+	input_close(in);
+	evalval_delete(ev);
+}
+
+void
+library_line(struct evalval *ev, const char *s, size_t len)
+{
+	struct evalval_expr *expr;
+	struct evalval_live *live;
+	enum evalval_error error;
+	double *vars, v, want;
+	size_t k, nvars, offset;
+
+	error = evalval_compile(ev, s, len, &expr, &offset);
+	if (error != evalval_error_none) {
+		printf("error %d at %zu: %s\n", error, offset,
+		    evalval_strerror(error));
+		return;
+	}
+
+	nvars = evalval_expr_nvariables(expr);
+	vars = ecalloc(nvars + 1, sizeof(*vars));
+	for (k = 0; k < nvars; k++)
+		vars[k] = h_values[k % H_NVALUES];
+	want = evalval_expr_eval(expr, vars);
+	printf("%016" PRIx64, bits(want));
+	for (k = 0; k < nvars; k++)
+		printf(" %s", evalval_expr_variable(expr, k));
+
+	error = evalval_eval(ev, s, len, &v, &offset);
+	if (nvars == 0 && error == evalval_error_none)
+		report("eval", v, want);
+	else if (nvars == 0 || error != evalval_error_unbound)
+		printf(" eval=error %d at %zu", error, offset);
+
+	live = evalval_live_new(expr, vars);
+	report("live", evalval_live_eval(live), want);
+	for (k = 0; k < nvars; k++) {
+		vars[k] = h_values[(k + 1) % H_NVALUES];
+		evalval_live_set(live, k, vars[k]);
+		report("live", evalval_live_eval(live),
+		    evalval_expr_eval(expr, vars));
+	}
+	evalval_live_delete(live);
+	putchar('\n');
+
+	free(vars);
+	evalval_expr_delete(expr);
+}
+
+void
+catalog(const char *path)
+{
+	struct evalval_catalog *cat;
+	enum evalval_error error;
+	double *vars, v;
+	size_t i, k, nvars, offset;
+
+	cat = evalval_catalog_open(path);
+	if (cat == NULL)
+		err(EXIT_FAILURE, "%s", path);
+
+	for (i = 0; i < evalval_catalog_count(cat); i++) {
+		error = evalval_catalog_error(cat, i, &offset);
+		if (error != evalval_error_none) {
+			printf("error %d at %zu: %s", error, offset,
+			    evalval_strerror(error));
+			v = evalval_catalog_eval(cat, i, NULL);
+			if (!isnan(v))
+				printf(" eval=%016" PRIx64, bits(v));
+			putchar('\n');
+			continue;
+		}
+
+		nvars = evalval_catalog_nvariables(cat, i);
+		vars = ecalloc(nvars + 1, sizeof(*vars));
+		for (k = 0; k < nvars; k++)
+			vars[k] = h_values[k % H_NVALUES];
+		printf("%016" PRIx64, bits(evalval_catalog_eval(cat, i, vars)));
+		for (k = 0; k < nvars; k++)
+			printf(" %s", evalval_catalog_variable(cat, i, k));
+		putchar('\n');
+		free(vars);
+	}
+
+	evalval_catalog_close(cat);
+}
+
+void
+client(const char *path)
+{
+	struct sockaddr_un sun;
+	char buf[BUFSIZ];
+	ssize_t n;
+	int fd;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlcpy(sun.sun_path, path, sizeof(sun.sun_path)) >=
+	    sizeof(sun.sun_path))
+		errx(EXIT_FAILURE, "%s: Path too long", path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		err(EXIT_FAILURE, "socket");
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+		err(EXIT_FAILURE, "%s", path);
+
+	while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+		client_write(fd, buf, (size_t)n);
+	if (n == -1)
+		err(EXIT_FAILURE, "read");
+	if (shutdown(fd, SHUT_WR) == -1)
+		err(EXIT_FAILURE, "shutdown");
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		client_write(STDOUT_FILENO, buf, (size_t)n);
+	if (n == -1)
+		err(EXIT_FAILURE, "%s", path);
+
+	close(fd);
+}
+
+void
+client_write(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n == -1)
+			err(EXIT_FAILURE, "write");
+		buf += n;
+		len -= (size_t)n;
+	}
+}
+
+/* Appends a backend whose result differs from the walk in any bit */
+void
+report(const char *name, double v, double want)
+{
+
+	if (bits(v) != bits(want))
+		printf(" %s=%016" PRIx64, name, bits(v));
+}
+
+uint64_t
+bits(double v)
+{
+	uint64_t u;
+
+	memcpy(&u, &v, sizeof(u));
+
+	return u;
+}
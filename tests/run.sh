@@ -0,0 +1,188 @@
+#!/bin/sh
+#	$NetBSD$
+#
+# Regression tests for evalval(1): run.sh evalval h_evalval h_constexpr srcdir
+#
+# Every check feeds one of the *.in files in srcdir to a command and
+# compares what it writes with an expected file, byte for byte.  Lexers
+# and kernels are forced through EVALVAL_LEXER and EVALVAL_KERNEL; one
+# the CPU lacks falls back to the next, which must agree all the same.
+#
+
+LC_ALL=C
+export LC_ALL
+
+if [ $# -ne 4 ]; then
+	echo "usage: $0 evalval h_evalval h_constexpr srcdir" >&2
+	exit 2
+fi
+
+evalval=$1
+helper=$2
+constexpr=$3
+srcdir=$4
+
+tmp=$(mktemp -d) || exit 2
+trap 'rm -rf "$tmp"' EXIT
+
+passed=0
+failed=0
+
+# check name input expected command [arg ...]: compares standard output
+check()
+{
+	name=$1
+	input=$2
+	expected=$3
+	shift 3
+
+	"$@" < "$srcdir/$input" > "$tmp/out" 2> /dev/null
+	if cmp -s "$srcdir/$expected" "$tmp/out"; then
+		passed=$((passed + 1))
+		echo "ok $name"
+	else
+		failed=$((failed + 1))
+		echo "FAIL $name"
+		diff -au "$srcdir/$expected" "$tmp/out" | head -n 20
+	fi
+}
+
+# Standard error of a command instead of its output
+stderr_of()
+{
+
+	"$@" 2>&1 > /dev/null
+}
+
+# Lines as length-prefixed records for -b, a byte of length is enough
+records()
+{
+	while IFS= read -r line; do
+		printf "\\$(printf %03o ${#line})\\000\\000\\000%s" "$line"
+	done
+}
+
+binary()
+{
+
+	records | "$@" 2> /dev/null | od -An -tx1 -v
+}
+
+# Compiles to a catalog, from records with -b, and reads it back
+roundtrip()
+{
+
+	if [ "$1" = -b ]; then
+		records | "$evalval" -b -o "$tmp/catalog"
+	else
+		"$evalval" -o "$tmp/catalog"
+	fi 2> /dev/null && "$helper" catalog "$tmp/catalog"
+}
+
+# Overwrites bytes of a file at an offset, given as for printf(1)
+overwrite()
+{
+
+	printf "$3" | dd of="$1" bs=1 seek="$2" conv=notrunc 2> /dev/null
+}
+
+# Damages the bytecode of the first entry, after the 40-byte header, and
+# the status of the third, which is rejected; each entry is 32 bytes
+damaged()
+{
+	"$evalval" -o "$tmp/catalog" 2> /dev/null || return
+	size=$(wc -c < "$tmp/catalog")
+	table=$((size - $(wc -l < "$srcdir/catalog.in") * 32))
+	overwrite "$tmp/catalog" 40 '\377\377\377\177'
+	overwrite "$tmp/catalog" $((table + 2 * 32 + 20)) '\143'
+	"$helper" catalog "$tmp/catalog"
+}
+
+# Expands lines of "count repeat middle [close]": repeat and close count
+# times each, around middle, into expressions far deeper than a C stack
+deep()
+{
+
+	awk '{
+		for (i = 0; i < $1; i++)
+			printf "%s", $2
+		printf "%s", $3
+		for (i = 0; i < $1; i++)
+			printf "%s", $4
+		printf "\n"
+	}' | "$@"
+}
+
+# Starts evalval -l on a socket in tmp, with the given arguments, and
+# sends the input through it
+serve()
+{
+	"$evalval" -l "$tmp/socket" "$@" 2> /dev/null &
+	server=$!
+	tries=0
+	while [ ! -S "$tmp/socket" ] && [ $tries -lt 100 ]; do
+		sleep 0.1
+		tries=$((tries + 1))
+	done
+	"$helper" client "$tmp/socket"
+	kill $server
+	wait $server
+}
+
+# Copies the input to a regular file and points evalval -l at it, which
+# must fail at once and leave the file alone, then prints the file
+notsocket()
+{
+	cat > "$tmp/file"
+	"$evalval" -l "$tmp/file" < /dev/null 2> /dev/null &
+	server=$!
+	(sleep 10; kill $server 2> /dev/null) &
+	watchdog=$!
+	wait $server && echo "evalval -l succeeded"
+	kill $watchdog 2> /dev/null
+	cat "$tmp/file"
+}
+
+for lexer in scalar sse4.2 avx2 avx512; do
+	export EVALVAL_LEXER=$lexer
+	check "basic $lexer" basic.in basic.out "$evalval"
+	check "basic stderr $lexer" basic.in basic.err stderr_of "$evalval"
+	check "cache $lexer" cache.in cache.out "$evalval"
+	check "binary $lexer" binary.in binary.out binary "$evalval" -b
+done
+unset EVALVAL_LEXER
+
+check "basic -f" basic.in basic.fixed.out "$evalval" -f
+check "basic -j4" basic.in basic.out "$evalval" -j4
+check "basic -q" basic.in basic.quiet.err stderr_of "$evalval" -q
+check "basic -C 16" basic.in basic.out "$evalval" -C 16
+check "basic --stats" basic.in basic.out "$evalval" --stats -j4
+check "cache -C 16" cache.in cache.out "$evalval" -C 16
+check "cache -C 2" cache.in cache.out "$evalval" -C 2
+check "cache -C 2 -j4" cache.in cache.out "$evalval" -C 2 -j4
+check "int64" int64.in int64.out "$evalval" -t int64
+check "int64 stderr" int64.in int64.err stderr_of "$evalval" -t int64
+check "binary -j4 -C 4" binary.in binary.out binary "$evalval" -b -j4 -C 4
+check "deep" deep.in deep.out deep "$evalval"
+check "deep backends" deep.in deep.backends.out deep "$helper" backends
+check "library" library.in library.out "$helper" library
+check "constexpr library" constexpr.in constexpr.out "$helper" library
+check "constexpr" constexpr.in constexpr.out "$constexpr"
+check "server" basic.in basic.server.out serve
+check "server -j4 -C 16" basic.in basic.server.out serve -j4 -C 16
+check "server -b" binary.in binary.out binary serve -b
+check "server not a socket" basic.in basic.in notsocket
+check "binary -t int64" binary.in binary.int64.out binary "$evalval" -b \
+    -t int64
+check "catalog" catalog.in catalog.out roundtrip
+check "catalog -b" catalog.in catalog.out roundtrip -b
+check "catalog damaged" catalog.in catalog.damaged.out damaged
+
+for kernel in scalar sse2 avx2 avx512; do
+	export EVALVAL_KERNEL=$kernel
+	check "backends $kernel" backends.in backends.out "$helper" backends
+done
+unset EVALVAL_KERNEL
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]
@@ -32,6 +32,8 @@
 #ifndef __EVALVAL_TOKEN_H__
 #define __EVALVAL_TOKEN_H__
 
+#include <stddef.h>
+
 enum token_type {
 	token_type_error,
 	token_type_plus,
@@ -41,12 +43,16 @@ enum token_type {
 	token_type_eot,
 	token_type_openparen,
 	token_type_closeparen,
-	token_type_number
+	token_type_number,
+	token_type_variable
 };
 
 struct token {
-	enum token_type	type;
-	double		value;
+	enum token_type	 type;
+	double		 value;
+	const char	*name;		/* of a variable, not NUL-terminated */
+	size_t		 namelen;
+	size_t		 offset;	/* of the first byte in the text */
 };
 
 #endif /* __EVALVAL_TOKEN_H__ */